@@ -26,7 +26,7 @@ namespace aKode {
 
 Converter::Converter(int sample_width) : m_sample_width(sample_width) {}
 
-template<typename T, typename S, template<typename T> class ArithmT, template<typename S> class ArithmS>
+template<typename T, typename S, template<typename> class ArithmT, template<typename> class ArithmS>
 static bool __doFrameFP(AudioFrame* in, AudioFrame* out, int sample_width)
 {
     AudioConfiguration config = *in;
@@ -64,17 +64,25 @@ static bool __doFrame(AudioFrame* in, AudioFrame* out, int sample_width)
     else
         out = in;
 
-    int width_T = sizeof(T)*8;
-    int shift = width_T - sample_width;
+    // The samples can be narrower than T, such as 24 bits in an int32_t
+    int shift = in->sample_width - sample_width;
 
     int channels = in->channels;
     uint32_t length = in->length;
 
     T** indata = (T**)in->data;
     S** outdata = (S**)out->data;
-    for(int i=0; i<channels; i++)
-        for(uint32_t j=0; j<length; j++)
-            outdata[i][j] = (S)(indata[i][j] >> shift);
+    if (shift >= 0) {
+        for(int i=0; i<channels; i++)
+            for(uint32_t j=0; j<length; j++)
+                outdata[i][j] = (S)(indata[i][j] >> shift);
+    }
+    else {
+        S scale = (S)1 << -shift;
+        for(int i=0; i<channels; i++)
+            for(uint32_t j=0; j<length; j++)
+                outdata[i][j] = (S)indata[i][j] * scale;
+    }
 
     out->sample_width = sample_width;
     return true;
@@ -54,7 +54,7 @@ FastResampler::FastResampler() : speed(1.0), sample_rate(44100) {}
 // A fast resampling by linear interpolation
 // I assume you know binary arithmetics and convertions if you're reading this
 // T is the input/output type, Arithm defines the used arithmetic
-template<typename T, typename S, template<typename S> class Arithm>
+template<typename T, typename S, template<typename> class Arithm>
 static bool _doBuffer(AudioFrame* in, AudioFrame* out, float speed, unsigned sample_rate)
 {
     unsigned long vt_pos_start = 0;  // virtual positions of new sample
@@ -145,6 +145,9 @@ bool FastResampler::doFrame(AudioFrame* in, AudioFrame* out)
         swapFrames(out, in);
         return true;
     }
+    if (in->sample_width < -32) {
+        return _doBuffer<double, double, Arithm_FP>(in, out, speed, sample_rate);
+    } else
     if (in->sample_width < 0) {
         return _doBuffer<float, float, Arithm_FP>(in, out, speed, sample_rate);
     } else
@@ -0,0 +1,286 @@
+/*  aKode: Loudness-Meter
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Steet, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "audioframe.h"
+#include "loudness.h"
+
+#include <cmath>
+#include <stdint.h>
+
+namespace aKode {
+
+// the true-peak interpolator: 4 phases of 12 taps each
+static const int phases = 4;
+static const int taps = 12;
+
+struct LoudnessMeter::private_data
+{
+    struct Channel
+    {
+        double weight;
+        // the state of the two K-weighting biquads
+        double x1[2], x2[2], y1[2], y2[2];
+        // the last few samples, newest at history[at]
+        double history[taps];
+        int at;
+    };
+
+    unsigned int sample_rate;
+    std::vector<Channel> channels;
+
+    // the high shelf, then the high pass
+    double b[2][3], a[2][3];
+    double fir[phases][taps];
+
+    // 100ms of samples, a quarter of a block
+    long hop;
+    long hop_filled;
+    double hop_sum;
+    double subs[4];
+    long sub_count;
+
+    // the mean square of each 400ms block, overlapping by 75%
+    std::vector<double> blocks;
+    double peak;
+};
+
+LoudnessMeter::LoudnessMeter()
+{
+    d = new private_data;
+
+    // a windowed sinc, cut off at the original nyquist
+    const double pi = 3.14159265358979323846;
+    const int length = phases*taps;
+    for (int k=0; k<length; k++) {
+        const double t = (k - (length-1)/2.0) / phases;
+        const double sinc = t == 0 ? 1.0 : std::sin(pi*t)/(pi*t);
+        const double window = 0.5 - 0.5*std::cos(2*pi*(k+0.5)/length);
+        d->fir[k%phases][k/phases] = sinc*window;
+    }
+
+    reset();
+}
+
+LoudnessMeter::~LoudnessMeter()
+{
+    delete d;
+}
+
+void LoudnessMeter::reset()
+{
+    d->sample_rate = 0;
+    d->channels.clear();
+    d->blocks.clear();
+    d->hop = 0;
+    d->hop_filled = 0;
+    d->hop_sum = 0;
+    d->sub_count = 0;
+    d->peak = 0;
+}
+
+// The filters of ITU BS.1770, for any sample rate
+void LoudnessMeter::configure(const AudioFrame* frame)
+{
+    const double pi = 3.14159265358979323846;
+    const double rate = frame->sample_rate;
+
+    {
+        const double f0 = 1681.974450955533;
+        const double G = 3.999843853973347;
+        const double Q = 0.7071752369554196;
+        const double K = std::tan(pi*f0/rate);
+        const double Vh = std::pow(10.0, G/20.0);
+        const double Vb = std::pow(Vh, 0.4996667741545416);
+        const double a0 = 1.0 + K/Q + K*K;
+        d->b[0][0] = (Vh + Vb*K/Q + K*K)/a0;
+        d->b[0][1] = 2.0*(K*K - Vh)/a0;
+        d->b[0][2] = (Vh - Vb*K/Q + K*K)/a0;
+        d->a[0][0] = 1.0;
+        d->a[0][1] = 2.0*(K*K - 1.0)/a0;
+        d->a[0][2] = (1.0 - K/Q + K*K)/a0;
+    }
+    {
+        const double f0 = 38.13547087602444;
+        const double Q = 0.5003270373238773;
+        const double K = std::tan(pi*f0/rate);
+        const double a0 = 1.0 + K/Q + K*K;
+        d->b[1][0] = 1.0;
+        d->b[1][1] = -2.0;
+        d->b[1][2] = 1.0;
+        d->a[1][0] = 1.0;
+        d->a[1][1] = 2.0*(K*K - 1.0)/a0;
+        d->a[1][2] = (1.0 - K/Q + K*K)/a0;
+    }
+
+    d->sample_rate = frame->sample_rate;
+    d->hop = frame->sample_rate/10;
+
+    d->channels.assign(frame->channels, private_data::Channel());
+    for (int c=0; c<frame->channels; c++) {
+        private_data::Channel &ch = d->channels[c];
+        for (int s=0; s<2; s++)
+            ch.x1[s] = ch.x2[s] = ch.y1[s] = ch.y2[s] = 0;
+        for (int t=0; t<taps; t++)
+            ch.history[t] = 0;
+        ch.at = 0;
+        ch.weight = 1.0;
+    }
+    // the surround channels count for more, and LFE for nothing
+    if (frame->channels == 5) {
+        d->channels[3].weight = d->channels[4].weight = 1.41;
+    }
+    else if (frame->channels == 6) {
+        d->channels[3].weight = 0.0;
+        d->channels[4].weight = d->channels[5].weight = 1.41;
+    }
+}
+
+template<typename T>
+void LoudnessMeter::_process(const AudioFrame* frame, double scale)
+{
+    T** data = (T**)frame->data;
+    const int channels = frame->channels;
+
+    for (long i=0; i<frame->length; i++) {
+        for (int c=0; c<channels; c++) {
+            private_data::Channel &ch = d->channels[c];
+            double x = data[c][i]*scale;
+
+            ch.at = (ch.at+1) % taps;
+            ch.history[ch.at] = x;
+            for (int p=0; p<phases; p++) {
+                double y = 0;
+                for (int t=0; t<taps; t++)
+                    y += d->fir[p][t] * ch.history[(ch.at - t + taps) % taps];
+                if (std::fabs(y) > d->peak)
+                    d->peak = std::fabs(y);
+            }
+            if (std::fabs(x) > d->peak)
+                d->peak = std::fabs(x);
+
+            for (int s=0; s<2; s++) {
+                const double y = d->b[s][0]*x + d->b[s][1]*ch.x1[s] + d->b[s][2]*ch.x2[s]
+                    - d->a[s][1]*ch.y1[s] - d->a[s][2]*ch.y2[s];
+                ch.x2[s] = ch.x1[s];
+                ch.x1[s] = x;
+                ch.y2[s] = ch.y1[s];
+                ch.y1[s] = y;
+                x = y;
+            }
+            d->hop_sum += ch.weight*x*x;
+        }
+
+        if (++d->hop_filled == d->hop) {
+            d->subs[d->sub_count%4] = d->hop_sum/d->hop;
+            d->sub_count++;
+            d->hop_filled = 0;
+            d->hop_sum = 0;
+            if (d->sub_count >= 4)
+                d->blocks.push_back((d->subs[0]+d->subs[1]+d->subs[2]+d->subs[3])/4);
+        }
+    }
+}
+
+void LoudnessMeter::process(const AudioFrame* frame)
+{
+    if (!frame || frame->length <= 0 || frame->channels <= 0 || !frame->sample_rate)
+        return;
+    if (d->sample_rate != frame->sample_rate || int(d->channels.size()) != frame->channels)
+        configure(frame);
+
+    const int width = frame->sample_width;
+    if (width == -32)
+        _process<float>(frame, 1.0);
+    else
+    if (width == -64)
+        _process<double>(frame, 1.0);
+    else
+    if (width > 0 && width <= 8)
+        _process<int8_t>(frame, 1.0/(1<<(width-1)));
+    else
+    if (width > 0 && width <= 16)
+        _process<int16_t>(frame, 1.0/(1<<(width-1)));
+    else
+    if (width > 0 && width <= 32)
+        _process<int32_t>(frame, 1.0/(1u<<(width-1)));
+}
+
+// Sums the blocks that are louder than -70 LUFS, and then those
+// that are no more than 10 LU quieter than those were on average
+static void gated(const std::vector<double> &blocks, double &energy, long &count)
+{
+    const double absolute = std::pow(10.0, (-70.0+0.691)/10.0);
+    double sum = 0;
+    long n = 0;
+    for (std::vector<double>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+        if (*i > absolute) {
+            sum += *i;
+            n++;
+        }
+    }
+    energy = 0;
+    count = 0;
+    if (!n) return;
+
+    const double relative = (sum/n) * 0.1;
+    const double threshold = relative > absolute ? relative : absolute;
+    for (std::vector<double>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+        if (*i > threshold) {
+            energy += *i;
+            count++;
+        }
+    }
+}
+
+double LoudnessMeter::integrated() const
+{
+    double energy;
+    long count;
+    gated(d->blocks, energy, count);
+    return count ? toLufs(energy/count) : toLufs(0);
+}
+
+double LoudnessMeter::truePeak() const
+{
+    return d->peak;
+}
+
+double LoudnessMeter::gatedEnergy() const
+{
+    double energy;
+    long count;
+    gated(d->blocks, energy, count);
+    return energy;
+}
+
+long LoudnessMeter::gatedBlocks() const
+{
+    double energy;
+    long count;
+    gated(d->blocks, energy, count);
+    return count;
+}
+
+double LoudnessMeter::toLufs(double energy)
+{
+    if (energy <= 0)
+        return -HUGE_VAL;
+    return -0.691 + 10.0*std::log10(energy);
+}
+
+} // namespace
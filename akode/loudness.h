@@ -0,0 +1,86 @@
+/*  aKode: Loudness-Meter
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Steet, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+#ifndef _AKODE_LOUDNESS_H
+#define _AKODE_LOUDNESS_H
+
+#include "akode_export.h"
+
+#include <vector>
+
+namespace aKode {
+
+class AudioFrame;
+
+//! Measures loudness as EBU R128 describes it
+
+/*!
+ * Frames of a whole track are given to process(), after which integrated()
+ * is its loudness in LUFS and truePeak() its highest sample, found by
+ * oversampling four times.
+ *
+ * To measure an album, its tracks' gatedEnergy() and gatedBlocks() can be
+ * summed. That gates each track on its own, which is close to, but not
+ * quite, gating the album as a whole.
+ */
+class AKODE_EXPORT LoudnessMeter {
+public:
+    LoudnessMeter();
+    ~LoudnessMeter();
+
+    /*!
+     * Forgets everything, so that another track can be measured.
+     */
+    void reset();
+    /*!
+     * Measures another \a frame. The sample rate and channels must stay
+     * the same until reset() is called.
+     */
+    void process(const AudioFrame* frame);
+
+    /*!
+     * Returns the integrated loudness in LUFS, or a very negative number
+     * for silence.
+     */
+    double integrated() const;
+    /*!
+     * Returns the true peak, where 1.0 is full scale.
+     */
+    double truePeak() const;
+
+    /*!
+     * The summed mean square of the blocks that pass both gates.
+     */
+    double gatedEnergy() const;
+    long gatedBlocks() const;
+
+    /*!
+     * Converts a mean square to LUFS.
+     */
+    static double toLufs(double energy);
+
+private:
+    struct private_data;
+    private_data *d;
+
+    void configure(const AudioFrame* frame);
+    template<typename T> void _process(const AudioFrame* frame, double scale);
+};
+
+} // namespace
+
+#endif
@@ -47,18 +47,67 @@
 #define AKODE_DEBUG(x) { }
 #endif
 
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <thread>
 #include <vector>
 
+#include <time.h>
+
 namespace aKode
 {
-    
+
+namespace
+{
+// Adds the time since it was last started to one stage of a Profile
+// after another, starting again each time
+class StageClock
+{
+    double cpu;
+    std::chrono::steady_clock::time_point wall;
+
+    static double threadCpu()
+    {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec/1e9;
+#else
+        // no clock for one thread (Windows), so only wall-time is kept
+        return 0;
+#endif
+    }
+
+public:
+    StageClock() : cpu(0) { }
+    void start()
+    {
+        cpu = threadCpu();
+        wall = std::chrono::steady_clock::now();
+    }
+    void lap(Player::Profile::Stage &stage)
+    {
+        const double c = threadCpu();
+        const std::chrono::steady_clock::time_point w = std::chrono::steady_clock::now();
+        stage.cpu += c - cpu;
+        stage.wall += std::chrono::duration<double>(w - wall).count();
+        cpu = c;
+        wall = w;
+    }
+};
+}
+
+
 struct Player::private_data
 {
     private_data()
         : buffered_decoder(std::make_shared<BufferedDecoder>())
-        , resampler_plugin(&fast_resampler())
-    {}
+        , resampler_plugin(&fast_resampler(), [](ResamplerPlugin*) { })
+    {
+        volume_filter.setVolume(1.0);
+    }
 
     std::shared_ptr<File> src;
 
@@ -66,7 +115,9 @@ struct Player::private_data
     std::shared_ptr<BufferedDecoder> buffered_decoder;
     std::shared_ptr<Resampler> resampler;
     std::shared_ptr<Converter> converter;
-    std::shared_ptr<VolumeFilter> volume_filter;
+    // lives as long as the player, so the player-thread never
+    // sees it come or go
+    VolumeFilter volume_filter;
     std::shared_ptr<Sink> sink;
     std::shared_ptr<Player::Manager> manager;
     std::shared_ptr<Player::Monitor> monitor;
@@ -77,8 +128,17 @@ struct Player::private_data
 
     unsigned int sample_rate=0;
     State state=Closed;
+    float volume=1.0;
+    float gain=1.0;
     int start_pos=0;
 
+    bool profiling=false;
+    Profile profile;
+
+    // the position in milliseconds of what's being heard, written
+    // by the player-thread after each frame
+    std::atomic<long> heard_pos{0};
+
     volatile bool halt=false;
     volatile bool pause=false;
     bool running=false;
@@ -87,6 +147,7 @@ struct Player::private_data
     sem_t pause_sem;
 
     void runThread();
+    void applyVolume();
 };
 
 // The player-thread. It is controlled through the variable halt and pause
@@ -96,6 +157,8 @@ void Player::private_data::runThread()
     AudioFrame re_frame;
     AudioFrame c_frame;
     bool no_error = true;
+    long end_pos = 0;
+    StageClock clock;
 
     while(true)
     {
@@ -107,7 +170,11 @@ void Player::private_data::runThread()
         }
         if (halt) break;
 
+        if (profiling)
+            clock.start();
         no_error = buffered_decoder->readFrame(&frame);
+        if (profiling)
+            clock.lap(profile.read);
 
         if (!no_error)
         {
@@ -126,31 +193,53 @@ void Player::private_data::runThread()
                 r->doFrame(out_frame, &re_frame);
                 out_frame = &re_frame;
             }
+            if (profiling)
+                clock.lap(profile.resample);
 
             if (converter)
             {
                 converter->doFrame(out_frame, &c_frame);
                 out_frame = &c_frame;
             }
+            if (profiling)
+                clock.lap(profile.convert);
 
-            {
-                std::shared_ptr<VolumeFilter> volumeFilter = volume_filter;
-                if (volumeFilter)
-                    volumeFilter->doFrame(out_frame);
-            }
+            if (volume_filter.volume() != 1.0f)
+                volume_filter.doFrame(out_frame);
+            if (profiling)
+                clock.lap(profile.volume);
             
             out_frame->pos = frame.pos;
 
             no_error = sink->writeFrame(out_frame);
+            if (profiling)
+                clock.lap(profile.sink);
 
             if (monitor)
                 monitor->writeFrame(out_frame);
+            if (profiling)
+            {
+                clock.lap(profile.monitor);
+                profile.frames++;
+                profile.samples += out_frame->length;
+            }
 
             if (!no_error)
             {
                 // ### Check type of error
                 goto error;
             }
+
+            // frame.pos is where the decoder was after this frame,
+            // less what's still waiting in the sink is what's heard
+            if (frame.pos >= 0)
+                end_pos = frame.pos;
+            else if (frame.sample_rate)
+                end_pos += frame.length*1000/long(frame.sample_rate);
+            long heard = end_pos;
+            if (const long rate = sink->audioConfiguration()->sample_rate)
+                heard -= sink->delay()*1000/rate;
+            heard_pos.store(std::max(heard, 0L), std::memory_order_relaxed);
         }
     }
 
@@ -365,6 +454,8 @@ void Player::play()
         return;
     }
     d->frame_decoder->seek(0);
+    d->heard_pos.store(0, std::memory_order_relaxed);
+    d->profile = Profile();
 
     // Start buffering
     d->buffered_decoder->start();
@@ -431,34 +522,41 @@ void Player::resume()
 }
 
 
+// The volume and the gain are both done by the one VolumeFilter,
+// which the player-thread skips when there's nothing for it to do
+void Player::private_data::applyVolume()
+{
+    float f = volume*gain;
+    // beyond this, 16 bit samples overflow in the filter
+    if (f > 2.0) f = 2.0;
+
+    volume_filter.setVolume(f);
+}
+
 void Player::setVolume(float f)
 {
     if (f < 0.0 || f > 1.0) return;
 
-    std::shared_ptr<VolumeFilter> vf = d->volume_filter;
-    
-    if (f != 1.0 && !vf)
-    {
-        vf = std::make_shared<VolumeFilter>();
-        vf->setVolume(f);
-        d->volume_filter = vf;
-    }
-    else if (f != 1.0)
-    {
-        vf->setVolume(f);
-    }
-    else if (vf)
-    {
-        vf.reset();
-    }
+    d->volume = f;
+    d->applyVolume();
 }
 
 float Player::volume() const
 {
-    if (std::shared_ptr<VolumeFilter> vf = d->volume_filter)
-        return vf->volume();
-    else
-        return 1.0;
+    return d->volume;
+}
+
+void Player::setGain(float g)
+{
+    if (g <= 0.0) return;
+
+    d->gain = g;
+    d->applyVolume();
+}
+
+float Player::gain() const
+{
+    return d->gain;
 }
 
 std::shared_ptr<File> Player::file() const 
@@ -476,6 +574,11 @@ std::shared_ptr<Decoder> Player::decoder() const
     return d->buffered_decoder;
 }
 
+long Player::position() const
+{
+    return d->heard_pos.load(std::memory_order_relaxed);
+}
+
 std::shared_ptr<Resampler> Player::resampler() const
 {
     return d->resampler;
@@ -506,6 +609,16 @@ void Player::setMonitor(std::shared_ptr<Monitor> monitor)
     d->monitor = monitor;
 }
 
+void Player::setProfiling(bool profiling)
+{
+    d->profiling = profiling;
+}
+
+Player::Profile Player::profile() const
+{
+    return d->profile;
+}
+
 void Player::setState(Player::State state)
 {
     d->state = state;
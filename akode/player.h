@@ -156,6 +156,14 @@ public:
      * Valid in states \a Playing and \a Paused
      */
     float volume() const;
+    /*!
+     * Set a gain of \a g to apply on top of the volume, to make up for
+     * how loud a track is. The two together are limited to 2.0.
+     *
+     * Valid in all states
+     */
+    void setGain(float g);
+    float gain() const;
 
     std::shared_ptr<File> file() const;
     std::shared_ptr<Sink> sink() const;
@@ -169,6 +177,51 @@ public:
      * Used for adjusting playback speed.
      */
     std::shared_ptr<Resampler> resampler() const;
+    /*!
+     * Returns the position in milliseconds of what is being heard now,
+     * counting the samples the sink is still holding. It's kept by the
+     * player-thread, and reading it doesn't lock or touch the decoder,
+     * so it can be called from any thread.
+     *
+     * Valid in states \a Playing and \a Paused
+     */
+    long position() const;
+
+    /*!
+     * How long the player-thread spent on each stage of the frames
+     * it played, in seconds of its own CPU-time and of wall-time.
+     * CPU-time stays 0 where there's no CPU clock for a thread.
+     */
+    struct Profile
+    {
+        struct Stage
+        {
+            double cpu = 0;
+            double wall = 0;
+        };
+        // waiting for and taking each frame from the decoder's buffer
+        Stage read;
+        Stage resample;
+        Stage convert;
+        Stage volume;
+        Stage sink;
+        Stage monitor;
+        long frames = 0;
+        long samples = 0;
+    };
+    /*!
+     * Keeps a Profile while playing. It's off unless this is called,
+     * because it reads the clocks several times for every frame.
+     *
+     * Can only be set before play() is called.
+     */
+    void setProfiling(bool profiling);
+    /*!
+     * Returns the Profile kept since play() was last called.
+     *
+     * Valid in state \a Loaded, after playing.
+     */
+    Profile profile() const;
 
     enum State { Closed  = 0,
                  Open    = 2,
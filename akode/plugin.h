@@ -35,6 +35,10 @@ class AKODE_EXPORT Plugin
     const std::string mPluginName;
 public:
     Plugin(const std::string &pluginname);
+    /*!
+     * Returns the name the plugin was made with, such as "wav_decoder".
+     */
+    const std::string& name() const { return mPluginName; }
 };
     
     
@@ -61,6 +61,7 @@ public:
     bool writeFrame(AudioFrame *frame);
     void pause();
     void resume();
+    long delay();
 
     struct private_data;
 private:
@@ -338,6 +339,17 @@ void ALSASink::resume()
         snd_pcm_pause(m_data->pcm_playback, 0);
 }
 
+long ALSASink::delay()
+{
+    if (m_data->error || !m_data->pcm_playback) return 0;
+
+    snd_pcm_sframes_t frames = 0;
+    // fails during an xrun, when nothing is queued anyway
+    if (snd_pcm_delay(m_data->pcm_playback, &frames) < 0 || frames < 0)
+        frames = 0;
+    return frames + snd_pcm_bytes_to_frames(m_data->pcm_playback, m_data->filled);
+}
+
 template<class T, typename... Params, typename AllocType, typename DeleterType>
 static std::unique_ptr<T, DeleterType> makePtr(AllocType allocator, DeleterType deleter, Params ... params)
 {
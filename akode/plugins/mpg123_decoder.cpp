@@ -37,7 +37,6 @@ using namespace aKode;
 namespace
 {
 
-static bool wasInitialized=false;
 
 static ssize_t fileRead(void *_f, void *data, size_t count)
 {
@@ -110,16 +109,14 @@ MPG123Decoder::MPG123Decoder(File *src)
     mError = false;
     
     int err;
-    if (!wasInitialized)
+    // decoders can be opened by several threads at once,
+    // and this makes sure only one of them initializes
+    static const int initialized = mpg123_init();
+    if (initialized != MPG123_OK)
     {
-        err = mpg123_init();
-        if (err != MPG123_OK)
-        {
-            std::cerr << "mpg123 error: " << std::string(mpg123_plain_strerror(err)) << std::endl;
-            mError = true;
-            return;
-        }
-        wasInitialized=true;
+        std::cerr << "mpg123 error: " << std::string(mpg123_plain_strerror(initialized)) << std::endl;
+        mError = true;
+        return;
     }
     
 
@@ -81,6 +81,12 @@ public:
      * Resume from a paused state
      */
     virtual void resume() {};
+    /*!
+     * Returns how many samples that were written haven't been heard yet,
+     * including any the sink holds before handing them to the device.
+     * Only called from the thread that writes.
+     */
+    virtual long delay() { return 0; }
 };
 
 class SinkPlugin : public Plugin
@@ -25,8 +25,6 @@
 
 namespace aKode {
 
-extern "C" { VoidSinkPlugin void_sink; }
-
 struct VoidSink::private_data
 {
     AudioConfiguration config;
@@ -70,4 +68,28 @@ bool VoidSink::writeFrame(AudioFrame* /*frame*/)
     return true;
 }
 
+namespace
+{
+class VoidSinkPlugin : public SinkPlugin
+{
+public:
+    VoidSinkPlugin() : SinkPlugin("void") { }
+    virtual std::shared_ptr<Sink> openSink(const std::string &)
+    {
+        return std::make_shared<VoidSink>();
+    }
+    virtual std::vector<std::pair<std::string, std::string>> deviceNames()
+    {
+        std::vector<std::pair<std::string, std::string>> result;
+        result.push_back(std::make_pair(std::string(), std::string("Discard")));
+        return result;
+    }
+} plugin;
+}
+
+SinkPlugin& void_sink()
+{
+    return plugin;
+}
+
 } // namespace
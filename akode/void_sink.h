@@ -49,15 +49,11 @@ private:
     private_data *m_data;
 };
 
-class VoidSinkPlugin : public SinkPlugin {
-public:
-    VoidSinkPlugin() : SinkPlugin("void") { }
-    virtual VoidSink* openSink() {
-        return new VoidSink();
-    }
-};
-
-extern "C" AKODE_EXPORT VoidSinkPlugin void_sink;
+/*!
+ * A sink that throws away what it's given, as fast as it's given it.
+ * It has one device, "".
+ */
+extern SinkPlugin& void_sink();
 
 } // namespace
 
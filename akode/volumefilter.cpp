@@ -29,7 +29,7 @@ namespace aKode {
 VolumeFilter::VolumeFilter() : m_volume(0) {}
 
 // T is the input/output type, S is the fast arithmetics type, Arithm is a division definition
-template<typename T, typename S, template<typename S> class Arithm>
+template<typename T, typename S, template<typename> class Arithm>
 static bool _doFrame(AudioFrame* in, AudioFrame* out, int volume)
 {
     T** indata = (T**)in->data;
@@ -43,13 +43,13 @@ static bool _doFrame(AudioFrame* in, AudioFrame* out, int volume)
 
     for(int i=0; i<in->channels; i++) {
         for(int j=0; j<length; j++) {
-            S signal = Arithm<S>::muldiv(outdata[i][j], volume, VM_FIDELITY);
+            S signal = Arithm<S>::muldiv(indata[i][j], volume, VM_FIDELITY);
 
             if (signal > smax) signal = smax;
             else
             if (signal < -smax) signal = -smax;
 
-            indata[i][j] = (T)(signal);
+            outdata[i][j] = (T)(signal);
         }
     }
     return true;
@@ -59,8 +59,13 @@ static bool _doFrame(AudioFrame* in, AudioFrame* out, int volume)
 bool VolumeFilter::doFrame(AudioFrame* in, AudioFrame* out)
 {
     if (!out) out = in;
+    else
+    if (out != in) {
+        out->reserveSpace(in, in->length);
+        out->pos = in->pos;
+    }
 
-    int volint = (int)(m_volume*VM_FIDELITY+0.5);
+    int volint = (int)(m_volume.load(std::memory_order_relaxed)*VM_FIDELITY+0.5);
 
     if (in->sample_width < -32) {
         return _doFrame<double, double, Arithm_FP>(in, out, volint);
@@ -81,11 +86,11 @@ bool VolumeFilter::doFrame(AudioFrame* in, AudioFrame* out)
 }
 
 void VolumeFilter::setVolume(float volume) {
-    m_volume = volume;
+    m_volume.store(volume, std::memory_order_relaxed);
 }
 
 float VolumeFilter::volume() const {
-    return m_volume;
+    return m_volume.load(std::memory_order_relaxed);
 }
 
 } // namespace
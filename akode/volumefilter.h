@@ -20,12 +20,18 @@
 #ifndef _AKODE_VOLUMEFILTER_H
 #define _AKODE_VOLUMEFILTER_H
 
+#include <atomic>
+
 namespace aKode {
 
 class AudioFrame;
 
+/*!
+ * The volume can be set from another thread than the one
+ * filtering, each frame gets either the old or the new one.
+ */
 class VolumeFilter {
-    float m_volume;
+    std::atomic<float> m_volume;
 public:
     VolumeFilter();
     bool doFrame(AudioFrame* in, AudioFrame* out = 0);
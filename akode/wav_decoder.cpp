@@ -85,7 +85,7 @@ bool WavDecoder::openFile(File* src) {
     src->fadvise();
 
     // Get format information
-    char buffer[4];
+    unsigned char buffer[4];
     src->seek(4);
     src->read((char*)buffer, 4); // size of stream
     d->length = buffer[0] + buffer[1]*256 + buffer[2] * (1<<16) + buffer[3] * (1<<24) + 8;
@@ -148,10 +148,12 @@ invalid:
 void WavDecoder::close() {
     d->src->close();
     delete[] d->buffer;
+    d->buffer = 0;
     d->valid = false;
 }
 
 WavDecoder::~WavDecoder() {
+    delete[] d->buffer;
     delete d;
 }
 
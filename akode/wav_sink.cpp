@@ -0,0 +1,244 @@
+/*  aKode: WAV-Sink
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Steet, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "audioframe.h"
+#include "wav_sink.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace aKode {
+
+struct WavSink::private_data
+{
+    private_data() : file(0), configured(false), sample_rate(0), sample_width(0), bytes(0), data_size(0) {}
+
+    std::string filename;
+    FILE *file;
+    AudioConfiguration config;
+    bool configured;
+
+    // what was asked for, 0 for whatever comes
+    unsigned int sample_rate;
+    int sample_width;
+
+    int bytes;
+    unsigned long data_size;
+    std::vector<unsigned char> buffer;
+};
+
+WavSink::WavSink(const std::string &filename, unsigned int sample_rate, int sample_width)
+{
+    d = new private_data;
+    d->filename = filename;
+    d->sample_rate = sample_rate;
+    d->sample_width = sample_width;
+}
+
+WavSink::~WavSink()
+{
+    close();
+    delete d;
+}
+
+bool WavSink::open()
+{
+    if (d->filename.empty() || d->file)
+        return true;
+    d->file = fopen(d->filename.c_str(), "wb");
+    if (!d->file)
+        return false;
+    d->data_size = 0;
+    // filled in by close(), once the sizes are known
+    writeHeader();
+    return true;
+}
+
+static void put16(unsigned char *&p, unsigned int v)
+{
+    *p++ = v & 0xff;
+    *p++ = (v >> 8) & 0xff;
+}
+
+static void put32(unsigned char *&p, unsigned long v)
+{
+    put16(p, v & 0xffff);
+    put16(p, (v >> 16) & 0xffff);
+}
+
+void WavSink::writeHeader()
+{
+    const int channels = d->config.channels;
+    const unsigned long rate = d->config.sample_rate;
+    const int bytes = d->bytes;
+
+    unsigned char header[44];
+    unsigned char *p = header;
+    memcpy(p, "RIFF", 4); p += 4;
+    put32(p, 36 + d->data_size);
+    memcpy(p, "WAVEfmt ", 8); p += 8;
+    put32(p, 16);
+    // PCM or IEEE float
+    put16(p, d->config.sample_width < 0 ? 3 : 1);
+    put16(p, channels);
+    put32(p, rate);
+    put32(p, rate*channels*bytes);
+    put16(p, channels*bytes);
+    put16(p, bytes*8);
+    memcpy(p, "data", 4); p += 4;
+    put32(p, d->data_size);
+
+    fseek(d->file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), d->file);
+    fseek(d->file, 0, SEEK_END);
+}
+
+void WavSink::close()
+{
+    if (!d->file)
+        return;
+    writeHeader();
+    fclose(d->file);
+    d->file = 0;
+}
+
+int WavSink::setAudioConfiguration(const AudioConfiguration* config)
+{
+    if (d->configured) {
+        // it can't change in the middle of a file
+        if (config->channels != d->config.channels)
+            return -1;
+        if (config->sample_rate == d->config.sample_rate
+            && config->sample_width == d->config.sample_width)
+            return 0;
+        return 1;
+    }
+
+    d->config = *config;
+    if (d->sample_rate)
+        d->config.sample_rate = d->sample_rate;
+    if (d->sample_width)
+        d->config.sample_width = d->sample_width;
+    // WAV has no doubles
+    if (d->config.sample_width == -64)
+        d->config.sample_width = -32;
+
+    const int width = d->config.sample_width;
+    if (width == -32)
+        d->bytes = 4;
+    else
+    if (width > 0 && width <= 32)
+        d->bytes = (width+7)/8;
+    else
+        return -1;
+    d->configured = true;
+
+    if (d->config.sample_rate == config->sample_rate
+        && d->config.sample_width == config->sample_width)
+        return 0;
+    return 1;
+}
+
+const AudioConfiguration* WavSink::audioConfiguration() const
+{
+    return &d->config;
+}
+
+// T is the type the samples are kept in, of which the lowest
+// bytes are written, little-endian
+template<typename T>
+void WavSink::_writeFrame(AudioFrame* frame, int bytes)
+{
+    const int channels = frame->channels;
+    const long length = frame->length;
+    d->buffer.resize(length*channels*bytes);
+
+    T** data = (T**)frame->data;
+    unsigned char *p = d->buffer.empty() ? 0 : &d->buffer[0];
+    for (long i=0; i<length; i++) {
+        for (int c=0; c<channels; c++) {
+            T sample = data[c][i];
+            unsigned char *s = (unsigned char*)&sample;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            for (int b=0; b<bytes; b++)
+                *p++ = s[sizeof(T)-1-b];
+#else
+            for (int b=0; b<bytes; b++)
+                *p++ = s[b];
+#endif
+        }
+    }
+}
+
+bool WavSink::writeFrame(AudioFrame* frame)
+{
+    if (!d->configured)
+        return false;
+    if (frame->channels != d->config.channels || frame->sample_width != d->config.sample_width)
+        return false;
+    if (!d->file)
+        return true;
+
+    const int width = frame->sample_width;
+    if (width == -32)
+        _writeFrame<float>(frame, 4);
+    else
+    if (width <= 8) {
+        // WAV 8bit is unsigned
+        _writeFrame<int8_t>(frame, 1);
+        for (std::vector<unsigned char>::iterator i = d->buffer.begin(); i != d->buffer.end(); ++i)
+            *i ^= 0x80;
+    }
+    else
+    if (width <= 16)
+        _writeFrame<int16_t>(frame, 2);
+    else
+        _writeFrame<int32_t>(frame, d->bytes);
+
+    if (d->buffer.empty())
+        return true;
+    if (fwrite(&d->buffer[0], 1, d->buffer.size(), d->file) != d->buffer.size())
+        return false;
+    d->data_size += d->buffer.size();
+    return true;
+}
+
+namespace
+{
+class WavSinkPlugin : public SinkPlugin
+{
+public:
+    WavSinkPlugin() : SinkPlugin("wav") { }
+    virtual std::shared_ptr<Sink> openSink(const std::string &deviceName)
+    {
+        return std::make_shared<WavSink>(deviceName);
+    }
+    virtual std::vector<std::pair<std::string, std::string>> deviceNames()
+    {
+        return std::vector<std::pair<std::string, std::string>>();
+    }
+} plugin;
+}
+
+SinkPlugin& wav_sink()
+{
+    return plugin;
+}
+
+} // namespace
@@ -0,0 +1,65 @@
+/*  aKode: WAV-Sink
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Steet, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+#ifndef _AKODE_WAV_SINK_H
+#define _AKODE_WAV_SINK_H
+
+#include "sink.h"
+#include "akode_export.h"
+
+#include <string>
+
+namespace aKode {
+
+class AudioConfiguration;
+class AudioFrame;
+
+//! A sink that writes a WAV-file as fast as it's given frames
+
+/*!
+ * Nothing is paced, so a Player with this sink plays as fast as it can
+ * decode. With an empty filename, the frames are thrown away instead.
+ *
+ * If a sample_rate or sample_width is given, that's what the sink asks
+ * for, so that the player resamples or converts to it. Otherwise it
+ * takes what the first file has, and asks for the same of the ones after.
+ */
+class AKODE_EXPORT WavSink : public Sink {
+public:
+    WavSink(const std::string &filename, unsigned int sample_rate = 0, int sample_width = 0);
+    ~WavSink();
+    bool open();
+    void close();
+    int setAudioConfiguration(const AudioConfiguration *config);
+    const AudioConfiguration* audioConfiguration() const;
+    bool writeFrame(AudioFrame *frame);
+
+    struct private_data;
+private:
+    template<typename T> void _writeFrame(AudioFrame *frame, int bytes);
+    void writeHeader();
+    private_data *d;
+};
+
+/*!
+ * Opens a WavSink that writes to the file its device is named.
+ */
+extern SinkPlugin& wav_sink();
+
+} // namespace
+
+#endif
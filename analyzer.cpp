@@ -0,0 +1,362 @@
+#include "analyzer.h"
+
+#include <akode/audioframe.h>
+
+#include <qapplication.h>
+#include <qthread.h>
+#include <qmutex.h>
+#include <qwaitcondition.h>
+#include <qevent.h>
+
+#include <atomic>
+#include <algorithm>
+#include <complex>
+#include <cmath>
+
+#include <stdint.h>
+
+namespace
+{
+
+class AnalyzedEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+15);
+	AnalyzedEvent()
+		: QEvent(type)
+	{}
+};
+
+// stereo frames, about 370ms at 44.1kHz. Must be a power of two
+const unsigned ringSize = 16384;
+const int fftSize = 2*Meow::Analyzer::spectrumSize;
+// what silence is reported as
+const float floorDb = -100.0f;
+
+template<typename T>
+void copySamples(const aKode::AudioFrame *frame, float scale, float (*to)[2], unsigned at, unsigned mask)
+{
+	T **const data = reinterpret_cast<T**>(frame->data);
+	// mono goes to both sides, and past the first two channels are ignored
+	const T *const left = data[0];
+	const T *const right = data[frame->channels > 1 ? 1 : 0];
+	for (long i=0; i < frame->length; i++)
+	{
+		float *const f = to[(at+i) & mask];
+		f[0] = left[i]*scale;
+		f[1] = right[i]*scale;
+	}
+}
+
+void fft(std::complex<float> *x, const std::complex<float> *twiddle)
+{
+	for (int i=1, j=0; i < fftSize; i++)
+	{
+		int bit = fftSize >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(x[i], x[j]);
+	}
+
+	for (int len=2; len <= fftSize; len <<= 1)
+	{
+		const int step = fftSize/len;
+		for (int i=0; i < fftSize; i += len)
+		{
+			for (int k=0; k < len/2; k++)
+			{
+				const std::complex<float> t = twiddle[k*step] * x[i+k+len/2];
+				x[i+k+len/2] = x[i+k] - t;
+				x[i+k] += t;
+			}
+		}
+	}
+}
+
+}
+
+/**
+ * The frames on their way from the output thread to the Worker.
+ * There's one of each, so the position each is at is all
+ * that needs to be shared between them
+ **/
+struct Meow::Analyzer::Ring
+{
+	Ring() : enabled(false), written(0), read(0), sampleRate(0), overruns(0) { }
+
+	std::atomic<bool> enabled;
+	// only the output thread moves written, and only the Worker read
+	std::atomic<unsigned> written;
+	std::atomic<unsigned> read;
+	std::atomic<int> sampleRate;
+	std::atomic<quint64> overruns;
+
+	float frames[ringSize][2];
+};
+
+class Meow::Analyzer::Tap : public aKode::Player::Monitor
+{
+	const std::shared_ptr<Ring> ring;
+
+public:
+	Tap(const std::shared_ptr<Ring> &ring)
+		: ring(ring)
+	{
+	}
+
+	// in the output thread, so this must never wait on anything
+	virtual void writeFrame(aKode::AudioFrame *frame)
+	{
+		if (!ring->enabled.load(std::memory_order_relaxed))
+			return;
+		if (!frame->channels || frame->length <= 0)
+			return;
+
+		const unsigned at = ring->written.load(std::memory_order_relaxed);
+		const unsigned room = ringSize - (at - ring->read.load(std::memory_order_acquire));
+		if (unsigned(frame->length) > room)
+		{
+			ring->overruns.fetch_add(frame->length, std::memory_order_relaxed);
+			return;
+		}
+
+		const int width = frame->sample_width;
+		if (width == -32)
+			copySamples<float>(frame, 1.0f, ring->frames, at, ringSize-1);
+		else if (width == -64)
+			copySamples<double>(frame, 1.0f, ring->frames, at, ringSize-1);
+		else if (width > 0 && width <= 8)
+			copySamples<int8_t>(frame, 1.0f/(1<<(width-1)), ring->frames, at, ringSize-1);
+		else if (width > 0 && width <= 16)
+			copySamples<int16_t>(frame, 1.0f/(1<<(width-1)), ring->frames, at, ringSize-1);
+		else if (width > 0 && width <= 32)
+			copySamples<int32_t>(frame, 1.0f/(1u<<(width-1)), ring->frames, at, ringSize-1);
+		else
+			return;
+
+		ring->sampleRate.store(frame->sample_rate, std::memory_order_relaxed);
+		ring->written.store(at + frame->length, std::memory_order_release);
+	}
+};
+
+struct Meow::Analyzer::Private
+{
+	std::shared_ptr<Ring> ring;
+	std::shared_ptr<Tap> tap;
+	Worker *worker;
+	int rate;
+
+	// the Worker makes the next Result on its own and only
+	// holds this long enough to swap it in
+	mutable QMutex resultLock;
+	Result result;
+	// so that a busy GUI only gets one AnalyzedEvent at a time
+	std::atomic<bool> posted;
+};
+
+class Meow::Analyzer::Worker : public QThread
+{
+	Analyzer *const analyzer;
+	Private *const d;
+
+	QMutex lock;
+	QWaitCondition wake;
+	bool stopping;
+
+	// the last fftSize samples, mixed down, oldest at history[at]
+	float history[fftSize];
+	int at;
+	float window[fftSize];
+	float windowSum;
+	std::complex<float> twiddle[fftSize/2];
+	std::complex<float> bins[fftSize];
+
+	void analyze(Result &result)
+	{
+		Ring *const ring = d->ring.get();
+		const unsigned written = ring->written.load(std::memory_order_acquire);
+		unsigned read = ring->read.load(std::memory_order_relaxed);
+		const unsigned count = written - read;
+
+		double squares[2] = { 0.0, 0.0 };
+		float peak[2] = { 0.0f, 0.0f };
+		for (; read != written; read++)
+		{
+			const float *const f = ring->frames[read & (ringSize-1)];
+			for (int c=0; c < 2; c++)
+			{
+				squares[c] += f[c]*f[c];
+				peak[c] = std::max(peak[c], std::fabs(f[c]));
+			}
+			history[at] = (f[0]+f[1])*0.5f;
+			at = (at+1) % fftSize;
+		}
+		ring->read.store(read, std::memory_order_release);
+
+		result.rms.resize(2);
+		result.peak.resize(2);
+		for (int c=0; c < 2; c++)
+		{
+			result.rms[c] = count ? std::sqrt(squares[c]/count) : 0.0f;
+			result.peak[c] = peak[c];
+		}
+
+		for (int i=0; i < fftSize; i++)
+			bins[i] = history[(at+i) % fftSize] * window[i];
+		fft(bins, twiddle);
+
+		result.spectrum.resize(spectrumSize);
+		for (int i=0; i < spectrumSize; i++)
+		{
+			const float magnitude = 2*std::abs(bins[i])/windowSum;
+			result.spectrum[i] = magnitude > 0
+				? std::max(20*std::log10(magnitude), floorDb)
+				: floorDb;
+		}
+
+		result.sampleRate = ring->sampleRate.load(std::memory_order_relaxed);
+		result.overruns = ring->overruns.load(std::memory_order_relaxed);
+	}
+
+public:
+	Worker(Analyzer *analyzer, Private *d)
+		: analyzer(analyzer), d(d), stopping(false), at(0)
+	{
+		const double pi = 3.14159265358979323846;
+		windowSum = 0;
+		for (int i=0; i < fftSize; i++)
+		{
+			// Hann
+			window[i] = 0.5 - 0.5*std::cos(2*pi*i/(fftSize-1));
+			windowSum += window[i];
+			history[i] = 0;
+		}
+		for (int i=0; i < fftSize/2; i++)
+			twiddle[i] = std::polar(1.0f, float(-2*pi*i/fftSize));
+	}
+
+	void stop()
+	{
+		lock.lock();
+		stopping = true;
+		wake.wakeAll();
+		lock.unlock();
+		wait();
+	}
+
+	virtual void run()
+	{
+		// whatever is left from before was heard long ago
+		d->ring->read.store(
+				d->ring->written.load(std::memory_order_acquire),
+				std::memory_order_release
+			);
+
+		Result result;
+		lock.lock();
+		while (!stopping)
+		{
+			wake.wait(&lock, 1000/d->rate);
+			if (stopping)
+				break;
+			lock.unlock();
+
+			// while paused there's nothing to say
+			if (d->ring->written.load(std::memory_order_acquire)
+				!= d->ring->read.load(std::memory_order_relaxed))
+			{
+				analyze(result);
+				d->resultLock.lock();
+				d->result = result;
+				d->resultLock.unlock();
+
+				if (!d->posted.exchange(true))
+					QApplication::postEvent(analyzer, new AnalyzedEvent);
+			}
+
+			lock.lock();
+		}
+		lock.unlock();
+	}
+};
+
+
+Meow::Analyzer::Analyzer(QObject *parent)
+	: QObject(parent)
+{
+	d = new Private;
+	d->ring = std::make_shared<Ring>();
+	d->tap = std::make_shared<Tap>(d->ring);
+	d->worker = 0;
+	d->rate = 25;
+	d->posted = false;
+}
+
+Meow::Analyzer::~Analyzer()
+{
+	setEnabled(false);
+	delete d;
+}
+
+std::shared_ptr<aKode::Player::Monitor> Meow::Analyzer::monitor() const
+{
+	return d->tap;
+}
+
+bool Meow::Analyzer::isEnabled() const
+{
+	return d->worker;
+}
+
+void Meow::Analyzer::setEnabled(bool enabled)
+{
+	if (enabled == isEnabled())
+		return;
+
+	if (enabled)
+	{
+		d->worker = new Worker(this, d);
+		d->worker->start(QThread::LowPriority);
+		d->ring->enabled = true;
+	}
+	else
+	{
+		d->ring->enabled = false;
+		d->worker->stop();
+		delete d->worker;
+		d->worker = 0;
+	}
+}
+
+int Meow::Analyzer::rate() const
+{
+	return d->rate;
+}
+
+void Meow::Analyzer::setRate(int perSecond)
+{
+	const bool enabled = isEnabled();
+	setEnabled(false);
+	d->rate = qBound(1, perSecond, 100);
+	setEnabled(enabled);
+}
+
+Meow::Analyzer::Result Meow::Analyzer::result() const
+{
+	QMutexLocker locker(&d->resultLock);
+	return d->result;
+}
+
+bool Meow::Analyzer::event(QEvent *e)
+{
+	if (e->type() != AnalyzedEvent::type)
+		return QObject::event(e);
+
+	d->posted = false;
+	emit analyzed();
+	return true;
+}
+
+// kate: space-indent off; replace-tabs off;
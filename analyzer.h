@@ -0,0 +1,93 @@
+#ifndef MEOW_ANALYZER_H
+#define MEOW_ANALYZER_H
+
+#include <qobject.h>
+#include <qvector.h>
+
+#include <akode/player.h>
+
+#include <memory>
+
+namespace Meow
+{
+
+/**
+ * Measures what's being played: the level of each channel, and
+ * its spectrum.
+ *
+ * The player's output thread hands each frame to @ref monitor, which
+ * only copies it into a ring without locking or waiting. If the ring
+ * is full, the frame is dropped and counted in Result::overruns,
+ * so a slow analysis can never hold up playback. A thread of
+ * our own takes what's in the ring @ref rate times a second and
+ * analyzes it; the newest Result is fetched with @ref result
+ * whenever @ref analyzed is emitted.
+ *
+ * Nothing is measured until it's enabled
+ **/
+class Analyzer : public QObject
+{
+	Q_OBJECT
+	struct Private;
+	struct Ring;
+	class Tap;
+	class Worker;
+	Private *d;
+
+public:
+	struct Result
+	{
+		Result() : sampleRate(0), overruns(0) { }
+
+		// for each of the first two channels, from 0 to 1,
+		// of the samples since the previous result
+		QVector<float> rms, peak;
+		// in dB, @ref spectrumSize bands evenly spaced from
+		// 0 to half of sampleRate
+		QVector<float> spectrum;
+		int sampleRate;
+		// how many samples were dropped because the ring was full
+		quint64 overruns;
+	};
+
+	static const int spectrumSize = 1024;
+
+	Analyzer(QObject *parent);
+	~Analyzer();
+
+	/**
+	 * what the player gives its frames to
+	 **/
+	std::shared_ptr<aKode::Player::Monitor> monitor() const;
+
+	bool isEnabled() const;
+	/**
+	 * start or stop measuring, which costs nothing
+	 * in the output thread while it's off
+	 **/
+	void setEnabled(bool enabled);
+
+	int rate() const;
+	/**
+	 * produce @p perSecond results each second
+	 **/
+	void setRate(int perSecond);
+
+	Result result() const;
+
+signals:
+	/**
+	 * there's a new @ref result. If there's another before this
+	 * is handled, it's only emitted once
+	 **/
+	void analyzed();
+
+protected:
+	virtual bool event(QEvent *e);
+};
+
+}
+
+#endif
+
+// kate: space-indent off; replace-tabs off;
@@ -0,0 +1,468 @@
+/*
+ * Decodes files with each of aKode's decoders into a void sink, as fast
+ * as it can, and prints how it went as JSON:
+ *
+ *   bench_decoders [--repeat N] [--seconds S] [--no-generate] [file|dir]...
+ *
+ * WAV fixtures of every width the WAV decoder handles are generated
+ * first (S seconds long, the same every time); other formats come from
+ * the files and directories given. Each file is measured in its own
+ * process, so that its peak RSS is its own.
+ */
+
+#include "decoders.h"
+
+#include <akode/audioframe.h>
+#include <akode/decoder.h>
+#include <akode/mmapfile.h>
+#include <akode/localfile.h>
+#include <akode/void_sink.h>
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+static std::atomic<unsigned long> allocations(0);
+
+void* operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+namespace
+{
+
+// a decoder that keeps not giving a frame without saying
+// why is given up on after this many tries
+const int maxBlips = 1000;
+
+double seconds(clockid_t clock)
+{
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+long peakRssKib()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+std::string quoted(const std::string &s)
+{
+	std::string q = "\"";
+	for (std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+	{
+		const unsigned char c = *i;
+		if (c == '"' || c == '\\')
+		{
+			q += '\\';
+			q += c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			q += escaped;
+		}
+		else
+			q += c;
+	}
+	return q + "\"";
+}
+
+void put16(std::string &s, unsigned v)
+{
+	s += char(v & 0xff);
+	s += char((v >> 8) & 0xff);
+}
+
+void put32(std::string &s, unsigned long v)
+{
+	put16(s, v & 0xffff);
+	put16(s, (v >> 16) & 0xffff);
+}
+
+/**
+ * write a tone with some noise under it, the same every time
+ **/
+bool writeWav(const std::string &path, int channels, unsigned rate, int width, int seconds)
+{
+	const int bytes = width/8;
+	const unsigned long frames = (unsigned long)rate*seconds;
+	const unsigned long dataSize = frames*channels*bytes;
+
+	std::string header = "RIFF";
+	put32(header, 36 + dataSize);
+	header += "WAVEfmt ";
+	put32(header, 16);
+	put16(header, 1);
+	put16(header, channels);
+	put32(header, rate);
+	put32(header, rate*channels*bytes);
+	put16(header, channels*bytes);
+	put16(header, width);
+	header += "data";
+	put32(header, dataSize);
+
+	FILE *const f = std::fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	std::fwrite(header.data(), 1, header.size(), f);
+
+	const double pi = 3.14159265358979323846;
+	uint32_t noise = 22222;
+	std::vector<unsigned char> block;
+	for (unsigned long i=0; i < frames; i++)
+	{
+		for (int c=0; c < channels; c++)
+		{
+			noise = noise*1664525u + 1013904223u;
+			const double v = 0.5*std::sin(2*pi*(440.0*(c+1))*i/rate)
+				+ 0.03*(int32_t(noise)/2147483648.0);
+			if (width == 8)
+				block.push_back((unsigned char)(128 + std::lrint(v*127)));
+			else
+			{
+				const int32_t s = int32_t(std::lrint(v*((1u << (width-1)) - 1)));
+				for (int b=0; b < bytes; b++)
+					block.push_back((unsigned char)((uint32_t(s) >> (8*b)) & 0xff));
+			}
+		}
+		if (block.size() >= 65536)
+		{
+			std::fwrite(&block[0], 1, block.size(), f);
+			block.clear();
+		}
+	}
+	if (!block.empty())
+		std::fwrite(&block[0], 1, block.size(), f);
+	return std::fclose(f) == 0;
+}
+
+struct Run
+{
+	Run() : frames(0), samples(0), allocations(0), cpu(0), wall(0), ok(false) { }
+	long frames;
+	long samples;
+	unsigned long allocations;
+	double cpu, wall;
+	bool ok;
+};
+
+Run decodeOnce(aKode::File *src, aKode::DecoderPlugin *plugin, aKode::AudioConfiguration &config)
+{
+	Run run;
+	const std::shared_ptr<aKode::Sink> sink = aKode::void_sink().openSink("");
+	sink->open();
+
+	const unsigned long allocs = allocations.load(std::memory_order_relaxed);
+	const double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+	const double wall = seconds(CLOCK_MONOTONIC);
+
+	std::unique_ptr<aKode::Decoder> decoder(plugin->openDecoder(src));
+	if (!decoder)
+		return run;
+
+	aKode::AudioFrame frame;
+	int blips=0;
+	while (true)
+	{
+		if (decoder->readFrame(&frame))
+		{
+			if (frame.length <= 0)
+				continue;
+			if (!run.frames)
+			{
+				config = frame;
+				sink->setAudioConfiguration(&config);
+			}
+			sink->writeFrame(&frame);
+			run.frames++;
+			run.samples += frame.length;
+			blips = 0;
+		}
+		else if (decoder->eof())
+			break;
+		else if (decoder->error() || ++blips == maxBlips)
+			return run;
+	}
+	decoder.reset();
+	src->close();
+
+	run.wall = seconds(CLOCK_MONOTONIC) - wall;
+	run.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+	run.allocations = allocations.load(std::memory_order_relaxed) - allocs;
+	run.ok = run.frames > 0 && config.sample_rate > 0;
+	return run;
+}
+
+/**
+ * measure @p path, in this process, and return its JSON
+ **/
+std::string measure(const std::string &path, int repeat)
+{
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\"file\": " << quoted(path);
+
+	std::unique_ptr<aKode::File> src(new aKode::MMapFile(path));
+	if (!src->openRO())
+	{
+		src.reset(new aKode::LocalFile(path));
+		if (!src->openRO())
+		{
+			json << ", \"error\": \"unreadable\"}";
+			return json.str();
+		}
+	}
+	src->close();
+
+	aKode::DecoderPlugin *plugin = 0;
+	const std::vector<aKode::DecoderPlugin*> plugins = decoderPlugins();
+	for (std::vector<aKode::DecoderPlugin*>::const_iterator i = plugins.begin(); i != plugins.end(); ++i)
+	{
+		if ((*i)->canDecode(src.get()))
+		{
+			plugin = *i;
+			break;
+		}
+	}
+	if (!plugin)
+	{
+		json << ", \"error\": \"no decoder\"}";
+		return json.str();
+	}
+	json << ", \"decoder\": " << quoted(plugin->name());
+
+	aKode::AudioConfiguration config;
+	Run best;
+	for (int r=0; r < repeat; r++)
+	{
+		const Run run = decodeOnce(src.get(), plugin, config);
+		if (!run.ok)
+		{
+			json << ", \"error\": \"decoding failed\"}";
+			return json.str();
+		}
+		if (!best.ok || run.cpu < best.cpu)
+			best = run;
+	}
+
+	const double decoded = double(best.samples)/config.sample_rate;
+	json << ", \"channels\": " << int(config.channels)
+		<< ", \"sample_rate\": " << config.sample_rate
+		<< ", \"sample_width\": " << int(config.sample_width)
+		<< ", \"frames\": " << best.frames
+		<< ", \"decoded_seconds\": " << decoded
+		<< ", \"cpu_seconds\": " << best.cpu
+		<< ", \"wall_seconds\": " << best.wall
+		<< ", \"decoded_seconds_per_cpu_second\": " << (best.cpu > 0 ? decoded/best.cpu : 0.0)
+		<< ", \"allocations_per_frame\": " << double(best.allocations)/best.frames
+		<< ", \"peak_rss_kib\": " << peakRssKib()
+		<< "}";
+	return json.str();
+}
+
+/**
+ * measure @p path in a child process, so that nothing
+ * measured before counts toward its peak RSS
+ **/
+std::string measureApart(const std::string &path, int repeat)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return measure(path, repeat);
+
+	const pid_t pid = fork();
+	if (pid < 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return measure(path, repeat);
+	}
+	if (pid == 0)
+	{
+		close(fds[0]);
+		const std::string json = measure(path, repeat);
+		for (size_t at=0; at < json.size(); )
+		{
+			const ssize_t n = write(fds[1], json.data()+at, json.size()-at);
+			if (n <= 0)
+				_exit(1);
+			at += n;
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	std::string json;
+	char buffer[4096];
+	ssize_t n;
+	while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+		json.append(buffer, n);
+	close(fds[0]);
+
+	int status;
+	waitpid(pid, &status, 0);
+	if (json.empty())
+		json = "{\"file\": " + quoted(path) + ", \"error\": \"crashed\"}";
+	return json;
+}
+
+void addPath(const std::string &path, std::vector<std::string> &files)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+	{
+		std::cerr << "Can't open " << path << std::endl;
+		return;
+	}
+	if (!S_ISDIR(st.st_mode))
+	{
+		files.push_back(path);
+		return;
+	}
+
+	DIR *const dir = opendir(path.c_str());
+	if (!dir)
+		return;
+	std::vector<std::string> entries;
+	while (dirent *const e = readdir(dir))
+	{
+		if (e->d_name[0] != '.')
+			entries.push_back(path + "/" + e->d_name);
+	}
+	closedir(dir);
+
+	// so that the output is in the same order each time
+	std::sort(entries.begin(), entries.end());
+	for (std::vector<std::string>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+		addPath(*i, files);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	int repeat = 3;
+	int length = 30;
+	bool generate = true;
+	std::vector<std::string> files;
+
+	for (int i=1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--repeat" && i+1 < argc)
+			repeat = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--seconds" && i+1 < argc)
+			length = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--no-generate")
+			generate = false;
+		else if (arg.size() > 1 && arg[0] == '-')
+		{
+			std::cerr << "Usage: " << argv[0]
+				<< " [--repeat N] [--seconds S] [--no-generate] [file|dir]..." << std::endl;
+			return 1;
+		}
+		else
+			addPath(arg, files);
+	}
+
+	std::string fixtures;
+	std::vector<std::string> generated;
+	if (generate)
+	{
+		const char *const tmp = std::getenv("TMPDIR");
+		std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/bench_decoders.XXXXXX";
+		if (!mkdtemp(&dir[0]))
+		{
+			std::cerr << "Can't make a directory for fixtures" << std::endl;
+			return 1;
+		}
+		fixtures = dir;
+
+		struct Fixture { const char *name; int channels; unsigned rate; int width; };
+		const Fixture wavs[] =
+		{
+			{ "u8-mono-22050.wav", 1, 22050, 8 },
+			{ "s16-stereo-44100.wav", 2, 44100, 16 },
+			{ "s32-stereo-48000.wav", 2, 48000, 32 },
+		};
+		for (size_t i=0; i < sizeof(wavs)/sizeof(wavs[0]); i++)
+		{
+			const std::string path = fixtures + "/" + wavs[i].name;
+			if (!writeWav(path, wavs[i].channels, wavs[i].rate, wavs[i].width, length))
+			{
+				std::cerr << "Can't write " << path << std::endl;
+				continue;
+			}
+			generated.push_back(path);
+		}
+		files.insert(files.begin(), generated.begin(), generated.end());
+	}
+
+	std::cout << "{\n\t\"benchmark\": \"decoders\",\n\t\"repeat\": " << repeat
+		<< ",\n\t\"results\": [";
+	for (size_t i=0; i < files.size(); i++)
+	{
+		std::cout << (i ? ",\n\t\t" : "\n\t\t") << measureApart(files[i], repeat);
+		std::cout.flush();
+	}
+	std::cout << "\n\t]\n}" << std::endl;
+
+	for (std::vector<std::string>::const_iterator i = generated.begin(); i != generated.end(); ++i)
+		unlink(i->c_str());
+	if (!fixtures.empty())
+		rmdir(fixtures.c_str());
+	return 0;
+}
+
+// kate: space-indent off; replace-tabs off;
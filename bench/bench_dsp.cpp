@@ -0,0 +1,506 @@
+/*
+ * Times aKode's per-sample stages over every sample width they handle,
+ * and checks what they make against a plain reference done in doubles:
+ *
+ *   bench_dsp [--min-time SECONDS]
+ *
+ * Prints JSON, one result per stage, width, channel count and frame
+ * length, and exits with 1 if any result was wrong.
+ */
+
+#include <akode/audioframe.h>
+#include <akode/converter.h>
+#include <akode/fast_resampler.h>
+#include <akode/volumefilter.h>
+#include <akode/crossfader.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include <stdint.h>
+
+namespace
+{
+
+struct Width
+{
+	int width;
+	const char *name;
+};
+
+const Width widths[] =
+{
+	{ 8, "int8" },
+	{ 16, "int16" },
+	{ 24, "int24" },
+	{ 32, "int32" },
+	{ -32, "float" },
+	{ -64, "double" },
+};
+const int channelCounts[] = { 1, 2, 6 };
+const long lengths[] = { 64, 1024, 4096 };
+
+const int widthCount = sizeof(widths)/sizeof(widths[0]);
+const int channelCountCount = sizeof(channelCounts)/sizeof(channelCounts[0]);
+const int lengthCount = sizeof(lengths)/sizeof(lengths[0]);
+
+typedef std::chrono::steady_clock Clock;
+
+double since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// what the smallest step is, as a fraction of full scale
+double lsb(int width)
+{
+	return width > 0 ? 1.0/(1u << (width-1)) : 0.0;
+}
+
+/**
+ * a sample of @p frame, where 1.0 is full scale
+ **/
+double sample(const aKode::AudioFrame *frame, int channel, long i)
+{
+	const int w = frame->sample_width;
+	if (w == -64)
+		return ((double**)frame->data)[channel][i];
+	if (w == -32)
+		return ((float**)frame->data)[channel][i];
+
+	double v;
+	if (w <= 8)
+		v = ((int8_t**)frame->data)[channel][i];
+	else if (w <= 16)
+		v = ((int16_t**)frame->data)[channel][i];
+	else
+		v = ((int32_t**)frame->data)[channel][i];
+	return v*lsb(w);
+}
+
+void setSample(aKode::AudioFrame *frame, int channel, long i, double v)
+{
+	const int w = frame->sample_width;
+	if (w == -64)
+		((double**)frame->data)[channel][i] = v;
+	else if (w == -32)
+		((float**)frame->data)[channel][i] = float(v);
+	else
+	{
+		const double max = (1u << (w-1)) - 1.0;
+		const double s = std::max(-max, std::min(max, double(std::lrint(v/lsb(w)))));
+		if (w <= 8)
+			((int8_t**)frame->data)[channel][i] = int8_t(s);
+		else if (w <= 16)
+			((int16_t**)frame->data)[channel][i] = int16_t(s);
+		else
+			((int32_t**)frame->data)[channel][i] = int32_t(s);
+	}
+}
+
+/**
+ * fill @p frame with a different tone in each channel and some
+ * noise, the same each time for the same @p seed. It goes no
+ * higher than 0.9, so nothing needs to clip on the way to an integer
+ **/
+void generate(aKode::AudioFrame *frame, int width, int channels, long length, unsigned rate, uint32_t seed)
+{
+	frame->reserveSpace(channels, length, width);
+	frame->sample_rate = rate;
+	frame->channel_config = channels <= 2 ? aKode::MonoStereo : aKode::MultiChannel;
+	frame->pos = 0;
+
+	const double pi = 3.14159265358979323846;
+	uint32_t noise = seed;
+	for (int c=0; c < channels; c++)
+	{
+		for (long i=0; i < length; i++)
+		{
+			noise = noise*1664525u + 1013904223u;
+			const double v = 0.7*std::sin(2*pi*(997.0 + 211.0*c)*i/rate + c)
+				+ 0.2*(int32_t(noise)/2147483648.0);
+			setSample(frame, c, i, v);
+		}
+	}
+}
+
+void copyFrame(const aKode::AudioFrame *from, aKode::AudioFrame *to)
+{
+	to->reserveSpace(from, from->length);
+	to->pos = from->pos;
+	for (int c=0; c < from->channels; c++)
+		for (long i=0; i < from->length; i++)
+			setSample(to, c, i, sample(from, c, i));
+}
+
+/**
+ * how long @p run takes, per time, run as many
+ * times as fit in @p minTime
+ **/
+template<typename F>
+double timePerRun(F run, double minTime)
+{
+	run();
+	long times = 1;
+	while (true)
+	{
+		const Clock::time_point start = Clock::now();
+		for (long t=0; t < times; t++)
+			run();
+		const double elapsed = since(start);
+		if (elapsed >= minTime || times >= (1L << 30))
+			return elapsed/times;
+		times *= elapsed > 0 ? std::max(2L, std::min(100L, long(minTime/elapsed*1.2))) : 100;
+	}
+}
+
+struct Check
+{
+	Check() : maxError(0), ok(true) { }
+
+	void compare(double got, double want, double tolerance)
+	{
+		const double error = std::fabs(got - want);
+		if (!(error <= tolerance))
+			ok = false;
+		if (!(error <= maxError))
+			maxError = error;
+	}
+
+	double maxError;
+	bool ok;
+};
+
+struct Report
+{
+	Report() : count(0), failures(0) { }
+
+	void add(const std::string &fields, double nsPerSample, const Check &check)
+	{
+		json << (count++ ? ",\n\t\t" : "\n\t\t")
+			<< "{" << fields
+			<< ", \"ns_per_sample\": " << nsPerSample
+			<< ", \"max_error\": " << check.maxError
+			<< ", \"ok\": " << (check.ok ? "true" : "false") << "}";
+		if (!check.ok)
+			failures++;
+	}
+
+	std::ostringstream json;
+	int count;
+	int failures;
+};
+
+std::string shape(const char *stage, int channels, long length)
+{
+	std::ostringstream s;
+	s << "\"stage\": \"" << stage << "\", \"channels\": " << channels << ", \"length\": " << length;
+	return s.str();
+}
+
+void benchConverter(Report &report, double minTime)
+{
+	for (int l=0; l < lengthCount; l++)
+	for (int c=0; c < channelCountCount; c++)
+	for (int from=0; from < widthCount; from++)
+	for (int to=0; to < widthCount; to++)
+	{
+		const int channels = channelCounts[c];
+		const long length = lengths[l];
+		aKode::AudioFrame in, out;
+		generate(&in, widths[from].width, channels, length, 44100, 1);
+
+		aKode::Converter converter(widths[to].width);
+		const double t = timePerRun([&]() { converter.doFrame(&in, &out); }, minTime);
+
+		Check check;
+		if (out.length != in.length || out.sample_width != widths[to].width)
+			check.ok = false;
+		else
+		{
+			const double tolerance = 2*(lsb(widths[from].width) + lsb(widths[to].width)) + 1e-6;
+			for (int ch=0; ch < channels; ch++)
+				for (long i=0; i < length; i++)
+					check.compare(sample(&out, ch, i), sample(&in, ch, i), tolerance);
+		}
+
+		std::ostringstream fields;
+		fields << shape("converter", channels, length)
+			<< ", \"from\": \"" << widths[from].name << "\", \"to\": \"" << widths[to].name << "\"";
+		report.add(fields.str(), t*1e9/(length*channels), check);
+	}
+}
+
+/**
+ * FastResampler's box filter, in doubles: each output sample is the
+ * mean of the input it spans, in 1024ths of an input sample
+ **/
+void referenceResample(const aKode::AudioFrame *in, unsigned rate, std::vector<std::vector<double> > &out)
+{
+	const long speed = long(in->sample_rate/float(rate)*1024.0 + 0.5);
+	const unsigned long end = in->length*1024 - 1;
+
+	out.assign(in->channels, std::vector<double>());
+	unsigned long start = 0, stop = speed;
+	while (start < end)
+	{
+		const unsigned long first = start/1024, last = stop/1024;
+		for (int c=0; c < in->channels; c++)
+		{
+			double v;
+			if (first == last)
+				v = sample(in, c, first);
+			else
+			{
+				v = sample(in, c, first)*(1024 - long(start%1024))
+					+ sample(in, c, last)*long(stop%1024);
+				for (unsigned long j=first+1; j < last; j++)
+					v += sample(in, c, j)*1024;
+				v /= speed;
+			}
+			out[c].push_back(v);
+		}
+		start = stop;
+		stop = std::min(stop + speed, end);
+	}
+}
+
+void benchResampler(Report &report, double minTime)
+{
+	struct Rates { unsigned from, to; };
+	const Rates rates[] = { { 48000, 44100 }, { 44100, 48000 }, { 22050, 44100 } };
+
+	for (unsigned r=0; r < sizeof(rates)/sizeof(rates[0]); r++)
+	for (int l=0; l < lengthCount; l++)
+	for (int c=0; c < channelCountCount; c++)
+	for (int w=0; w < widthCount; w++)
+	{
+		const int channels = channelCounts[c];
+		const long length = lengths[l];
+		aKode::AudioFrame in, out;
+		generate(&in, widths[w].width, channels, length, rates[r].from, 2);
+
+		std::unique_ptr<aKode::Resampler> resampler(aKode::fast_resampler().openResampler());
+		resampler->setSampleRate(rates[r].to);
+		const double t = timePerRun([&]() { resampler->doFrame(&in, &out); }, minTime);
+
+		std::vector<std::vector<double> > want;
+		referenceResample(&in, rates[r].to, want);
+
+		Check check;
+		if (out.sample_rate != rates[r].to || out.sample_width != in.sample_width)
+			check.ok = false;
+		else
+		{
+			// only as far as the reference got; anything past that
+			// is counted as wrong, as it was never written
+			const double tolerance = 2*lsb(widths[w].width) + 1e-6;
+			const long made = long(want[0].size());
+			if (made != out.length)
+				check.ok = false;
+			for (int ch=0; ch < channels; ch++)
+				for (long i=0; i < std::min(made, out.length); i++)
+					check.compare(sample(&out, ch, i), want[ch][i], tolerance);
+		}
+
+		std::ostringstream fields;
+		fields << shape("resampler", channels, length)
+			<< ", \"width\": \"" << widths[w].name << "\""
+			<< ", \"from_rate\": " << rates[r].from << ", \"to_rate\": " << rates[r].to;
+		report.add(fields.str(), t*1e9/(length*channels), check);
+	}
+}
+
+void benchVolume(Report &report, double minTime)
+{
+	// the second is loud enough that some of it clips
+	const float volumes[] = { 0.7f, 1.6f };
+
+	for (unsigned v=0; v < sizeof(volumes)/sizeof(volumes[0]); v++)
+	for (int l=0; l < lengthCount; l++)
+	for (int c=0; c < channelCountCount; c++)
+	for (int w=0; w < widthCount; w++)
+	{
+		const int channels = channelCounts[c];
+		const long length = lengths[l];
+		const int width = widths[w].width;
+		aKode::AudioFrame in, out, inPlace;
+		generate(&in, width, channels, length, 44100, 3);
+
+		aKode::VolumeFilter filter;
+		filter.setVolume(volumes[v]);
+		const double t = timePerRun([&]() { filter.doFrame(&in, &out); }, minTime);
+
+		copyFrame(&in, &inPlace);
+		filter.doFrame(&inPlace);
+
+		// what VolumeFilter rounds the volume to
+		const double volume = std::floor(volumes[v]*(1<<14) + 0.5)/(1<<14);
+		const double max = 1.0 - lsb(width);
+		const double tolerance = lsb(width) + 1e-6;
+
+		Check check;
+		if (out.length != in.length || out.sample_width != width)
+			check.ok = false;
+		else
+		{
+			for (int ch=0; ch < channels; ch++)
+			{
+				for (long i=0; i < length; i++)
+				{
+					const double want = std::max(-max, std::min(max, sample(&in, ch, i)*volume));
+					check.compare(sample(&out, ch, i), want, tolerance);
+					check.compare(sample(&inPlace, ch, i), want, tolerance);
+				}
+			}
+		}
+
+		std::ostringstream fields;
+		fields << shape("volume", channels, length)
+			<< ", \"width\": \"" << widths[w].name << "\", \"volume\": " << volumes[v];
+		report.add(fields.str(), t*1e9/(length*channels), check);
+	}
+}
+
+/**
+ * a CrossFader holds as much as its time at the frame's
+ * sample rate, so this rate makes it hold exactly one frame
+ **/
+unsigned fadeRate(long length)
+{
+	return unsigned(length*1000);
+}
+
+void benchCrossFader(Report &report, double minTime)
+{
+	for (int l=0; l < lengthCount; l++)
+	for (int c=0; c < channelCountCount; c++)
+	for (int w=0; w < widthCount; w++)
+	{
+		const int channels = channelCounts[c];
+		const long length = lengths[l];
+		const unsigned rate = fadeRate(length);
+		aKode::AudioFrame old, fresh, work;
+		generate(&old, widths[w].width, channels, length, rate, 4);
+		generate(&fresh, widths[w].width, channels, length, rate, 5);
+		const double tolerance = 2*lsb(widths[w].width) + 1e-6;
+
+		// fading one into the other; a CrossFader can only be used
+		// once, so only doFrame itself is counted
+		{
+			double spent = 0;
+			long times = 0;
+			Check check;
+			while (spent < minTime || times < 2)
+			{
+				aKode::CrossFader fader(1);
+				fader.writeFrame(&old);
+				copyFrame(&fresh, &work);
+
+				const Clock::time_point start = Clock::now();
+				const bool done = fader.doFrame(&work);
+				spent += since(start);
+				times++;
+
+				if (!done || work.length != length)
+					check.ok = false;
+				else if (times == 1)
+				{
+					for (int ch=0; ch < channels; ch++)
+					{
+						for (long i=0; i < length; i++)
+						{
+							const double want = (sample(&fresh, ch, i)*i
+								+ sample(&old, ch, i)*(length-i))/length;
+							check.compare(sample(&work, ch, i), want, tolerance);
+						}
+					}
+				}
+			}
+
+			std::ostringstream fields;
+			fields << shape("crossfade", channels, length)
+				<< ", \"width\": \"" << widths[w].name << "\"";
+			report.add(fields.str(), spent/times*1e9/(length*channels), check);
+		}
+
+		// fading out what's left when nothing comes next
+		{
+			double spent = 0;
+			long times = 0;
+			Check check;
+			while (spent < minTime || times < 2)
+			{
+				aKode::CrossFader fader(1);
+				fader.writeFrame(&old);
+
+				long at = 0;
+				const Clock::time_point start = Clock::now();
+				while (fader.readFrame(&work))
+				{
+					if (times == 0)
+					{
+						for (int ch=0; ch < channels; ch++)
+						{
+							for (long i=0; i < work.length; i++)
+							{
+								const double want = sample(&old, ch, at+i)*(length-(at+i))/length;
+								check.compare(sample(&work, ch, i), want, tolerance);
+							}
+						}
+					}
+					at += work.length;
+				}
+				if (times > 0)
+					spent += since(start);
+				times++;
+
+				if (at != length)
+					check.ok = false;
+			}
+
+			std::ostringstream fields;
+			fields << shape("fadeout", channels, length)
+				<< ", \"width\": \"" << widths[w].name << "\"";
+			report.add(fields.str(), spent/(times-1)*1e9/(length*channels), check);
+		}
+	}
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	double minTime = 0.01;
+	for (int i=1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--min-time" && i+1 < argc)
+			minTime = std::max(0.0, std::atof(argv[++i]));
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--min-time SECONDS]" << std::endl;
+			return 1;
+		}
+	}
+
+	Report report;
+	report.json.precision(6);
+	benchConverter(report, minTime);
+	benchResampler(report, minTime);
+	benchVolume(report, minTime);
+	benchCrossFader(report, minTime);
+
+	std::cout << "{\n\t\"benchmark\": \"dsp\",\n\t\"failures\": " << report.failures
+		<< ",\n\t\"results\": [" << report.json.str() << "\n\t]\n}" << std::endl;
+	return report.failures ? 1 : 0;
+}
+
+// kate: space-indent off; replace-tabs off;
@@ -0,0 +1,282 @@
+/*
+ * Measures files with Meow::LoudnessScanner::measure, the way the
+ * scanner does for each song of a collection, and prints how long it
+ * took and what it found as JSON:
+ *
+ *   bench_loudness [--repeat N] [--no-generate] [file|dir]...
+ *
+ * The fixtures generated first are the stereo sines of EBU Tech 3341,
+ * whose loudness is known, and the exit code is 1 if any of them is
+ * measured more than 0.1 LU off. Other files are only timed.
+ */
+
+#include "loudnessscanner.h"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace
+{
+
+double seconds(clockid_t clock)
+{
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+std::string quoted(const std::string &s)
+{
+	std::string q = "\"";
+	for (std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+	{
+		const unsigned char c = *i;
+		if (c == '"' || c == '\\')
+		{
+			q += '\\';
+			q += c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			q += escaped;
+		}
+		else
+			q += c;
+	}
+	return q + "\"";
+}
+
+void put16(std::string &s, unsigned v)
+{
+	s += char(v & 0xff);
+	s += char((v >> 8) & 0xff);
+}
+
+void put32(std::string &s, unsigned long v)
+{
+	put16(s, v & 0xffff);
+	put16(s, (v >> 16) & 0xffff);
+}
+
+/**
+ * write a 1kHz sine at @p dbfs in both channels of 16 bit stereo
+ **/
+bool writeSine(const std::string &path, unsigned rate, double dbfs, int seconds)
+{
+	const unsigned long frames = (unsigned long)rate*seconds;
+	const unsigned long dataSize = frames*2*2;
+
+	std::string header = "RIFF";
+	put32(header, 36 + dataSize);
+	header += "WAVEfmt ";
+	put32(header, 16);
+	put16(header, 1);
+	put16(header, 2);
+	put32(header, rate);
+	put32(header, rate*2*2);
+	put16(header, 2*2);
+	put16(header, 16);
+	header += "data";
+	put32(header, dataSize);
+
+	FILE *const f = std::fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	std::fwrite(header.data(), 1, header.size(), f);
+
+	const double pi = 3.14159265358979323846;
+	const double amplitude = std::pow(10.0, dbfs/20.0)*32767;
+	std::vector<unsigned char> block;
+	for (unsigned long i=0; i < frames; i++)
+	{
+		const int16_t s = int16_t(std::lrint(amplitude*std::sin(2*pi*1000.0*i/rate)));
+		for (int c=0; c < 2; c++)
+		{
+			block.push_back((unsigned char)(uint16_t(s) & 0xff));
+			block.push_back((unsigned char)(uint16_t(s) >> 8));
+		}
+		if (block.size() >= 65536)
+		{
+			std::fwrite(&block[0], 1, block.size(), f);
+			block.clear();
+		}
+	}
+	if (!block.empty())
+		std::fwrite(&block[0], 1, block.size(), f);
+	return std::fclose(f) == 0;
+}
+
+void addPath(const std::string &path, std::vector<std::string> &files)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+	{
+		std::cerr << "Can't open " << path << std::endl;
+		return;
+	}
+	if (!S_ISDIR(st.st_mode))
+	{
+		files.push_back(path);
+		return;
+	}
+
+	DIR *const dir = opendir(path.c_str());
+	if (!dir)
+		return;
+	std::vector<std::string> entries;
+	while (dirent *const e = readdir(dir))
+	{
+		if (e->d_name[0] != '.')
+			entries.push_back(path + "/" + e->d_name);
+	}
+	closedir(dir);
+
+	// so that the output is in the same order each time
+	std::sort(entries.begin(), entries.end());
+	for (std::vector<std::string>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+		addPath(*i, files);
+}
+
+struct Fixture
+{
+	std::string path;
+	// NAN for the files that were given
+	double expected;
+};
+
+}
+
+int main(int argc, char **argv)
+{
+	int repeat = 3;
+	bool generate = true;
+	std::vector<Fixture> files;
+
+	for (int i=1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--repeat" && i+1 < argc)
+			repeat = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--no-generate")
+			generate = false;
+		else if (arg.size() > 1 && arg[0] == '-')
+		{
+			std::cerr << "Usage: " << argv[0]
+				<< " [--repeat N] [--no-generate] [file|dir]..." << std::endl;
+			return 1;
+		}
+		else
+		{
+			std::vector<std::string> found;
+			addPath(arg, found);
+			for (std::vector<std::string>::const_iterator i = found.begin(); i != found.end(); ++i)
+			{
+				const Fixture f = { *i, NAN };
+				files.push_back(f);
+			}
+		}
+	}
+
+	std::string fixtures;
+	std::vector<std::string> generated;
+	if (generate)
+	{
+		const char *const tmp = std::getenv("TMPDIR");
+		std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/bench_loudness.XXXXXX";
+		if (!mkdtemp(&dir[0]))
+		{
+			std::cerr << "Can't make a directory for fixtures" << std::endl;
+			return 1;
+		}
+		fixtures = dir;
+
+		// EBU Tech 3341 cases 1 and 2, and the first at CD's rate
+		struct Sine { const char *name; unsigned rate; double dbfs; };
+		const Sine sines[] =
+		{
+			{ "sine-23-48000.wav", 48000, -23 },
+			{ "sine-33-48000.wav", 48000, -33 },
+			{ "sine-23-44100.wav", 44100, -23 },
+		};
+		std::vector<Fixture> made;
+		for (size_t i=0; i < sizeof(sines)/sizeof(sines[0]); i++)
+		{
+			const std::string path = fixtures + "/" + sines[i].name;
+			if (!writeSine(path, sines[i].rate, sines[i].dbfs, 20))
+			{
+				std::cerr << "Can't write " << path << std::endl;
+				continue;
+			}
+			generated.push_back(path);
+			const Fixture f = { path, sines[i].dbfs };
+			made.push_back(f);
+		}
+		files.insert(files.begin(), made.begin(), made.end());
+	}
+
+	int wrong = 0;
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\n\t\"benchmark\": \"loudness\",\n\t\"repeat\": " << repeat
+		<< ",\n\t\"results\": [";
+	for (size_t i=0; i < files.size(); i++)
+	{
+		const Fixture &f = files[i];
+
+		Meow::Collection::Loudness loudness;
+		double best = 0, bestCpu = 0;
+		for (int r=0; r < repeat; r++)
+		{
+			const double wall = seconds(CLOCK_MONOTONIC), cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+			loudness = Meow::LoudnessScanner::measure(QString::fromLocal8Bit(f.path.c_str()));
+			const double w = seconds(CLOCK_MONOTONIC) - wall;
+			const double c = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+			if (r == 0 || w < best)
+			{
+				best = w;
+				bestCpu = c;
+			}
+		}
+
+		json << (i ? ",\n\t\t" : "\n\t\t") << "{\"file\": " << quoted(f.path)
+			<< ", \"measured\": " << (loudness.measured ? "true" : "false");
+		if (loudness.measured)
+		{
+			json << ", \"integrated_lufs\": " << loudness.track
+				<< ", \"true_peak\": " << loudness.trackPeak
+				<< ", \"gated_blocks\": " << loudness.blocks;
+		}
+		if (!std::isnan(f.expected))
+		{
+			const bool ok = loudness.measured && std::fabs(loudness.track - f.expected) <= 0.1;
+			if (!ok)
+				wrong++;
+			json << ", \"expected_lufs\": " << f.expected << ", \"ok\": " << (ok ? "true" : "false");
+		}
+		json << ", \"wall_seconds\": " << best << ", \"cpu_seconds\": " << bestCpu << "}";
+	}
+	json << "\n\t],\n\t\"wrong\": " << wrong << "\n}";
+	std::cout << json.str() << std::endl;
+
+	for (std::vector<std::string>::const_iterator i = generated.begin(); i != generated.end(); ++i)
+		unlink(i->c_str());
+	if (!fixtures.empty())
+		rmdir(fixtures.c_str());
+	return wrong ? 1 : 0;
+}
+
+// kate: space-indent off; replace-tabs off;
@@ -0,0 +1,41 @@
+#ifndef MEOW_BENCH_DECODERS_H
+#define MEOW_BENCH_DECODERS_H
+
+#include <akode/decoder.h>
+#include <akode/wav_decoder.h>
+#include <akode/plugins/mpg123_decoder.h>
+#include <akode/plugins/vorbis_decoder.h>
+#include <akode/plugins/flac113_decoder.h>
+#include <akode/plugins/speex_decoder.h>
+#ifdef AKODE_WITH_OPUS
+#include <akode/plugins/opus_decoder.h>
+#endif
+#ifdef AKODE_WITH_MUSEPACK
+#include <akode/plugins/mpc_decoder.h>
+#endif
+
+#include <vector>
+
+/**
+ * the decoders Meow::Player plays with, in the same order, and then WAV
+ **/
+inline std::vector<aKode::DecoderPlugin*> decoderPlugins()
+{
+	std::vector<aKode::DecoderPlugin*> decoders;
+	decoders.push_back(&aKode::mpg123_decoder());
+	decoders.push_back(&aKode::vorbis_decoder());
+#ifdef AKODE_WITH_OPUS
+	decoders.push_back(&aKode::opus_decoder());
+#endif
+	decoders.push_back(&aKode::flac_decoder());
+#ifdef AKODE_WITH_MUSEPACK
+	decoders.push_back(&aKode::mpc_decoder());
+#endif
+	decoders.push_back(&aKode::speex_decoder());
+	decoders.push_back(&aKode::wav_decoder());
+	return decoders;
+}
+
+#endif
+
+// kate: space-indent off; replace-tabs off;
@@ -0,0 +1,289 @@
+/*
+ * Adds directories to a collection the way Meow does, without a
+ * window:
+ *
+ *   meow-import [--replace] COLLECTION (directory|file)...
+ *   meow-import --make-corpus DIRECTORY COUNT
+ *
+ * The files are found in order of name and given to
+ * Meow::Collection as one job, so the same corpus makes the same
+ * collection each time and runs can be compared. Prints JSON with
+ * how many files went in and how fast, how long TagLib, the sort keys,
+ * sqlite and preparing its statements took, and how big the collection
+ * came out.
+ *
+ * --make-corpus writes COUNT tagged, silent MP3s into DIRECTORY,
+ * which are the same every time.
+ */
+
+#include <db/base.h>
+#include <db/collection.h>
+#include <db/snapshot.h>
+#include "directoryadder.h"
+
+#include <taglib/fileref.h>
+#include <taglib/tag.h>
+
+#include <qcoreapplication.h>
+#include <qelapsedtimer.h>
+#include <qfileinfo.h>
+#include <qfile.h>
+#include <qdir.h>
+#include <qset.h>
+
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+#include <string.h>
+
+namespace
+{
+
+std::string quoted(const QString &string)
+{
+	const QByteArray s = string.toUtf8();
+	std::string q = "\"";
+	for (const char *i = s.constData(); *i; ++i)
+	{
+		const unsigned char c = *i;
+		if (c == '"' || c == '\\')
+		{
+			q += '\\';
+			q += c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			q += escaped;
+		}
+		else
+			q += c;
+	}
+	return q + '"';
+}
+
+// like DirectoryAdder, but in order and in this thread
+void list(const QString &path, QSet<QString> &seen, QStringList &files)
+{
+	const QFileInfo info(path);
+	if (info.isFile())
+	{
+		if (Meow::DirectoryAdder::isAudioFile(path))
+			files.append(path);
+		return;
+	}
+	// a symlink can lead back up
+	const QString real = info.canonicalFilePath();
+	if (real.isEmpty() || seen.contains(real))
+		return;
+	seen.insert(real);
+
+	const QFileInfoList entries = QDir(path).entryInfoList(
+			QDir::AllEntries | QDir::NoDotAndDotDot, QDir::Name
+		);
+	for (QFileInfoList::const_iterator i = entries.begin(); i != entries.end(); ++i)
+		list(i->filePath(), seen, files);
+}
+
+// a frame of MPEG 1 layer 3 at 128kbit/s and 44100Hz, with no
+// main data, which decodes as silence
+const int frameSize = 417;
+const unsigned char frameHeader[] = { 0xff, 0xfb, 0x90, 0x00 };
+// about a second
+const int framesPerFile = 39;
+
+// a few of them aren't ASCII, so that the sort keys have
+// something to do
+const char *const artistNames[] =
+{
+	"Aphex Twin", "Beth Gibbons", "Björk", "Cocteau Twins",
+	"Dead Can Dance", "Ólafur Arnalds", "Portishead", "Sigur Rós",
+	"The Knife", "Ñu"
+};
+const int numArtists = sizeof(artistNames)/sizeof(artistNames[0]);
+
+bool makeCorpus(const QString &directory, int count)
+{
+	QByteArray frame(frameSize, '\0');
+	memcpy(frame.data(), frameHeader, sizeof(frameHeader));
+
+	for (int i=0; i < count; i++)
+	{
+		// ten tracks to an album, ten albums to an artist
+		const int track = i%10 + 1;
+		const int album = i/10;
+		const int artist = i/100;
+		const QString artistName = QString::fromUtf8(artistNames[artist%numArtists])
+			+ (artist < numArtists ? QString() : QString(" %1").arg(artist/numArtists + 1));
+
+		const QString dir = QString("%1/%2/%3")
+			.arg(directory)
+			.arg(artist, 4, 10, QChar('0'))
+			.arg(album, 5, 10, QChar('0'));
+		const QString path = QString("%1/%2.mp3").arg(dir).arg(track, 2, 10, QChar('0'));
+		if (!QDir().mkpath(dir))
+		{
+			std::cerr << "Can't make " << dir.toLocal8Bit().data() << std::endl;
+			return false;
+		}
+
+		{
+			QFile f(path);
+			if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+			{
+				std::cerr << "Can't write " << path.toLocal8Bit().data() << std::endl;
+				return false;
+			}
+			for (int n=0; n < framesPerFile; n++)
+				f.write(frame);
+		}
+
+		TagLib::FileRef f(QFile::encodeName(path).data());
+		if (f.isNull() || !f.tag())
+		{
+			std::cerr << "TagLib can't read " << path.toLocal8Bit().data() << std::endl;
+			return false;
+		}
+		f.tag()->setArtist(TagLib::String(artistName.toUtf8().data(), TagLib::String::UTF8));
+		f.tag()->setAlbum(TagLib::String(
+				QString("Album %1").arg(album+1).toUtf8().data(), TagLib::String::UTF8
+			));
+		f.tag()->setTitle(TagLib::String(
+				QString("Song %1").arg(i+1).toUtf8().data(), TagLib::String::UTF8
+			));
+		f.tag()->setTrack(track);
+		if (!f.save())
+		{
+			std::cerr << "Can't tag " << path.toLocal8Bit().data() << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+qint64 fileSize(const QString &path)
+{
+	const QFileInfo info(path);
+	return info.exists() ? info.size() : 0;
+}
+
+int usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [--replace] COLLECTION (directory|file)...\n"
+		<< "       " << name << " --make-corpus DIRECTORY COUNT" << std::endl;
+	return 1;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+
+	bool replace = false;
+	QString collectionFile;
+	QStringList paths;
+
+	for (int i=1; i < argc; i++)
+	{
+		const QString arg = QString::fromLocal8Bit(argv[i]);
+		if (arg == "--make-corpus" && i+2 < argc)
+		{
+			const int count = std::atoi(argv[i+2]);
+			if (count <= 0)
+				return usage(argv[0]);
+			return makeCorpus(QString::fromLocal8Bit(argv[i+1]), count) ? 0 : 1;
+		}
+		else if (arg == "--replace")
+			replace = true;
+		else if (arg.startsWith('-'))
+			return usage(argv[0]);
+		else if (collectionFile.isEmpty())
+			collectionFile = arg;
+		else
+			paths.append(arg);
+	}
+	if (paths.isEmpty())
+		return usage(argv[0]);
+
+	// starting from nothing is what makes runs comparable
+	if (QFileInfo(collectionFile).exists())
+	{
+		if (!replace)
+		{
+			std::cerr << collectionFile.toLocal8Bit().data()
+				<< " already exists, use --replace" << std::endl;
+			return 1;
+		}
+		QFile::remove(collectionFile);
+		QFile::remove(collectionFile + "-wal");
+		QFile::remove(collectionFile + "-shm");
+		QFile::remove(Meow::Snapshot::pathFor(collectionFile));
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	QStringList files;
+	{
+		QSet<QString> seen;
+		for (QStringList::const_iterator i = paths.begin(); i != paths.end(); ++i)
+			list(*i, seen, files);
+	}
+	const qint64 listing = timer.nsecsElapsed();
+
+	Meow::Base base;
+	if (!base.open(collectionFile))
+		return 1;
+
+	Meow::Collection::Timings timings;
+	qint64 importing;
+	{
+		Meow::Collection collection(&base);
+		QObject::connect(&collection, SIGNAL(loaded()), &app, SLOT(quit()));
+		QObject::connect(&collection, SIGNAL(jobFinished()), &app, SLOT(quit()));
+
+		// the collection is empty, but it's how its statements
+		// are prepared
+		collection.getFilesAndFirst(0);
+		app.exec();
+
+		timer.restart();
+		collection.startJob();
+		collection.add(files);
+		collection.scheduleFinishJob();
+		app.exec();
+		importing = timer.nsecsElapsed();
+
+		timings = collection.timings();
+	}
+	const Meow::Base::StatementCacheStats statements = base.statementCacheStats();
+	base.close();
+
+	const double seconds = importing/1e9;
+	const qint64 dbBytes = fileSize(collectionFile) + fileSize(collectionFile + "-wal");
+
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\n\t\"tool\": \"meow-import\",\n\t\"collection\": " << quoted(collectionFile)
+		<< ",\n\t\"files_found\": " << files.size()
+		<< ",\n\t\"files_added\": " << timings.files
+		<< ",\n\t\"listing_seconds\": " << listing/1e9
+		<< ",\n\t\"seconds\": " << seconds
+		<< ",\n\t\"files_per_second\": " << (seconds > 0 ? timings.files/seconds : 0.0)
+		<< ",\n\t\"taglib_seconds\": " << timings.taglib/1e9
+		<< ",\n\t\"keys_seconds\": " << timings.keys/1e9
+		<< ",\n\t\"sql_seconds\": " << timings.sql/1e9
+		<< ",\n\t\"statements_prepared\": " << statements.prepares
+		<< ",\n\t\"prepare_seconds\": " << statements.prepareNanoseconds/1e9
+		<< ",\n\t\"statements_reused\": " << statements.hits
+		<< ",\n\t\"db_bytes\": " << dbBytes
+		<< "\n}";
+	std::cout << json.str() << std::endl;
+
+	return 0;
+}
+
+// kate: space-indent off; replace-tabs off;
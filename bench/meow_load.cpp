@@ -0,0 +1,387 @@
+/*
+ * Times loading a collection the way Meow does when it starts,
+ * without a window:
+ *
+ *   meow-load COLLECTION
+ *   meow-load --synthetic DIRECTORY [COUNT]...
+ *
+ * The collection is loaded twice, first without its snapshot so that
+ * it comes from sqlite (which writes the snapshot again), and then
+ * from the snapshot. Each batch goes into a TreeModel as it arrives,
+ * as TreeView does. Prints JSON with how long it took until the first
+ * batch, until the last one, and how much of that was the tree,
+ * and how much memory the tree takes.
+ *
+ * Then the songs are added to a new TreeModel again, in a shuffled
+ * order, one at a time and in batches, to time finding the artist
+ * and album each goes in, and then every song in the tree is stepped
+ * through with nextSong() and back with previousSong(), as playing
+ * them in order does.
+ *
+ * --synthetic makes a collection of COUNT songs in DIRECTORY for each
+ * COUNT given, or for 10000, 100000 and 1000000, and loads each. They
+ * have ten songs to an album and two albums to an artist, so 100000
+ * songs are under 5000 artists, and there are no files behind them,
+ * unlike meow-import --make-corpus's.
+ */
+
+#include <db/base.h>
+#include <db/collection.h>
+#include <db/snapshot.h>
+#include "treemodel.h"
+
+#include <qcoreapplication.h>
+#include <qelapsedtimer.h>
+#include <qfileinfo.h>
+#include <qfile.h>
+#include <qdir.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+using Meow::File;
+
+// puts each batch in the tree, and times it
+class Loading : public QObject
+{
+	Q_OBJECT
+
+public:
+	Loading(Meow::TreeModel *model, QVector<File> *kept)
+		: model(model), kept(kept), batches(0), firstBatch(0), tree(0), finished(0)
+	{
+		timer.start();
+	}
+
+	Meow::TreeModel *const model;
+	// every file is appended to this, if it's not null
+	QVector<File> *const kept;
+	QElapsedTimer timer;
+	int batches;
+	// nanoseconds since the timer was started
+	qint64 firstBatch, tree, finished;
+
+public slots:
+	void addedBatch(const QVector<File> &files)
+	{
+		const qint64 start = timer.nsecsElapsed();
+		if (batches++ == 0)
+			firstBatch = start;
+		model->addFiles(files);
+		tree += timer.nsecsElapsed() - start;
+		if (kept)
+			*kept += files;
+	}
+	void loaded()
+	{
+		finished = timer.nsecsElapsed();
+		QCoreApplication::quit();
+	}
+};
+
+namespace
+{
+
+std::string quoted(const QString &string)
+{
+	const QByteArray s = string.toUtf8();
+	std::string q = "\"";
+	for (const char *i = s.constData(); *i; ++i)
+	{
+		const unsigned char c = *i;
+		if (c == '"' || c == '\\')
+		{
+			q += '\\';
+			q += c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			q += escaped;
+		}
+		else
+			q += c;
+	}
+	return q + '"';
+}
+
+void removeCollection(const QString &collectionFile)
+{
+	QFile::remove(collectionFile);
+	QFile::remove(collectionFile + "-wal");
+	QFile::remove(collectionFile + "-shm");
+	QFile::remove(Meow::Snapshot::pathFor(collectionFile));
+}
+
+/**
+ * fill a new collection with @p count songs by sqlite alone, and
+ * let Base make their sort keys and search index the way it does
+ * when the collation changes
+ **/
+bool makeCollection(const QString &collectionFile, int count)
+{
+	removeCollection(collectionFile);
+	{
+		Meow::Base base;
+		if (!base.open(collectionFile))
+			return false;
+
+		const QString numbers = "with recursive n(i) as "
+			"(select 1 union all select i+1 from n where i<" + QString::number(count) + ") ";
+		base.exec("begin");
+		base.exec(
+				numbers + "insert into songs (song_id, length, url) "
+				"select i, 120000 + i%240000, "
+				"printf('/music/%05d/%06d/%02d.mp3', (i-1)/20, (i-1)/10, (i-1)%10 + 1) from n"
+			);
+		// a few of them aren't ASCII, so that the sort keys have
+		// something to do
+		base.exec(QString::fromUtf8(
+				"insert into tags (song_id, tag, value) "
+				"select song_id, 'artist', printf('%s %d', "
+					"case (song_id-1)/20%4 when 0 then 'Björk' when 1 then 'the Knife' "
+					"when 2 then 'Ólafur Arnalds' else 'Sigur Rós' end, (song_id-1)/20) "
+				"from songs"
+			));
+		base.exec(
+				"insert into tags (song_id, tag, value) "
+				"select song_id, 'album', printf('Album %d', (song_id-1)/10) from songs"
+			);
+		base.exec(
+				"insert into tags (song_id, tag, value) "
+				"select song_id, 'title', printf('Song %d', song_id) from songs"
+			);
+		base.exec(
+				"insert into tags (song_id, tag, value) "
+				"select song_id, 'track', (song_id-1)%10 + 1 from songs"
+			);
+		base.exec("delete from sort_collation");
+		base.exec("drop table if exists song_search");
+		base.exec("commit");
+	}
+	Meow::Base base;
+	return base.open(collectionFile);
+}
+
+/**
+ * one load of @p collectionFile, as a JSON object
+ **/
+std::string load(const QString &collectionFile, bool fromSnapshot, QVector<File> *kept=0)
+{
+	if (!fromSnapshot)
+		QFile::remove(Meow::Snapshot::pathFor(collectionFile));
+
+	Meow::Base base;
+	if (!base.open(collectionFile))
+		return std::string();
+
+	Meow::TreeModel model(0);
+	Loading loading(&model, kept);
+	{
+		Meow::Collection collection(&base);
+		QObject::connect(
+				&collection, SIGNAL(addedBatch(QVector<File>)),
+				&loading, SLOT(addedBatch(QVector<File>))
+			);
+		QObject::connect(&collection, SIGNAL(loaded()), &loading, SLOT(loaded()));
+
+		loading.timer.restart();
+		collection.getFilesAndFirst(0);
+		QCoreApplication::exec();
+	}
+	base.close();
+
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\"source\": \"" << (fromSnapshot ? "snapshot" : "sqlite")
+		<< "\", \"songs\": " << model.numSongs()
+		<< ", \"batches\": " << loading.batches
+		<< ", \"first_batch_seconds\": " << loading.firstBatch/1e9
+		<< ", \"seconds\": " << loading.finished/1e9
+		<< ", \"tree_seconds\": " << loading.tree/1e9
+		<< ", \"tree_bytes\": " << model.memoryUsed()
+		<< ", \"tree_bytes_per_song\": "
+			<< (model.numSongs() ? double(model.memoryUsed())/model.numSongs() : 0.0)
+		<< "}";
+	return json.str();
+}
+
+std::string loadBoth(const QString &collectionFile, QVector<File> &files)
+{
+	const std::string sqlite = load(collectionFile, false);
+	const std::string snapshot = load(collectionFile, true, &files);
+	if (sqlite.empty() || snapshot.empty())
+		return std::string();
+	return "[\n\t\t\t\t" + sqlite + ",\n\t\t\t\t" + snapshot + "\n\t\t\t]";
+}
+
+/**
+ * add @p files to a new tree one at a time, and to another one in
+ * batches like a load's, as a JSON object
+ **/
+std::string adding(QVector<File> files)
+{
+	// in the order they're loaded, each would go after the last
+	std::shuffle(files.begin(), files.end(), std::mt19937(1));
+
+	QElapsedTimer timer;
+	Meow::TreeModel oneAtATime(0);
+	timer.start();
+	for (int i=0; i < files.size(); i++)
+		oneAtATime.addFile(files[i]);
+	const qint64 single = timer.nsecsElapsed();
+
+	Meow::TreeModel batched(0);
+	timer.restart();
+	for (int at=0; at < files.size(); at += 512)
+		batched.addFiles(files.mid(at, 512));
+	const qint64 batches = timer.nsecsElapsed();
+
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\"songs\": " << batched.numSongs()
+		<< ", \"top_level_branches\": " << batched.rowCount()
+		<< ", \"one_at_a_time_seconds\": " << single/1e9
+		<< ", \"batched_seconds\": " << batches/1e9
+		<< "}";
+	return json.str();
+}
+
+/**
+ * step through every song of a tree of @p files, forward and then
+ * back, as a JSON object
+ **/
+std::string stepping(const QVector<File> &files)
+{
+	Meow::TreeModel model(0);
+	model.addFiles(files);
+
+	QElapsedTimer timer;
+	timer.start();
+	int forward=0;
+	QModelIndex last;
+	for (QModelIndex i = model.nextSong(QModelIndex(), true); i.isValid(); i = model.nextSong(i, true))
+	{
+		last = i;
+		forward++;
+	}
+	const qint64 next = timer.nsecsElapsed();
+
+	timer.restart();
+	int back=0;
+	for (QModelIndex i = last; i.isValid(); i = model.previousSong(i, true))
+		back++;
+	const qint64 previous = timer.nsecsElapsed();
+
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\"songs\": " << forward
+		<< ", \"songs_back\": " << back
+		<< ", \"next_song_seconds\": " << next/1e9
+		<< ", \"next_song_ns_each\": " << (forward ? double(next)/forward : 0.0)
+		<< ", \"previous_song_seconds\": " << previous/1e9
+		<< "}";
+	return json.str();
+}
+
+int usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " COLLECTION\n"
+		<< "       " << name << " --synthetic DIRECTORY [COUNT]..." << std::endl;
+	return 1;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+
+	if (argc < 2)
+		return usage(argv[0]);
+
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\n\t\"tool\": \"meow-load\",\n\t\"collections\": [";
+
+	if (QString(argv[1]) == "--synthetic")
+	{
+		if (argc < 3)
+			return usage(argv[0]);
+		const QString directory = QString::fromLocal8Bit(argv[2]);
+		if (!QDir().mkpath(directory))
+		{
+			std::cerr << "Can't make " << argv[2] << std::endl;
+			return 1;
+		}
+
+		QList<int> counts;
+		for (int i=3; i < argc; i++)
+		{
+			const int count = std::atoi(argv[i]);
+			if (count <= 0)
+				return usage(argv[0]);
+			counts.append(count);
+		}
+		if (counts.isEmpty())
+			counts << 10000 << 100000 << 1000000;
+
+		for (int i=0; i < counts.size(); i++)
+		{
+			const QString collectionFile = QString("%1/synthetic-%2.sqlite")
+				.arg(directory).arg(counts[i]);
+
+			QElapsedTimer timer;
+			timer.start();
+			if (!makeCollection(collectionFile, counts[i]))
+				return 1;
+			const qint64 making = timer.nsecsElapsed();
+
+			QVector<File> files;
+			const std::string runs = loadBoth(collectionFile, files);
+			if (runs.empty())
+				return 1;
+			json << (i ? ",\n\t\t" : "\n\t\t") << "{\n\t\t\t\"collection\": " << quoted(collectionFile)
+				<< ",\n\t\t\t\"count\": " << counts[i]
+				<< ",\n\t\t\t\"make_seconds\": " << making/1e9
+				<< ",\n\t\t\t\"runs\": " << runs
+				<< ",\n\t\t\t\"add\": " << adding(files)
+				<< ",\n\t\t\t\"steps\": " << stepping(files)
+				<< "\n\t\t}";
+			removeCollection(collectionFile);
+		}
+	}
+	else if (argc == 2 && argv[1][0] != '-')
+	{
+		const QString collectionFile = QString::fromLocal8Bit(argv[1]);
+		if (!QFileInfo(collectionFile).exists())
+		{
+			std::cerr << argv[1] << " doesn't exist" << std::endl;
+			return 1;
+		}
+		QVector<File> files;
+		const std::string runs = loadBoth(collectionFile, files);
+		if (runs.empty())
+			return 1;
+		json << "\n\t\t{\n\t\t\t\"collection\": " << quoted(collectionFile)
+			<< ",\n\t\t\t\"runs\": " << runs
+			<< ",\n\t\t\t\"add\": " << adding(files)
+			<< ",\n\t\t\t\"steps\": " << stepping(files)
+			<< "\n\t\t}";
+	}
+	else
+		return usage(argv[0]);
+
+	json << "\n\t]\n}";
+	std::cout << json.str() << std::endl;
+	return 0;
+}
+
+#include "meow_load.moc"
+
+// kate: space-indent off; replace-tabs off;
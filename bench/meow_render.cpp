@@ -0,0 +1,496 @@
+/*
+ * Plays a playlist through the same aKode::Player chain that Meow uses,
+ * as fast as it can, into a WAV-file or nowhere:
+ *
+ *   meow-render [--output FILE.wav] [--rate HZ] [--width BITS]
+ *               [--volume V] (file|playlist.m3u)...
+ *
+ * Prints JSON with the wall- and CPU-time each stage took for each
+ * track and in total, and a checksum of what each track came out as,
+ * which is the same from one run to the next if nothing has changed.
+ * Width -32 is float.
+ */
+
+#include "decoders.h"
+
+#include <akode/audioframe.h>
+#include <akode/decoder.h>
+#include <akode/player.h>
+#include <akode/wav_sink.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+#include <stdint.h>
+#include <time.h>
+
+namespace
+{
+
+struct Times
+{
+	Times() : cpu(0), wall(0) { }
+	double cpu, wall;
+
+	Times& operator+=(const Times &o)
+	{
+		cpu += o.cpu;
+		wall += o.wall;
+		return *this;
+	}
+	Times& operator+=(const aKode::Player::Profile::Stage &o)
+	{
+		cpu += o.cpu;
+		wall += o.wall;
+		return *this;
+	}
+};
+
+double clockSeconds(clockid_t clock)
+{
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+std::string quoted(const std::string &s)
+{
+	std::string q = "\"";
+	for (std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+	{
+		const unsigned char c = *i;
+		if (c == '"' || c == '\\')
+		{
+			q += '\\';
+			q += c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			q += escaped;
+		}
+		else
+			q += c;
+	}
+	return q + "\"";
+}
+
+/**
+ * a decoder that counts how long the one it
+ * wraps spends decoding, in whichever thread
+ **/
+class TimedDecoder : public aKode::Decoder
+{
+	aKode::Decoder *const decoder;
+	Times &times;
+
+public:
+	TimedDecoder(aKode::Decoder *decoder, Times &times)
+		: decoder(decoder), times(times)
+	{
+	}
+	~TimedDecoder()
+	{
+		delete decoder;
+	}
+
+	virtual bool readFrame(aKode::AudioFrame *frame)
+	{
+		const double cpu = clockSeconds(CLOCK_THREAD_CPUTIME_ID);
+		const double wall = clockSeconds(CLOCK_MONOTONIC);
+		const bool read = decoder->readFrame(frame);
+		times.cpu += clockSeconds(CLOCK_THREAD_CPUTIME_ID) - cpu;
+		times.wall += clockSeconds(CLOCK_MONOTONIC) - wall;
+		return read;
+	}
+	virtual long length() { return decoder->length(); }
+	virtual long position() { return decoder->position(); }
+	virtual bool seek(long pos) { return decoder->seek(pos); }
+	virtual bool seekable() { return decoder->seekable(); }
+	virtual bool eof() { return decoder->eof(); }
+	virtual bool error() { return decoder->error(); }
+	virtual const aKode::AudioConfiguration* audioConfiguration()
+	{
+		return decoder->audioConfiguration();
+	}
+};
+
+class TimedDecoderPlugin : public aKode::DecoderPlugin
+{
+	aKode::DecoderPlugin *const plugin;
+
+public:
+	// what the decoders this opens count into, and which opened one last
+	static Times times;
+	static std::string opened;
+
+	TimedDecoderPlugin(aKode::DecoderPlugin *plugin)
+		: aKode::DecoderPlugin("timed"), plugin(plugin)
+	{
+	}
+
+	virtual bool canDecode(aKode::File *src)
+	{
+		return plugin->canDecode(src);
+	}
+	virtual aKode::Decoder* openDecoder(aKode::File *src)
+	{
+		aKode::Decoder *const decoder = plugin->openDecoder(src);
+		if (!decoder)
+			return 0;
+		opened = plugin->name();
+		return new TimedDecoder(decoder, times);
+	}
+};
+
+Times TimedDecoderPlugin::times;
+std::string TimedDecoderPlugin::opened;
+
+/**
+ * 64 bit FNV-1a of the samples as the sink gets them, each
+ * one little-endian in as many bytes as it's kept in
+ **/
+class Checksum : public aKode::Player::Monitor
+{
+	uint64_t hash;
+
+	void add(unsigned char byte)
+	{
+		hash ^= byte;
+		hash *= 1099511628211ull;
+	}
+
+	template<typename T>
+	void add(const aKode::AudioFrame *frame)
+	{
+		T **const data = (T**)frame->data;
+		for (long i=0; i < frame->length; i++)
+		{
+			for (int c=0; c < frame->channels; c++)
+			{
+				T sample = data[c][i];
+				const unsigned char *const s = (const unsigned char*)&sample;
+				for (unsigned b=0; b < sizeof(T); b++)
+				{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+					add(s[sizeof(T)-1-b]);
+#else
+					add(s[b]);
+#endif
+				}
+			}
+		}
+	}
+
+public:
+	Checksum() { reset(); }
+
+	void add(const std::string &s)
+	{
+		for (std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+			add((unsigned char)*i);
+	}
+
+	void reset() { hash = 14695981039346656037ull; }
+	std::string value() const
+	{
+		char hex[17];
+		std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+		return hex;
+	}
+
+	// in the player-thread, read only after Player::stop()
+	virtual void writeFrame(aKode::AudioFrame *frame)
+	{
+		const int width = frame->sample_width;
+		if (width == -64)
+			add<double>(frame);
+		else if (width == -32)
+			add<float>(frame);
+		else if (width <= 8)
+			add<int8_t>(frame);
+		else if (width <= 16)
+			add<int16_t>(frame);
+		else
+			add<int32_t>(frame);
+	}
+};
+
+class Manager : public aKode::Player::Manager
+{
+	std::mutex lock;
+	std::condition_variable changed;
+	bool ended;
+	bool failed;
+
+public:
+	Manager() : ended(false), failed(false) { }
+
+	void reset()
+	{
+		std::lock_guard<std::mutex> locker(lock);
+		ended = failed = false;
+	}
+	// returns false if it ended in an error
+	bool wait()
+	{
+		std::unique_lock<std::mutex> locker(lock);
+		while (!ended)
+			changed.wait(locker);
+		return !failed;
+	}
+
+	virtual void stateChangeEvent(aKode::Player::State) { }
+	virtual void eofEvent()
+	{
+		std::lock_guard<std::mutex> locker(lock);
+		ended = true;
+		changed.notify_all();
+	}
+	virtual void errorEvent()
+	{
+		std::lock_guard<std::mutex> locker(lock);
+		ended = failed = true;
+		changed.notify_all();
+	}
+};
+
+struct Stages
+{
+	Times decode, read, resample, convert, volume, sink, monitor;
+
+	Stages& operator+=(const Stages &o)
+	{
+		decode += o.decode;
+		read += o.read;
+		resample += o.resample;
+		convert += o.convert;
+		volume += o.volume;
+		sink += o.sink;
+		monitor += o.monitor;
+		return *this;
+	}
+};
+
+void writeTimes(std::ostream &json, const char *name, const Times &times, bool first=false)
+{
+	json << (first ? "" : ", ") << "\"" << name << "\": {\"cpu_seconds\": " << times.cpu
+		<< ", \"wall_seconds\": " << times.wall << "}";
+}
+
+void writeStages(std::ostream &json, const Stages &stages)
+{
+	json << "\"stages\": {";
+	writeTimes(json, "decode", stages.decode, true);
+	writeTimes(json, "read", stages.read);
+	writeTimes(json, "resample", stages.resample);
+	writeTimes(json, "convert", stages.convert);
+	writeTimes(json, "volume", stages.volume);
+	writeTimes(json, "sink", stages.sink);
+	writeTimes(json, "monitor", stages.monitor);
+	json << "}";
+}
+
+/**
+ * the entries of an m3u playlist, relative to where it is
+ **/
+void readPlaylist(const std::string &path, std::vector<std::string> &files)
+{
+	std::ifstream in(path.c_str());
+	if (!in)
+	{
+		std::cerr << "Can't open " << path << std::endl;
+		return;
+	}
+	const std::string::size_type slash = path.rfind('/');
+	const std::string dir = slash == std::string::npos ? std::string() : path.substr(0, slash+1);
+
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (!line.empty() && line[line.size()-1] == '\r')
+			line.erase(line.size()-1);
+		if (line.empty() || line[0] == '#')
+			continue;
+		files.push_back(line[0] == '/' ? line : dir + line);
+	}
+}
+
+bool endsWith(const std::string &s, const std::string &end)
+{
+	return s.size() >= end.size() && s.compare(s.size()-end.size(), end.size(), end) == 0;
+}
+
+int usage(const char *name)
+{
+	std::cerr << "Usage: " << name
+		<< " [--output FILE.wav] [--rate HZ] [--width BITS] [--volume V] (file|playlist.m3u)..."
+		<< std::endl;
+	return 1;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	std::string output;
+	unsigned rate = 0;
+	int width = 0;
+	float volume = 1.0f;
+	std::vector<std::string> files;
+
+	for (int i=1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--output" && i+1 < argc)
+			output = argv[++i];
+		else if (arg == "--rate" && i+1 < argc)
+			rate = std::atoi(argv[++i]);
+		else if (arg == "--width" && i+1 < argc)
+			width = std::atoi(argv[++i]);
+		else if (arg == "--volume" && i+1 < argc)
+			volume = std::atof(argv[++i]);
+		else if (arg.size() > 1 && arg[0] == '-')
+			return usage(argv[0]);
+		else if (endsWith(arg, ".m3u") || endsWith(arg, ".m3u8"))
+			readPlaylist(arg, files);
+		else
+			files.push_back(arg);
+	}
+	if (files.empty())
+		return usage(argv[0]);
+
+	const std::vector<aKode::DecoderPlugin*> plugins = decoderPlugins();
+	std::vector<std::unique_ptr<TimedDecoderPlugin> > timedPlugins;
+	const std::shared_ptr<Manager> manager = std::make_shared<Manager>();
+	const std::shared_ptr<Checksum> checksum = std::make_shared<Checksum>();
+	const std::shared_ptr<aKode::Sink> sink = std::make_shared<aKode::WavSink>(output, rate, width);
+
+	aKode::Player player;
+	for (std::vector<aKode::DecoderPlugin*>::const_iterator i = plugins.begin(); i != plugins.end(); ++i)
+	{
+		timedPlugins.emplace_back(new TimedDecoderPlugin(*i));
+		player.registerDecoderPlugin(timedPlugins.back().get());
+	}
+	player.setManager(manager);
+	player.setMonitor(checksum);
+	player.setProfiling(true);
+
+	try
+	{
+		player.open(sink);
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << "Can't open the sink: " << e.what() << std::endl;
+		return 1;
+	}
+	player.setVolume(volume);
+
+	std::ostringstream tracks;
+	tracks.precision(6);
+	Stages total;
+	Times totalTimes;
+	double totalSeconds = 0;
+	int failures = 0;
+
+	// the checksum of every track's checksum, in order
+	Checksum all;
+
+	for (size_t t=0; t < files.size(); t++)
+	{
+		tracks << (t ? ",\n\t\t" : "\n\t\t") << "{\"file\": " << quoted(files[t]);
+
+		TimedDecoderPlugin::times = Times();
+		TimedDecoderPlugin::opened.clear();
+		checksum->reset();
+		manager->reset();
+
+		const double cpu = clockSeconds(CLOCK_PROCESS_CPUTIME_ID);
+		const double wall = clockSeconds(CLOCK_MONOTONIC);
+		bool ok;
+		try
+		{
+			player.load(files[t]);
+			player.play();
+			ok = manager->wait();
+			player.stop();
+		}
+		catch (std::exception &e)
+		{
+			tracks << ", \"error\": " << quoted(e.what()) << "}";
+			failures++;
+			continue;
+		}
+
+		Times times;
+		times.cpu = clockSeconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+		times.wall = clockSeconds(CLOCK_MONOTONIC) - wall;
+
+		const aKode::Player::Profile profile = player.profile();
+		Stages stages;
+		stages.decode = TimedDecoderPlugin::times;
+		stages.read += profile.read;
+		stages.resample += profile.resample;
+		stages.convert += profile.convert;
+		stages.volume += profile.volume;
+		stages.sink += profile.sink;
+		stages.monitor += profile.monitor;
+		player.unload();
+
+		const double seconds = double(profile.samples)/sink->audioConfiguration()->sample_rate;
+		const std::string sum = checksum->value();
+		all.add(sum);
+
+		tracks << ", \"decoder\": " << quoted(TimedDecoderPlugin::opened)
+			<< ", \"frames\": " << profile.frames
+			<< ", \"seconds\": " << seconds
+			<< ", \"cpu_seconds\": " << times.cpu
+			<< ", \"wall_seconds\": " << times.wall
+			<< ", \"realtime_factor\": " << (times.wall > 0 ? seconds/times.wall : 0.0)
+			<< ", \"checksum\": \"" << sum << "\", ";
+		writeStages(tracks, stages);
+		if (!ok)
+		{
+			tracks << ", \"error\": \"decoding failed\"";
+			failures++;
+		}
+		tracks << "}";
+
+		total += stages;
+		totalTimes += times;
+		totalSeconds += seconds;
+	}
+	player.close();
+	sink->close();
+
+	const aKode::AudioConfiguration *const config = sink->audioConfiguration();
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\n\t\"tool\": \"meow-render\",\n\t\"output\": " << quoted(output)
+		<< ",\n\t\"sample_rate\": " << config->sample_rate
+		<< ",\n\t\"sample_width\": " << int(config->sample_width)
+		<< ",\n\t\"channels\": " << int(config->channels)
+		<< ",\n\t\"tracks\": [" << tracks.str() << "\n\t],\n\t\"total\": {"
+		<< "\"seconds\": " << totalSeconds
+		<< ", \"cpu_seconds\": " << totalTimes.cpu
+		<< ", \"wall_seconds\": " << totalTimes.wall
+		<< ", \"realtime_factor\": " << (totalTimes.wall > 0 ? totalSeconds/totalTimes.wall : 0.0)
+		<< ", \"checksum\": \"" << all.value() << "\", ";
+	writeStages(json, total);
+	json << "},\n\t\"failures\": " << failures << "\n}";
+	std::cout << json.str() << std::endl;
+
+	return failures ? 1 : 0;
+}
+
+// kate: space-indent off; replace-tabs off;
@@ -0,0 +1,315 @@
+/*
+ * Talks to a stand-in for last.fm on localhost, by way of
+ * MEOW_SCROBBLE_URL, and checks what Meow::ScrobbleSession makes of
+ * each answer last.fm can give:
+ *
+ *   meow-scrobble-standin
+ *
+ * Prints JSON, one result per answer, and exits with 1 if any of them
+ * came out wrong, such as plays being dropped because the login was
+ * refused.
+ */
+
+#include "scrobble.h"
+
+#include <qcoreapplication.h>
+#include <qeventloop.h>
+#include <qtcpserver.h>
+#include <qtcpsocket.h>
+#include <qhostaddress.h>
+#include <qtimer.h>
+#include <qhash.h>
+#include <qurl.h>
+
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+
+using Meow::ScrobbleSession;
+
+// answers every request with whatever it's been told to
+class StandIn : public QTcpServer
+{
+	Q_OBJECT
+	QHash<QTcpSocket*, QByteArray> received;
+
+public:
+	StandIn()
+		: status(200), requests(0)
+	{
+		connect(this, SIGNAL(newConnection()), SLOT(accept()));
+	}
+
+	int status;
+	QByteArray body;
+
+	int requests;
+	QString lastMethod, lastSessionKey;
+
+private slots:
+	void accept()
+	{
+		while (QTcpSocket *const s = nextPendingConnection())
+		{
+			connect(s, SIGNAL(readyRead()), SLOT(read()));
+			connect(s, SIGNAL(disconnected()), SLOT(dropped()));
+		}
+	}
+
+	void read()
+	{
+		QTcpSocket *const s = static_cast<QTcpSocket*>(sender());
+		QByteArray &got = received[s];
+		got += s->readAll();
+
+		const int end = got.indexOf("\r\n\r\n");
+		if (end < 0)
+			return;
+		int length = 0;
+		const QList<QByteArray> headers = got.left(end).split('\n');
+		for (QList<QByteArray>::const_iterator i = headers.begin(); i != headers.end(); ++i)
+		{
+			if (i->toLower().startsWith("content-length:"))
+				length = i->mid(15).trimmed().toInt();
+		}
+		if (got.size() < end+4+length)
+			return;
+
+		QUrl query;
+		query.setEncodedQuery(got.mid(end+4, length));
+		received.remove(s);
+		requests++;
+		lastMethod = query.queryItemValue("method");
+		lastSessionKey = query.queryItemValue("sk");
+
+		QByteArray reply = "HTTP/1.1 " + QByteArray::number(status)
+			+ (status == 200 ? " OK" : " Error") + "\r\n"
+			"Content-Type: text/xml; charset=utf-8\r\n"
+			"Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+			"Connection: close\r\n\r\n";
+		s->write(reply + body);
+		s->disconnectFromHost();
+	}
+
+	void dropped()
+	{
+		QTcpSocket *const s = static_cast<QTcpSocket*>(sender());
+		received.remove(s);
+		s->deleteLater();
+	}
+};
+
+// waits for the session to say something
+class Recorder : public QObject
+{
+	Q_OBJECT
+
+public:
+	Recorder()
+		: result(-1), state(-1), expired(false)
+	{
+		timeout.setSingleShot(true);
+		connect(&timeout, SIGNAL(timeout()), &loop, SLOT(quit()));
+	}
+
+	QEventLoop loop;
+	QTimer timeout;
+	int result, state;
+	bool expired;
+
+	void wait()
+	{
+		result = state = -1;
+		timeout.start(10*1000);
+		loop.exec();
+		timeout.stop();
+	}
+
+public slots:
+	void submitCompleted(qint64, ScrobbleSession::SubmitResult r)
+	{
+		result = r;
+		loop.quit();
+	}
+	void handshakeState(ScrobbleSession::HandshakeState s)
+	{
+		state = s;
+		loop.quit();
+	}
+	void sessionExpired()
+	{
+		expired = true;
+	}
+};
+
+namespace
+{
+
+const char *const submitNames[] = { "ok", "retry", "rejected", "refused" };
+const char *const handshakeNames[] = { "ok", "client_banned", "auth", "failure" };
+
+std::string name(const char *const *names, int n, int value)
+{
+	return value >= 0 && value < n ? names[value] : "none";
+}
+
+QByteArray failed(int code)
+{
+	return "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+		"<lfm status=\"failed\"><error code=\"" + QByteArray::number(code)
+		+ "\">stand-in error</error></lfm>";
+}
+
+const char session[] =
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+	"<lfm status=\"ok\"><session><name>meow</name><key>standin-key</key>"
+	"<subscriber>0</subscriber></session></lfm>";
+const char accepted[] =
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+	"<lfm status=\"ok\"><scrobbles accepted=\"1\" ignored=\"0\"></scrobbles></lfm>";
+
+struct Results
+{
+	Results() : wrong(0), first(true) { }
+	std::ostringstream json;
+	int wrong;
+	bool first;
+
+	void add(const char *what, const std::string &expected, const std::string &got)
+	{
+		if (expected != got)
+			wrong++;
+		json << (first ? "" : ",") << "\n\t\t{ \"case\": \"" << what
+			<< "\", \"expected\": \"" << expected << "\", \"got\": \"" << got
+			<< "\", \"ok\": " << (expected == got ? "true" : "false") << " }";
+		first = false;
+	}
+};
+
+}
+
+int main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+
+	StandIn standIn;
+	if (!standIn.listen(QHostAddress::LocalHost))
+	{
+		std::cerr << "Can't listen: " << standIn.errorString().toLocal8Bit().data() << std::endl;
+		return 1;
+	}
+	const QByteArray url = "http://127.0.0.1:" + QByteArray::number(standIn.serverPort()) + "/2.0/";
+	qputenv("MEOW_SCROBBLE_URL", url);
+
+	ScrobbleSession scrobbleSession(0);
+	Recorder recorder;
+	QObject::connect(
+			&scrobbleSession, SIGNAL(submitCompleted(qint64, ScrobbleSession::SubmitResult)),
+			&recorder, SLOT(submitCompleted(qint64, ScrobbleSession::SubmitResult))
+		);
+	QObject::connect(
+			&scrobbleSession, SIGNAL(handshakeState(ScrobbleSession::HandshakeState)),
+			&recorder, SLOT(handshakeState(ScrobbleSession::HandshakeState))
+		);
+	QObject::connect(&scrobbleSession, SIGNAL(sessionExpired()), &recorder, SLOT(sessionExpired()));
+
+	Results results;
+	const int numHandshake = sizeof(handshakeNames)/sizeof(handshakeNames[0]);
+	const int numSubmit = sizeof(submitNames)/sizeof(submitNames[0]);
+
+	const struct
+	{
+		const char *what;
+		int code;
+		ScrobbleSession::HandshakeState expected;
+	} handshakes[] =
+	{
+		{ "handshake_auth_failed", 4, ScrobbleSession::HandshakeAuth },
+		{ "handshake_suspended_key", 26, ScrobbleSession::HandshakeClientBanned },
+		{ "handshake_offline", 11, ScrobbleSession::HandshakeFailure },
+		{ "handshake_ok", 0, ScrobbleSession::HandshakeOk },
+	};
+	for (unsigned i=0; i < sizeof(handshakes)/sizeof(handshakes[0]); i++)
+	{
+		standIn.status = handshakes[i].code ? 403 : 200;
+		standIn.body = handshakes[i].code ? failed(handshakes[i].code) : QByteArray(session);
+		scrobbleSession.startSession("meow", "5f4dcc3b5aa765d61d8327deb882cf99");
+		recorder.wait();
+		results.add(
+				handshakes[i].what,
+				name(handshakeNames, numHandshake, handshakes[i].expected),
+				name(handshakeNames, numHandshake, recorder.state)
+			);
+	}
+
+	QList<QStringList> tracks;
+	tracks << (QStringList()
+			<< "artist" << QString::fromUtf8("Björk")
+			<< "track" << QString::fromUtf8("Jóga")
+			<< "timestamp" << "1300000000"
+		);
+
+	// the invalid session key goes last, since it ends the session
+	const struct
+	{
+		const char *what;
+		int status;
+		int code;
+		ScrobbleSession::SubmitResult expected;
+	} submits[] =
+	{
+		{ "accepted", 200, 0, ScrobbleSession::SubmitOk },
+		{ "invalid_parameters", 400, 6, ScrobbleSession::SubmitRejected },
+		{ "auth_failed", 403, 4, ScrobbleSession::SubmitRefused },
+		{ "invalid_api_key", 403, 10, ScrobbleSession::SubmitRefused },
+		{ "invalid_signature", 403, 13, ScrobbleSession::SubmitRefused },
+		{ "suspended_key", 403, 26, ScrobbleSession::SubmitRefused },
+		{ "operation_failed", 500, 8, ScrobbleSession::SubmitRetry },
+		{ "offline", 503, 11, ScrobbleSession::SubmitRetry },
+		{ "temporarily_unavailable", 503, 16, ScrobbleSession::SubmitRetry },
+		{ "rate_limited", 429, 29, ScrobbleSession::SubmitRetry },
+		{ "server_error", 502, -1, ScrobbleSession::SubmitRetry },
+		{ "invalid_session", 403, 9, ScrobbleSession::SubmitRetry },
+	};
+	for (unsigned i=0; i < sizeof(submits)/sizeof(submits[0]); i++)
+	{
+		standIn.status = submits[i].status;
+		if (submits[i].code > 0)
+			standIn.body = failed(submits[i].code);
+		else if (submits[i].code == 0)
+			standIn.body = accepted;
+		else
+			standIn.body = "<html>Bad Gateway</html>";
+		scrobbleSession.submitTracks(tracks, i);
+		recorder.wait();
+		results.add(
+				submits[i].what,
+				name(submitNames, numSubmit, submits[i].expected),
+				name(submitNames, numSubmit, recorder.result)
+			);
+		if (i == 0)
+		{
+			results.add(
+					"submitted_method", "track.scrobble",
+					standIn.lastMethod.toUtf8().constData()
+				);
+			results.add(
+					"submitted_session_key", "standin-key",
+					standIn.lastSessionKey.toUtf8().constData()
+				);
+		}
+	}
+	results.add("session_expired", "true", recorder.expired ? "true" : "false");
+
+	std::ostringstream json;
+	json << "{\n\t\"tool\": \"meow-scrobble-standin\",\n\t\"requests\": " << standIn.requests
+		<< ",\n\t\"wrong\": " << results.wrong
+		<< ",\n\t\"results\": [" << results.json.str() << "\n\t]\n}";
+	std::cout << json.str() << std::endl;
+
+	return results.wrong ? 1 : 0;
+}
+
+#include "scrobble_standin.moc"
+
+// kate: space-indent off; replace-tabs off;
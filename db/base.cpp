@@ -1,22 +1,55 @@
 #include "base.h"
 
 #include "sqlt.h"
+#include "file.h"
 
 #include <stdexcept>
+#include <chrono>
+
+static const int statementCacheSize = 64;
+
+// meow_sort_key(text), so that sort_keys can be filled in by sqlite
+static void sortKeyFunction(sqlite3_context *context, int, sqlite3_value **argv)
+{
+	const QString label = QString::fromUtf8(
+			reinterpret_cast<const char*>(sqlite3_value_text(argv[0])),
+			sqlite3_value_bytes(argv[0])
+		);
+	const QByteArray key = Meow::sortKey(label);
+	sqlite3_result_blob(context, key.constData(), key.length(), SQLITE_TRANSIENT);
+}
+
+Meow::Base::Tuning::Tuning()
+{
+	mmapSize = 256*1024*1024;
+	cacheSize = 16*1024;
+	synchronous = SyncNormal;
+	readers = 3;
+}
+
 Meow::Base::Base()
 {
 	d = new BasePrivate;
+	d->cacheStats.hits = d->cacheStats.misses = 0;
+	d->cacheStats.prepares = d->cacheStats.prepareNanoseconds = 0;
 }
 
 Meow::Base::~Base()
 {
-	sqlite3_close(d->db);
+	close();
 	delete d;
 }
 
+void Meow::Base::setTuning(const Tuning &tuning)
+{
+	d->tuning = tuning;
+}
 
 bool Meow::Base::open(const QString &database)
 {
+	if (d->db)
+		close();
+	
 	int rc = sqlite3_open(
 			QFile::encodeName(database).data(), &d->db
 		);
@@ -31,19 +64,152 @@ bool Meow::Base::open(const QString &database)
 		return false;
 	}
 		
+	{
+		QMutexLocker l(&d->poolLock);
+		d->fileName = database;
+	}
+	d->readOnly = false;
+	
+	// WAL lets the readers in the pool run while we're writing
+	exec("pragma journal_mode=wal");
+	applyTuning();
 	initialize();
 
 	return true;
 }
 
+bool Meow::Base::openReadOnly(const QString &database)
+{
+	if (d->db)
+		close();
+	
+	int rc = sqlite3_open_v2(
+			QFile::encodeName(database).data(), &d->db,
+			SQLITE_OPEN_READONLY, 0
+		);
+	if (rc != SQLITE_OK)
+	{
+		std::cerr << "Failed to open " << database.toLatin1().data() << " for reading" << std::endl;
+		return false;
+	}
+	d->fileName = database;
+	d->readOnly = true;
+	applyTuning();
+	return true;
+}
+
+void Meow::Base::applyTuning()
+{
+	static const char *const synchronous[] = { "off", "normal", "full" };
+	
+	exec("pragma cache_size=-" + QString::number(d->tuning.cacheSize));
+	exec("pragma mmap_size=" + QString::number(d->tuning.mmapSize));
+	if (!d->readOnly)
+		exec(QString("pragma synchronous=") + synchronous[d->tuning.synchronous]);
+}
+
+QString Meow::Base::fileName() const
+{
+	return d->fileName;
+}
+
+bool Meow::Base::hasFullTextSearch()
+{
+	return sqlite3_compileoption_used("ENABLE_FTS5");
+}
+
+void Meow::Base::interrupt()
+{
+	if (d->db)
+		sqlite3_interrupt(d->db);
+}
+
 bool Meow::Base::close()
 {
+	if (!d->db)
+		return true;
+	closeReaders();
+	
+	// so that the main file is complete when someone copies it
+	if (!d->readOnly)
+		exec("pragma wal_checkpoint(full)");
+	clearStatementCache();
+	
+#if SQLITE_VERSION_NUMBER >= 3007014
+	// statements that are still around get finalized later
+	sqlite3_close_v2(d->db);
+#else
 	if (SQLITE_BUSY == sqlite3_close(d->db))
 		return false;
+#endif
 	d->db = 0;
 	return true;
 }
 
+Meow::Base *Meow::Base::acquireReader()
+{
+	{
+		QMutexLocker l(&d->poolLock);
+		if (!d->idleReaders.isEmpty())
+			return d->idleReaders.takeLast();
+	}
+	
+	QString fileName;
+	{
+		QMutexLocker l(&d->poolLock);
+		if (!d->db)
+			return 0;
+		fileName = d->fileName;
+	}
+	
+	Base *const reader = new Base;
+	reader->setTuning(d->tuning);
+	if (!reader->openReadOnly(fileName))
+	{
+		delete reader;
+		return 0;
+	}
+	return reader;
+}
+
+void Meow::Base::releaseReader(Base *reader)
+{
+	if (!reader)
+		return;
+	{
+		QMutexLocker l(&d->poolLock);
+		// don't give it back to the pool if it's for a database
+		// we've since closed
+		if (reader->fileName() == d->fileName && d->db
+			&& d->idleReaders.count() < d->tuning.readers)
+		{
+			d->idleReaders.append(reader);
+			return;
+		}
+	}
+	delete reader;
+}
+
+void Meow::Base::closeReaders()
+{
+	QList<Base*> readers;
+	{
+		QMutexLocker l(&d->poolLock);
+		readers.swap(d->idleReaders);
+	}
+	qDeleteAll(readers);
+}
+
+Meow::Base::Reader::Reader(Base *owner)
+	: owner(owner), connection(owner->acquireReader())
+{
+}
+
+Meow::Base::Reader::~Reader()
+{
+	owner->releaseReader(connection);
+}
+
 void Meow::Base::initialize()
 {
 	bool doMigrate=false;
@@ -81,12 +247,41 @@ void Meow::Base::initialize()
 			"create table if not exists albums ("
 				"album text not null primary key, "
 				"flags integer not null)",
+			"create table if not exists sort_keys ("
+				"song_id integer not null primary key, "
+				"artist blob not null, "
+				"album blob not null, "
+				"label blob not null)",
+			"create table if not exists sort_collation ("
+				"collation text not null)",
+			"create table if not exists shuffle ("
+				"seed integer not null, "
+				"range integer not null, "
+				"position integer not null)",
+			"create table if not exists change_counter ("
+				"instance integer not null, "
+				"counter integer not null)",
+			"create table if not exists watched_folders ("
+				"path text not null primary key)",
+			"create table if not exists file_times ("
+				"song_id integer not null primary key, "
+				"mtime integer not null)",
+			"create table if not exists scrobble_queue ("
+				"id integer primary key autoincrement, "
+				"keys text not null)",
+			// integrated is null if the song couldn't be measured
+			"create table if not exists loudness ("
+				"song_id integer not null primary key, "
+				"integrated real, "
+				"peak real not null, "
+				"energy real not null, "
+				"blocks integer not null)",
 			0
 		};
 
 	for (int i=0; tables[i]; i++)
 		exec(tables[i]);
-
+	
 	if (doMigrate)
 	{
 		exec("insert into songs (song_id, length, url) select song_id, length, url from songs_migrate");
@@ -98,11 +293,85 @@ void Meow::Base::initialize()
 		exec("vacuum");
 	}
 	
+	// after the migration, which would have taken it with the old table
+	exec("create index if not exists songs_url on songs (url)");
+	// the songs on the same album as another, for its loudness
+	exec("create index if not exists tags_value on tags (tag, value)");
+	
+	// counts the changes to what's in the tree, so that a Snapshot
+	// can tell if it's still good. The instance tells databases apart
+	exec(
+			"insert into change_counter select random(), 0 "
+			"where not exists (select * from change_counter)"
+		);
+	{
+		static const char *const counted[] = { "songs", "tags", "albums", "sort_keys", 0 };
+		static const char *const changes[] = { "insert", "update", "delete", 0 };
+		for (int t=0; counted[t]; t++)
+		{
+			for (int c=0; changes[c]; c++)
+			{
+				exec(
+						QString("create trigger if not exists %1_%2_counter after %2 on %1 "
+							"begin update change_counter set counter=counter+1; end")
+							.arg(counted[t]).arg(changes[c])
+					);
+			}
+		}
+	}
+	
+	// the keys are only good for the collation they were made with
+	const QString collation = sortKeyCollation();
+	if (execValue("select collation from sort_collation") != collation)
+	{
+		sqlite3_create_function(
+				d->db, "meow_sort_key", 1, SQLITE_UTF8, 0,
+				sortKeyFunction, 0, 0
+			);
+		exec("delete from sort_keys");
+		exec("delete from sort_collation");
+		sql("insert into sort_collation values(?)").arg(collation).exec();
+		exec(
+				"insert into sort_keys (song_id, artist, album, label) "
+				"select songs.song_id, meow_sort_key(ifnull(a.value, '')), "
+				"meow_sort_key(ifnull(b.value, '')), "
+				"meow_sort_key(case when ifnull(t.value, '')='' then ifnull(c.value, '') "
+					"else t.value || '. ' || ifnull(c.value, '') end) "
+				"from songs "
+				"left outer join tags as a on a.song_id=songs.song_id and a.tag='artist' "
+				"left outer join tags as b on b.song_id=songs.song_id and b.tag='album' "
+				"left outer join tags as c on c.song_id=songs.song_id and c.tag='title' "
+				"left outer join tags as t on t.song_id=songs.song_id and t.tag='track'"
+			);
+	}
+	
+	if (hasFullTextSearch())
+	{
+		const bool indexed
+			= 0 != execValue("select count(*) from sqlite_master where name='song_search'").toInt();
+		// the rowid is the song_id
+		exec(
+				"create virtual table if not exists song_search using fts5("
+					"artist, album, title, "
+					"tokenize=\"unicode61 remove_diacritics 0\")"
+			);
+		if (!indexed)
+		{
+			exec(
+					"insert into song_search (rowid, artist, album, title) "
+					"select songs.song_id, a.value, b.value, c.value from songs "
+					"left outer join tags as a on a.song_id=songs.song_id and a.tag='artist' "
+					"left outer join tags as b on b.song_id=songs.song_id and b.tag='album' "
+					"left outer join tags as c on c.song_id=songs.song_id and c.tag='title'"
+				);
+		}
+	}
+	
 	exec("commit transaction");
 }
 
-Meow::Base::Statement::Shared::Shared(sqlite3 *db, sqlite3_stmt *statement)
-	: db(db), statement(statement)
+Meow::Base::Statement::Shared::Shared(sqlite3 *db, sqlite3_stmt *statement, QMutex *lock)
+	: db(db), statement(statement), lock(lock)
 {
 	refs = 1;
 	statement = 0;
@@ -132,7 +401,8 @@ Meow::Base::Statement &Meow::Base::Statement::operator=(const Statement &o)
 	if (shared && --shared->refs==0)
 		delete shared;
 	shared = o.shared;
-	shared->refs++;
+	if (shared)
+		shared->refs++;
 	return *this;
 }
 
@@ -155,6 +425,18 @@ Meow::Base::Statement& Meow::Base::Statement::arg(int n)
 	return *this;
 }
 
+Meow::Base::Statement& Meow::Base::Statement::arg(double n)
+{
+	sqlite3_bind_double(shared->statement, ++shared->bindingIndex, n);
+	return *this;
+}
+
+Meow::Base::Statement& Meow::Base::Statement::argBlob(const QByteArray &bytes)
+{
+	sqlite3_bind_blob(shared->statement, ++shared->bindingIndex, bytes.constData(), bytes.length(), SQLITE_TRANSIENT);
+	return *this;
+}
+
 namespace
 {
 struct Nothing { void operator() (const std::vector<QString> &) { } };
@@ -192,17 +474,77 @@ QString Meow::Base::Statement::execValue()
 
 Meow::Base::Statement Meow::Base::sql(const QString &s)
 {
+	QMutexLocker l(&d->cacheLock);
+	
+	QHash<QString, BasePrivate::CachedStatement>::iterator i
+		= d->statementCache.find(s);
+	if (i != d->statementCache.end())
+	{
+		Statement::Shared *const shared = i->statement.shared;
+		if (shared->refs == 1)
+		{ // only the cache has it, so nobody is in the middle of using it
+			d->statementAge.splice(d->statementAge.begin(), d->statementAge, i->age);
+			sqlite3_reset(shared->statement);
+			sqlite3_clear_bindings(shared->statement);
+			shared->bindingIndex = 0;
+			d->cacheStats.hits++;
+			return i->statement;
+		}
+	}
+	
+	d->cacheStats.misses++;
+	Statement st = prepare(s);
+	if (!st.shared->statement || i != d->statementCache.end())
+		return st;
+	
+	d->statementAge.push_front(s);
+	BasePrivate::CachedStatement &cached = d->statementCache[s];
+	cached.statement = st;
+	cached.age = d->statementAge.begin();
+	
+	if (d->statementCache.size() > statementCacheSize)
+	{
+		d->statementCache.remove(d->statementAge.back());
+		d->statementAge.pop_back();
+	}
+	return st;
+}
+
+Meow::Base::Statement Meow::Base::prepare(const QString &s)
+{
+	const std::chrono::steady_clock::time_point started
+		= std::chrono::steady_clock::now();
+	
 	sqlite3_stmt *stmt;
 	QByteArray utf8 = s.toUtf8();
 	if (SQLITE_OK != sqlite3_prepare_v2(d->db, utf8.constData(), utf8.length(), &stmt, 0))
 	{
 		std::cerr << "SQLite error (prepare): " << sqlite3_errmsg(d->db) << ": <<<" << utf8.constData() << ">>>" << std::endl;
 	}
+	
+	d->cacheStats.prepares++;
+	d->cacheStats.prepareNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - started
+		).count();
+	
 	Statement st;
-	st.shared = new Statement::Shared(d->db, stmt);
+	st.shared = new Statement::Shared(d->db, stmt, d->readOnly ? 0 : &d->writeLock);
 	return st;
 }
 
+Meow::Base::StatementCacheStats Meow::Base::statementCacheStats() const
+{
+	QMutexLocker l(&d->cacheLock);
+	return d->cacheStats;
+}
+
+void Meow::Base::clearStatementCache()
+{
+	QMutexLocker l(&d->cacheLock);
+	d->statementCache.clear();
+	d->statementAge.clear();
+}
+
 
 
 QString Meow::Base::execValue(const QString &s)
@@ -6,6 +6,10 @@
 
 #include <sqlite3.h>
 
+#include <atomic>
+
+class QMutex;
+
 namespace Meow
 {
 
@@ -18,19 +22,79 @@ public:
 	Base();
 	~Base();
 
+	/**
+	 * how the connections are set up, see @ref setTuning
+	 **/
+	struct Tuning
+	{
+		Tuning();
+		
+		enum Synchronous { SyncOff=0, SyncNormal=1, SyncFull=2 };
+		
+		/**
+		 * bytes of the database file that sqlite may memory map,
+		 * 0 disables memory mapped I/O
+		 **/
+		long long mmapSize;
+		/**
+		 * size of each connection's page cache in KiB
+		 **/
+		int cacheSize;
+		/**
+		 * how often sqlite waits for the disk. In WAL mode, Normal
+		 * can't corrupt the database, it can only lose the last
+		 * few transactions on power loss
+		 **/
+		Synchronous synchronous;
+		/**
+		 * how many idle read-only connections are kept open
+		 **/
+		int readers;
+	};
+	
+	/**
+	 * takes effect on the next @ref open
+	 **/
+	void setTuning(const Tuning &tuning);
+
 	bool open(const QString &database);
+	/**
+	 * open an existing database without touching its schema,
+	 * the connection may only be used for reading
+	 **/
+	bool openReadOnly(const QString &database);
 	bool close();
 
+	/**
+	 * the filename given to @ref open
+	 **/
+	QString fileName() const;
+
+	/**
+	 * abort whatever statement is currently running on this
+	 * connection. Can be called from any thread
+	 **/
+	void interrupt();
+	
+	/**
+	 * true if this sqlite has FTS5, and so the song_search
+	 * table exists
+	 **/
+	static bool hasFullTextSearch();
+
 	struct Statement
 	{
 		struct Shared
 		{
-			int refs;
+			std::atomic<int> refs;
 			sqlite3 *const db;
 			sqlite3_stmt *const statement;
+			// held while a statement on the write connection runs,
+			// null for statements on read-only connections
+			QMutex *const lock;
 			int bindingIndex;
 			
-			Shared(sqlite3 *db, sqlite3_stmt *statement);
+			Shared(sqlite3 *db, sqlite3_stmt *statement, QMutex *lock);
 			~Shared();
 		};
 		Shared *shared;
@@ -50,6 +114,11 @@ public:
 			return arg( static_cast<long long>(n) );
 		}
 		Statement& arg(int n);
+		Statement& arg(double n);
+		/**
+		 * bind @p bytes as a blob, not as text
+		 **/
+		Statement& argBlob(const QByteArray &bytes);
 
 		template<class T>
 		int64_t exec(T &function);
@@ -62,7 +131,27 @@ public:
 	
 	static QString escape(const QString &s);
 
+	/**
+	 * prepare @p s, or reuse the prepared statement from an earlier
+	 * call with the same text if it's not in use
+	 **/
 	Statement sql(const QString &s);
+	/**
+	 * prepare @p s for a caller that keeps it, without the cache,
+	 * so that it doesn't take up a slot that @ref sql can't reuse
+	 **/
+	Statement prepare(const QString &s);
+	
+	struct StatementCacheStats
+	{
+		uint64_t hits, misses;
+		/**
+		 * how many times sqlite3_prepare was called, and how long
+		 * it took altogether
+		 **/
+		uint64_t prepares, prepareNanoseconds;
+	};
+	StatementCacheStats statementCacheStats() const;
 	
 	int64_t exec(const QString &s)
 	{
@@ -74,8 +163,41 @@ public:
 		return sql(s).exec(function);
 	}
 	
+	/**
+	 * A read-only connection to the same database, borrowed from
+	 * a pool for as long as this object exists. Use one of these
+	 * from threads other than the one that writes, so that
+	 * reading never waits for the writer (the database is in
+	 * WAL mode).
+	 *
+	 * A Reader, and the statements made with it, must only be used
+	 * by one thread at a time.
+	 **/
+	class Reader
+	{
+		Base *const owner;
+		Base *const connection;
+		Reader(const Reader&);
+		Reader &operator=(const Reader&);
+	public:
+		Reader(Base *owner);
+		~Reader();
+		
+		/**
+		 * false if the database couldn't be opened
+		 **/
+		bool isValid() const { return connection != 0; }
+		Base *operator->() const { return connection; }
+		Base &operator*() const { return *connection; }
+	};
+	
 private:
 	void initialize();
+	void applyTuning();
+	void clearStatementCache();
+	Base *acquireReader();
+	void releaseReader(Base *reader);
+	void closeReaders();
 };
 
 
@@ -1,21 +1,29 @@
 #include "collection.h"
 #include "file.h"
 #include "sqlt.h"
+#include "snapshot.h"
 
 #ifdef _WIN32
 #define TAGLIB_STATIC
 #endif
 
+#include <taglib/taglib.h>
 #include <taglib/tag.h>
 #include <taglib/fileref.h>
+#include <taglib/audioproperties.h>
 
 #include <qfile.h>
+#include <qfileinfo.h>
 #include <qtimer.h>
 #include <qevent.h>
 #include <qapplication.h>
+#include <qmutex.h>
+#include <qelapsedtimer.h>
 
 #include <vector>
 #include <map>
+#include <cmath>
+#include <atomic>
 
 
 namespace
@@ -33,6 +41,17 @@ public:
 	const bool playNow;
 };
 
+class AddFilesEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+11);
+	AddFilesEvent(const QStringList &files)
+		: QEvent(type), files(files)
+	{}
+	
+	const QStringList files;
+};
+
 class ReloadFileEvent : public QEvent
 {
 public:
@@ -48,8 +67,8 @@ class FileReloadedEvent : public QEvent
 {
 public:
 	static const Type type = QEvent::Type(QEvent::User+3);
-	FileReloadedEvent(const Meow::File &file, TagLib::FileRef *const f)
-		: QEvent(type), file(file), f(f)
+	FileReloadedEvent(const Meow::File &file, TagLib::FileRef *const f, uint mtime)
+		: QEvent(type), file(file), f(f), mtime(mtime)
 	{}
 	
 	~FileReloadedEvent()
@@ -59,14 +78,15 @@ public:
 	
 	const Meow::File file;
 	TagLib::FileRef *const f;
+	const uint mtime;
 };
 
 class FileAddedEvent : public QEvent
 {
 public:
 	static const Type type = QEvent::Type(QEvent::User+4);
-	FileAddedEvent(const QString &file, bool playNow, TagLib::FileRef *const f)
-		: QEvent(type), file(file), playNow(playNow), f(f)
+	FileAddedEvent(const QString &file, bool playNow, TagLib::FileRef *const f, uint mtime)
+		: QEvent(type), file(file), playNow(playNow), f(f), mtime(mtime)
 	{}
 	
 	~FileAddedEvent()
@@ -77,6 +97,7 @@ public:
 	const QString file;
 	const bool playNow;
 	TagLib::FileRef *const f;
+	const uint mtime;
 };
 
 class DoneWithJobEvent : public QEvent
@@ -96,6 +117,54 @@ public:
 	{}
 };
 
+class FilesLoadedEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+7);
+	FilesLoadedEvent(int generation, const QVector<Meow::File> &files)
+		: QEvent(type), generation(generation), files(files)
+	{}
+	
+	const int generation;
+	const QVector<Meow::File> files;
+};
+
+class SearchEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+9);
+	SearchEvent(const QString &text, int generation)
+		: QEvent(type), text(text), generation(generation)
+	{}
+	
+	const QString text;
+	const int generation;
+};
+
+class SearchResultsEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+10);
+	SearchResultsEvent(const QString &text, int generation, const QVector<Meow::FileId> &files)
+		: QEvent(type), text(text), generation(generation), files(files)
+	{}
+	
+	const QString text;
+	const int generation;
+	const QVector<Meow::FileId> files;
+};
+
+class LoadingDoneEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+8);
+	LoadingDoneEvent(int generation)
+		: QEvent(type), generation(generation)
+	{}
+	
+	const int generation;
+};
+
 
 }
 
@@ -109,8 +178,11 @@ class Meow::Collection::AddThread : public QThread
 	Collection *const c;
 
 public:
+	// nanoseconds spent in TagLib, see Collection::timings
+	std::atomic<qint64> taglibTime;
+	
 	AddThread(Collection *c)
-		: c(c)
+		: c(c), taglibTime(0)
 	{
 	}
 	virtual void run()
@@ -118,34 +190,56 @@ public:
 		exec();
 	}
 	
+	static uint modificationTime(const QString &file)
+	{
+		return QFileInfo(file).lastModified().toTime_t();
+	}
+	
+	TagLib::FileRef *readTags(const QString &file)
+	{
+		QElapsedTimer timer;
+		timer.start();
+		TagLib::FileRef *f = new TagLib::FileRef(QFile::encodeName(file).data());
+		if (f->isNull() || !f->file() || !f->file()->isValid())
+		{
+			delete f;
+			f = 0;
+		}
+		taglibTime += timer.nsecsElapsed();
+		return f;
+	}
+	
+	void addFile(const QString &file, bool playNow)
+	{
+		TagLib::FileRef *const f = readTags(file);
+		if (!f)
+			return;
+		
+		QApplication::postEvent(c, new FileAddedEvent(file, playNow, f, modificationTime(file)));
+	}
+	
 	virtual bool event(QEvent *e)
 	{
 		if (e->type() == AddFileEvent::type)
 		{
 			AddFileEvent *const afe = static_cast<AddFileEvent*>(e);
-			const QString file = afe->file;
-		
-			TagLib::FileRef *const f = new TagLib::FileRef(QFile::encodeName(file).data());
-			if (f->isNull() || !f->file() || !f->file()->isValid())
-			{
-				delete f;
-				return true;
-			}
-			
-			QApplication::postEvent(c, new FileAddedEvent(file, afe->playNow, f));
+			addFile(afe->file, afe->playNow);
+		}
+		else if (e->type() == AddFilesEvent::type)
+		{
+			const QStringList &files = static_cast<AddFilesEvent*>(e)->files;
+			for (QStringList::const_iterator i = files.begin(); i != files.end(); ++i)
+				addFile(*i, false);
 		}
 		else if (e->type() == ReloadFileEvent::type)
 		{
 			const File file = static_cast<ReloadFileEvent*>(e)->file;
 		
-			TagLib::FileRef *const f = new TagLib::FileRef(QFile::encodeName(file.file()).data());
-			if (f->isNull() || !f->file() || !f->file()->isValid())
-			{
-				delete f;
+			TagLib::FileRef *const f = readTags(file.file());
+			if (!f)
 				return true;
-			}
 			
-			QApplication::postEvent(c, new FileReloadedEvent(file, f));
+			QApplication::postEvent(c, new FileReloadedEvent(file, f, modificationTime(file.file())));
 		}
 		else if (e->type() == FinishJobEvent::type)
 		{
@@ -158,32 +252,125 @@ public:
 
 
 
+class Meow::Collection::SearchThread : public QThread
+{
+	Collection *const c;
+	Base *const base;
+
+	struct CollectIds
+	{
+		QVector<FileId> ids;
+		void operator() (const std::vector<QString> &vals)
+		{
+			ids.append(vals[0].toULongLong());
+		}
+	};
+
+public:
+	// the generation of the most recent search, anything
+	// older than that is not worth doing
+	std::atomic<int> latest;
+	
+	SearchThread(Collection *c, Base *base)
+		: c(c), base(base), latest(0)
+	{
+	}
+	virtual void run()
+	{
+		exec();
+	}
+	
+	virtual bool event(QEvent *e)
+	{
+		if (e->type() != SearchEvent::type)
+			return QThread::event(e);
+		
+		SearchEvent *const se = static_cast<SearchEvent*>(e);
+		if (se->generation != latest)
+			return true;
+		
+		QString query;
+		const QStringList terms = searchTerms(se->text);
+		for (QStringList::const_iterator i = terms.begin(); i != terms.end(); ++i)
+		{
+			QString term = *i;
+			term.replace("\"", "\"\"");
+			if (!query.isEmpty())
+				query += ' ';
+			query += "\"" + term + "\"*";
+		}
+		
+		CollectIds results;
+		Base::Reader reader(base);
+		if (reader.isValid() && !query.isEmpty())
+		{
+			reader->sql("select rowid from song_search where song_search match ?")
+				.arg(query).exec(results);
+		}
+		
+		QApplication::postEvent(c, new SearchResultsEvent(se->text, se->generation, results.ids));
+		return true;
+	}
+};
+
+
 struct Meow::Collection::Private
 {
 	QString bigSelectJoin;
 	Base::Statement selectOneSql;
 
 	Base::Statement updateUrlSql, deleteTagsSql, insertSql, insertTagsSql;
+	Base::Statement deleteSongSql;
+	Base::Statement setSortKeysSql, deleteSortKeysSql;
+	Base::Statement selectAlbumFlagsSql, setAlbumFlagsSql, deleteAlbumFlagsSql;
+	Base::Statement selectByAlbumSql;
+	Base::Statement deleteSearchSql, insertSearchSql;
+	Base::Statement selectShuffleSql, setShuffleSql;
+	Base::Statement setFileTimeSql, deleteFileTimeSql;
+	Base::Statement selectByUrlSql, selectUnderUrlSql;
+	Base::Statement selectWatchedSql, insertWatchedSql, deleteWatchedSql;
+	Base::Statement insertScrobbleSql, selectScrobblesSql, deleteScrobblesSql;
+	Base::Statement selectLoudnessSql, setLoudnessSql, setUnmeasurableSql;
+	Base::Statement deleteLoudnessSql, selectUnmeasuredSql;
+	
+	// added files that haven't been emitted in an addedBatch yet
+	QVector<File> pendingAdded;
+	
+	// for timings(), with AddThread::taglibTime
+	qint64 keysTime, sqlTime;
+	qint64 timedFiles;
 	
 	LoadAll *allLoader;
+	// incremented each time we start loading, so that
+	// chunks posted by an old loader can be ignored
+	int loadGeneration;
 };
 
 Meow::Collection::Collection(Base *base)
-	: base(base), addThread(0)
+	: base(base), addThread(0), searchThread(0)
 {
 	d = new Private;
 	d->allLoader=0;
+	d->loadGeneration=0;
+	d->keysTime=0;
+	d->sqlTime=0;
+	d->timedFiles=0;
 
 
 	addThread = new AddThread(this);
 	addThread->moveToThread(addThread);
 	addThread->start(AddThread::LowestPriority);
+	
+	searchThread = new SearchThread(this, base);
+	searchThread->moveToThread(searchThread);
+	searchThread->start();
 }
 
 void Meow::Collection::newDatabase()
 {
 	{
-		QString statement = "select songs.song_id, songs.url, albums.flags";
+		QString statement = "select songs.song_id, songs.url, songs.length, albums.flags, "
+			"hex(sort_keys.artist), hex(sort_keys.album), hex(sort_keys.label)";
 		for (int i=0; i < numTags; i++)
 		{
 			QString tagCol = "tag_";
@@ -201,24 +388,95 @@ void Meow::Collection::newDatabase()
 		}
 
 		statement += " left outer join albums on tag_b.value=albums.album";
+		statement += " left outer join sort_keys on sort_keys.song_id=songs.song_id";
 		d->bigSelectJoin = statement;
 	}
 	
-	d->selectOneSql = base->sql(d->bigSelectJoin + " where songs.song_id=?");
-	d->updateUrlSql = base->sql("update songs set url=? where song_id=?");
-	d->deleteTagsSql = base->sql("delete from tags where song_id=?");
-	d->insertSql = base->sql("insert into songs values(null, 0, ?)");
-	d->insertTagsSql = base->sql("insert into tags values(?, ?, ?)");
+	d->selectOneSql = base->prepare(d->bigSelectJoin + " where songs.song_id=?");
+	d->updateUrlSql = base->prepare("update songs set url=?, length=? where song_id=?");
+	d->deleteTagsSql = base->prepare("delete from tags where song_id=?");
+	d->insertSql = base->prepare("insert into songs values(null, ?, ?)");
+	d->insertTagsSql = base->prepare("insert into tags values(?, ?, ?)");
+	d->deleteSongSql = base->prepare("delete from songs where song_id=?");
+	d->setSortKeysSql = base->prepare("insert or replace into sort_keys values(?, ?, ?, ?)");
+	d->deleteSortKeysSql = base->prepare("delete from sort_keys where song_id=?");
+	
+	d->selectAlbumFlagsSql = base->prepare("select flags from albums where album=?");
+	d->setAlbumFlagsSql = base->prepare("insert or replace into albums (album, flags) values(?, 1)");
+	d->deleteAlbumFlagsSql = base->prepare("delete from albums where album=?");
+	d->selectByAlbumSql = base->prepare(d->bigSelectJoin + " where tag_b.value=?");
+	
+	d->selectShuffleSql = base->prepare("select seed, range, position from shuffle");
+	// there's only ever the one row
+	d->setShuffleSql = base->prepare("insert or replace into shuffle (rowid, seed, range, position) values(1, ?, ?, ?)");
+	
+	d->setFileTimeSql = base->prepare("insert or replace into file_times values(?, ?)");
+	d->deleteFileTimeSql = base->prepare("delete from file_times where song_id=?");
+	d->selectByUrlSql = base->prepare("select song_id from songs where url=?");
+	// the url itself or anything in it as a folder, in a way
+	// that can use the index: '0' comes right after '/'
+	d->selectUnderUrlSql = base->prepare(
+			"select song_id from songs where url=?1 or (url>?1||'/' and url<?1||'0')"
+		);
+	d->selectWatchedSql = base->prepare("select path from watched_folders");
+	d->insertWatchedSql = base->prepare("insert or replace into watched_folders values(?)");
+	d->deleteWatchedSql = base->prepare("delete from watched_folders where path=?");
+	
+	d->insertScrobbleSql = base->prepare("insert into scrobble_queue (keys) values(?)");
+	d->selectScrobblesSql = base->prepare("select id, keys from scrobble_queue where id>? order by id limit ?");
+	d->deleteScrobblesSql = base->prepare("delete from scrobble_queue where id between ? and ?");
+	
+	// the album is every measured song with the same album tag
+	d->selectLoudnessSql = base->prepare(
+			"select loudness.integrated, loudness.peak, loudness.energy, loudness.blocks, "
+			"sum(album_loudness.energy), sum(album_loudness.blocks), max(album_loudness.peak) "
+			"from loudness "
+			"left outer join tags as album on album.song_id=loudness.song_id "
+				"and album.tag='album' and album.value<>'' "
+			"left outer join tags as same_album on same_album.tag='album' "
+				"and same_album.value=album.value "
+			"left outer join loudness as album_loudness on album_loudness.song_id=same_album.song_id "
+				"and album_loudness.integrated is not null "
+			"where loudness.song_id=?"
+		);
+	// a song can be removed while it's being measured
+	d->setLoudnessSql = base->prepare(
+			"insert or replace into loudness select ?1, ?2, ?3, ?4, ?5 "
+			"where exists (select * from songs where song_id=?1)"
+		);
+	d->setUnmeasurableSql = base->prepare(
+			"insert or replace into loudness select ?1, null, 0, 0, 0 "
+			"where exists (select * from songs where song_id=?1)"
+		);
+	d->deleteLoudnessSql = base->prepare("delete from loudness where song_id=?");
+	d->selectUnmeasuredSql = base->prepare(
+			"select songs.song_id, songs.url from songs "
+			"left outer join loudness on loudness.song_id=songs.song_id "
+			"where loudness.song_id is null and songs.song_id>? "
+			"order by songs.song_id limit ?"
+		);
+	
+	if (hasSearchIndex())
+	{
+		d->deleteSearchSql = base->prepare("delete from song_search where rowid=?");
+		d->insertSearchSql = base->prepare("insert into song_search (rowid, artist, album, title) values(?, ?, ?, ?)");
+	}
 }
 
 
 Meow::Collection::~Collection()
 {
+	stop();
 	if (addThread)
 	{
 		addThread->quit();
 		addThread->wait();
 	}
+	if (searchThread)
+	{
+		searchThread->quit();
+		searchThread->wait();
+	}
 	delete d;
 }
 
@@ -227,11 +485,106 @@ void Meow::Collection::add(const QString &file, bool playNow)
 	QApplication::postEvent(addThread, new AddFileEvent(file, playNow));
 }
 
+void Meow::Collection::add(const QStringList &files)
+{
+	if (!files.isEmpty())
+		QApplication::postEvent(addThread, new AddFilesEvent(files));
+}
+
 void Meow::Collection::reload(const Meow::File &file)
 {
 	QApplication::postEvent(addThread, new ReloadFileEvent(file));
 }
 
+namespace
+{
+struct CollectFileIds
+{
+	std::vector<Meow::FileId> ids;
+	void operator() (const std::vector<QString> &vals)
+	{
+		ids.push_back(vals[0].toULongLong());
+	}
+};
+}
+
+void Meow::Collection::update(const QStringList &files)
+{
+	QStringList added;
+	for (QStringList::const_iterator i = files.begin(); i != files.end(); ++i)
+	{
+		CollectFileIds found;
+		d->selectByUrlSql.arg(*i).exec(found);
+		if (found.ids.empty())
+			added.append(*i);
+		else
+			reload(getSong(found.ids[0]));
+	}
+	add(added);
+}
+
+void Meow::Collection::removeUrls(const QStringList &urls)
+{
+	CollectFileIds found;
+	for (QStringList::const_iterator i = urls.begin(); i != urls.end(); ++i)
+		d->selectUnderUrlSql.arg(*i).exec(found);
+	if (found.ids.empty())
+		return;
+	
+	remove(found.ids);
+	emit removed(QVector<FileId>::fromStdVector(found.ids));
+}
+
+namespace
+{
+struct CollectFileTimes
+{
+	QHash<QString, uint> times;
+	void operator() (const std::vector<QString> &vals)
+	{
+		times.insert(vals[0], vals[1].toUInt());
+	}
+};
+struct CollectStrings
+{
+	QStringList strings;
+	void operator() (const std::vector<QString> &vals)
+	{
+		strings.append(vals[0]);
+	}
+};
+}
+
+QHash<QString, uint> Meow::Collection::modificationTimes(const QString &folder) const
+{
+	CollectFileTimes times;
+	Base::Reader reader(base);
+	if (reader.isValid())
+	{
+		reader->sql(
+				"select songs.url, ifnull(file_times.mtime, 0) from songs "
+				"left outer join file_times on file_times.song_id=songs.song_id "
+				"where songs.url>?1||'/' and songs.url<?1||'0'"
+			).arg(folder).exec(times);
+	}
+	return times.times;
+}
+
+QStringList Meow::Collection::watchedFolders()
+{
+	CollectStrings folders;
+	d->selectWatchedSql.exec(folders);
+	return folders.strings;
+}
+
+void Meow::Collection::setWatched(const QString &folder, bool yes)
+{
+	if (yes)
+		d->insertWatchedSql.arg(folder).exec();
+	else
+		d->deleteWatchedSql.arg(folder).exec();
+}
+
 
 void Meow::Collection::remove(const std::vector<FileId> &files)
 {
@@ -239,16 +592,17 @@ void Meow::Collection::remove(const std::vector<FileId> &files)
 		return;
 	base->exec("savepoint remove");
 	
-	QString songids;
 	for (std::vector<FileId>::const_iterator i=files.begin(); i != files.end(); ++i)
 	{
-		if (songids.length() >0)
-			songids += " or ";
-		songids += "song_id=" + QString::number(*i);
+		d->deleteSongSql.arg(*i).exec();
+		d->deleteTagsSql.arg(*i).exec();
+		d->deleteSortKeysSql.arg(*i).exec();
+		d->deleteFileTimeSql.arg(*i).exec();
+		d->deleteLoudnessSql.arg(*i).exec();
+		if (hasSearchIndex())
+			d->deleteSearchSql.arg(*i).exec();
 	}
 	
-	base->exec("delete from songs where " + songids);
-	base->exec("delete from tags where " + songids);
 	base->exec("release savepoint remove");
 }
 
@@ -259,13 +613,15 @@ public:
 	{
 		FileId songid;
 		QString url;
+		unsigned int length;
+		QByteArray sortKeys[3];
 		QString tags[numTags];
 		unsigned flags;
 	};
 	
 	static void toSongEntry(const std::vector<QString> &vals, SongEntry &e)
 	{
-		if (vals.size() != 3 + numTags)
+		if (vals.size() != 7 + numTags)
 		{
 			std::cerr << "Vals had " << vals.size() << " item"<< std::endl;
 			return;
@@ -274,9 +630,12 @@ public:
 		FileId id = vals[0].toLongLong();
 		e.songid = id;
 		e.url = vals[1];
-		e.flags = vals[2].toInt();
+		e.length = vals[2].toUInt();
+		e.flags = vals[3].toInt();
+		for (int i=0; i < 3; i++)
+			e.sortKeys[i] = QByteArray::fromHex(vals[4+i].toLatin1());
 		for (int i=0; i < numTags; i++)
-			e.tags[i] = vals[3+i];
+			e.tags[i] = vals[7+i];
 	}
 
 	static File toFile(const SongEntry &entry)
@@ -284,6 +643,9 @@ public:
 		File f;
 		f.id = entry.songid;
 		f.mFile = entry.url;
+		f.mLength = entry.length;
+		for (int i=0; i < 3; i++)
+			f.mSortKeys[i] = entry.sortKeys[i];
 		for (int tagi=0; tagi < numTags; ++tagi)
 			f.tags[tagi] = entry.tags[tagi];
 		if (entry.flags & 1)
@@ -293,49 +655,147 @@ public:
 };
 
 
+// runs the big select on its own connection in a thread, and
+// posts what it finds to the Collection in chunks. If the Snapshot
+// is still good, it's read instead and posted all at once, and
+// otherwise a new one is written
 class Meow::Collection::LoadAll
-	: public QObject, private Meow::Collection::BasicLoader
+	: public QThread, private Meow::Collection::BasicLoader
 {
 	struct AddEachFile
 	{
-		Collection *const collection;
-		const FileId exceptThisOne;
+		LoadAll *const loader;
+		QVector<File> chunk;
+		// for the snapshot
+		QVector<File> all;
 
-		AddEachFile(Collection *collection, FileId exceptThisOne)
-			: collection(collection), exceptThisOne(exceptThisOne)
-		{ }
+		AddEachFile(LoadAll *loader)
+			: loader(loader)
+		{
+			chunk.reserve(chunkSize);
+		}
 		void operator() (const std::vector<QString> &vals)
 		{
 			SongEntry e;
 			toSongEntry(vals, e);
-			if (exceptThisOne == e.songid)
+			const File f = toFile(e);
+			all.append(f);
+			if (loader->exceptThisOne == e.songid)
 				return;
-			File f = toFile(e);
-			emit collection->added(f);
-			qApp->processEvents();
+			chunk.append(f);
+			if (chunk.size() == chunkSize)
+				flush();
+		}
+		void flush()
+		{
+			if (chunk.isEmpty() || loader->aborted)
+				return;
+			QApplication::postEvent(
+					loader->collection,
+					new FilesLoadedEvent(loader->generation, chunk)
+				);
+			chunk.clear();
+			chunk.reserve(chunkSize);
 		}
 	};
+	
+	static const int chunkSize = 512;
 
-	AddEachFile loader;
-	Base::Statement selectAll;
+	Collection *const collection;
+	Base *const base;
+	const QString selectAll;
+	const FileId exceptThisOne;
+	const int generation;
+	
+	QMutex readerLock;
+	Base *reader;
+	volatile bool aborted;
 
 public:
-	LoadAll(Collection *collection, Base::Statement selectAll, FileId exceptThisOne)
-		: loader(collection, exceptThisOne), selectAll(selectAll)
+	LoadAll(
+			Collection *collection, Base *base,
+			const QString &selectAll, FileId exceptThisOne, int generation
+		)
+		: collection(collection), base(base), selectAll(selectAll),
+			exceptThisOne(exceptThisOne), generation(generation)
 	{
-		startTimer(5);
+		reader = 0;
+		aborted = false;
+	}
+	
+	/**
+	 * stop loading as soon as possible, and wait for the thread
+	 **/
+	void abort()
+	{
+		{
+			QMutexLocker l(&readerLock);
+			aborted = true;
+			if (reader)
+				reader->interrupt();
+		}
+		wait();
 	}
 	
 protected:
-	virtual void timerEvent(QTimerEvent *e)
+	virtual void run()
 	{
-		killTimer(e->timerId());
-		selectAll.exec(loader);
+		Base::Reader db(base);
+		if (!db.isValid())
+		{
+			QApplication::postEvent(collection, new LoadingDoneEvent(generation));
+			return;
+		}
+		{
+			QMutexLocker l(&readerLock);
+			if (aborted)
+				return;
+			reader = &*db;
+		}
+		
+		// the counter and the select see the database at the same moment
+		db->exec("begin");
+		const quint64 instance = db->execValue("select instance from change_counter").toLongLong();
+		const quint64 counter = db->execValue("select counter from change_counter").toLongLong();
+		const QString snapshot = Snapshot::pathFor(db->fileName());
+		
+		QVector<File> files;
+		if (Snapshot::read(snapshot, instance, counter, files))
+		{
+			db->exec("commit");
+			for (int i=0; i < files.size(); i++)
+			{
+				if (files[i].fileId() == exceptThisOne)
+				{
+					files.remove(i);
+					break;
+				}
+			}
+			if (!files.isEmpty())
+				QApplication::postEvent(collection, new FilesLoadedEvent(generation, files));
+		}
+		else
+		{
+			AddEachFile loader(this);
+			db->sql(selectAll).exec(loader);
+			loader.flush();
+			db->exec("commit");
+			if (!aborted)
+				Snapshot::write(snapshot, instance, counter, loader.all);
+		}
+		
+		{
+			QMutexLocker l(&readerLock);
+			reader = 0;
+		}
+		if (!aborted)
+			QApplication::postEvent(collection, new LoadingDoneEvent(generation));
 	}
 };
 
 void Meow::Collection::getFilesAndFirst(Meow::FileId id)
 {
+	d->pendingAdded.clear();
 	newDatabase();
 	if (id != 0)
 	{
@@ -343,13 +803,21 @@ void Meow::Collection::getFilesAndFirst(Meow::FileId id)
 		if (f)
 			emit added(f);
 	}
-	d->allLoader = new LoadAll(this, base->sql(d->bigSelectJoin), id);
+	stop();
+	d->allLoader = new LoadAll(
+			this, base, d->bigSelectJoin, id, ++d->loadGeneration
+		);
+	d->allLoader->start(QThread::LowPriority);
 }
 
 void Meow::Collection::stop()
 {
+	if (d->allLoader)
+		d->allLoader->abort();
 	delete d->allLoader;
 	d->allLoader=0;
+	// anything already posted by that loader is now stale
+	d->loadGeneration++;
 }
 
 
@@ -374,18 +842,171 @@ struct Meow::Collection::ReloadEachFile : public BasicLoader
 void Meow::Collection::setGroupByAlbum(const QString &album, bool yes)
 {
 	if (yes)
-		base->sql("insert or replace into albums (album, flags) values(?, 1)").arg(album).exec();
+		d->setAlbumFlagsSql.arg(album).exec();
 	else
-		base->sql("delete from albums where album=?").arg(album).exec();
+		d->deleteAlbumFlagsSql.arg(album).exec();
 
 	ReloadEachFile loader(this);
-	Base::Statement statement = base->sql(d->bigSelectJoin + " where tag_b.value=?");
-	statement.arg(album).exec(loader);
+	d->selectByAlbumSql.arg(album).exec(loader);
 }
 
 bool Meow::Collection::groupByAlbum(const QString &album)
 {
-	return 1 & base->sql("select flags from albums where album=?").arg(album).execValue().toInt();
+	return 1 & d->selectAlbumFlagsSql.arg(album).execValue().toInt();
+}
+
+namespace
+{
+struct KeepShuffleState
+{
+	Meow::Collection::ShuffleState state;
+	void operator() (const std::vector<QString> &vals)
+	{
+		// stored as signed, sqlite has no unsigned integers
+		state.seed = quint64(vals[0].toLongLong());
+		state.range = vals[1].toULongLong();
+		state.position = vals[2].toULongLong();
+	}
+};
+}
+
+Meow::Collection::ShuffleState Meow::Collection::shuffleState()
+{
+	KeepShuffleState k;
+	d->selectShuffleSql.exec(k);
+	return k.state;
+}
+
+void Meow::Collection::setShuffleState(const ShuffleState &state)
+{
+	d->setShuffleSql
+		.arg(static_cast<long long>(state.seed))
+		.arg(state.range)
+		.arg(state.position)
+		.exec();
+}
+
+// the keys and values of a scrobble are stored in one column, split by this
+static const QChar scrobbleSeparator(0x1f);
+
+void Meow::Collection::queueScrobble(const QStringList &keys)
+{
+	d->insertScrobbleSql.arg(keys.join(scrobbleSeparator)).exec();
+}
+
+namespace
+{
+struct CollectScrobbles
+{
+	QList<Meow::Collection::QueuedScrobble> scrobbles;
+	void operator() (const std::vector<QString> &vals)
+	{
+		Meow::Collection::QueuedScrobble s;
+		s.id = vals[0].toLongLong();
+		s.keys = vals[1].split(scrobbleSeparator);
+		scrobbles.append(s);
+	}
+};
+}
+
+QList<Meow::Collection::QueuedScrobble> Meow::Collection::queuedScrobbles(qint64 after, int count)
+{
+	CollectScrobbles c;
+	d->selectScrobblesSql.arg(static_cast<long long>(after)).arg(count).exec(c);
+	return c.scrobbles;
+}
+
+void Meow::Collection::dequeueScrobbles(qint64 firstId, qint64 lastId)
+{
+	d->deleteScrobblesSql
+		.arg(static_cast<long long>(firstId))
+		.arg(static_cast<long long>(lastId))
+		.exec();
+}
+
+// what ReplayGain 2.0 brings everything to
+static const double referenceLufs = -18.0;
+
+double Meow::Collection::Loudness::gain(bool album) const
+{
+	if (!measured)
+		return 0.0;
+	double g = referenceLufs - (album ? this->album : track);
+	const double peak = album ? albumPeak : trackPeak;
+	if (peak > 0)
+		g = qMin(g, -20.0*std::log10(peak));
+	return g;
+}
+
+namespace
+{
+struct KeepLoudness
+{
+	Meow::Collection::Loudness loudness;
+	void operator() (const std::vector<QString> &vals)
+	{
+		// a row of nulls if there's no such song
+		if (vals[0].isEmpty())
+			return;
+		Meow::Collection::Loudness &l = loudness;
+		l.measured = true;
+		l.track = vals[0].toDouble();
+		l.trackPeak = vals[1].toDouble();
+		l.energy = vals[2].toDouble();
+		l.blocks = vals[3].toLongLong();
+		
+		const qint64 albumBlocks = vals[5].toLongLong();
+		if (albumBlocks > 0)
+		{
+			l.album = -0.691 + 10.0*std::log10(vals[4].toDouble()/albumBlocks);
+			l.albumPeak = vals[6].toDouble();
+		}
+		else
+		{
+			l.album = l.track;
+			l.albumPeak = l.trackPeak;
+		}
+	}
+};
+
+struct CollectUnmeasured
+{
+	QList<QPair<Meow::FileId, QString> > songs;
+	void operator() (const std::vector<QString> &vals)
+	{
+		songs.append(qMakePair(Meow::FileId(vals[0].toULongLong()), vals[1]));
+	}
+};
+}
+
+Meow::Collection::Loudness Meow::Collection::loudness(FileId id)
+{
+	KeepLoudness k;
+	d->selectLoudnessSql.arg(id).exec(k);
+	return k.loudness;
+}
+
+void Meow::Collection::setLoudness(FileId id, const Loudness &loudness)
+{
+	if (!loudness.measured)
+	{
+		d->setUnmeasurableSql.arg(id).exec();
+		return;
+	}
+	d->setLoudnessSql
+		.arg(id)
+		.arg(loudness.track)
+		.arg(loudness.trackPeak)
+		.arg(loudness.energy)
+		.arg(static_cast<long long>(loudness.blocks))
+		.exec();
+}
+
+QList<QPair<Meow::FileId, QString> > Meow::Collection::unmeasured(FileId after, int count)
+{
+	CollectUnmeasured c;
+	d->selectUnmeasuredSql.arg(after).arg(count).exec(c);
+	return c.songs;
 }
 
 void Meow::Collection::startJob()
@@ -397,6 +1018,47 @@ void Meow::Collection::scheduleFinishJob()
 	QApplication::postEvent(addThread, new FinishJobEvent());
 }
 
+Meow::Collection::Timings Meow::Collection::timings() const
+{
+	Timings t;
+	t.files = d->timedFiles;
+	t.taglib = addThread->taglibTime;
+	t.keys = d->keysTime;
+	t.sql = d->sqlTime;
+	return t;
+}
+
+bool Meow::Collection::hasSearchIndex() const
+{
+	return Base::hasFullTextSearch();
+}
+
+void Meow::Collection::search(const QString &text)
+{
+	const int generation = ++searchThread->latest;
+	QApplication::postEvent(searchThread, new SearchEvent(text, generation));
+}
+
+QStringList Meow::Collection::searchTerms(const QString &text)
+{
+	// roughly what fts5's unicode61 tokenizer does
+	QStringList terms;
+	const QString folded = text.toCaseFolded();
+	int start=-1;
+	for (int i=0; i <= folded.length(); i++)
+	{
+		const bool inWord = i < folded.length() && folded[i].isLetterOrNumber();
+		if (inWord && start == -1)
+			start = i;
+		else if (!inWord && start != -1)
+		{
+			terms += folded.mid(start, i-start);
+			start = -1;
+		}
+	}
+	return terms;
+}
+
 struct Meow::Collection::OneFile : public BasicLoader
 {
 	Collection *const collection;
@@ -440,7 +1102,33 @@ bool Meow::Collection::event(QEvent *e)
 		fff = static_cast<FileReloadedEvent*>(e)->file;
 	else if (e->type() == DoneWithJobEvent::type)
 	{
+		QElapsedTimer timer;
+		timer.start();
 		base->exec("release savepoint job");
+		d->sqlTime += timer.nsecsElapsed();
+		flushAdded();
+		emit jobFinished();
+		return true;
+	}
+	else if (e->type() == FilesLoadedEvent::type)
+	{
+		FilesLoadedEvent *const fle = static_cast<FilesLoadedEvent*>(e);
+		if (fle->generation == d->loadGeneration)
+			emit addedBatch(fle->files);
+		return true;
+	}
+	else if (e->type() == SearchResultsEvent::type)
+	{
+		SearchResultsEvent *const sre = static_cast<SearchResultsEvent*>(e);
+		if (sre->generation == searchThread->latest)
+			emit searchFinished(sre->text, sre->files);
+		return true;
+	}
+	else if (e->type() == LoadingDoneEvent::type)
+	{
+		LoadingDoneEvent *const lde = static_cast<LoadingDoneEvent*>(e);
+		if (lde->generation == d->loadGeneration)
+			emit loaded();
 		return true;
 	}
 	else
@@ -458,10 +1146,17 @@ bool Meow::Collection::event(QEvent *e)
 	};
 
 	const TagLib::FileRef *f=0;
+	uint mtime=0;
 	if (e->type() == FileAddedEvent::type)
+	{
 		f = static_cast<FileAddedEvent*>(e)->f;
+		mtime = static_cast<FileAddedEvent*>(e)->mtime;
+	}
 	else if (e->type() == FileReloadedEvent::type)
+	{
 		f = static_cast<FileReloadedEvent*>(e)->f;
+		mtime = static_cast<FileReloadedEvent*>(e)->mtime;
+	}
 	else
 	{
 		std::cerr << "Impossible." << std::endl;
@@ -470,44 +1165,105 @@ bool Meow::Collection::event(QEvent *e)
 
 	const TagLib::Tag *const tag = f->tag();
 	
+	// TagLib already read the headers when it opened the file
+	fff.mLength = 0;
+	if (const TagLib::AudioProperties *const props = f->audioProperties())
+	{
+#if TAGLIB_MAJOR_VERSION > 1 || TAGLIB_MINOR_VERSION >= 10
+		fff.mLength = props->lengthInMilliseconds();
+#else
+		fff.mLength = props->length()*1000;
+#endif
+	}
+	
+	QElapsedTimer timer;
+	timer.start();
+	
+	// the tags and their sort keys come first, so that sqlTime
+	// is only the statements
+	for (int i=0; propertyMap[i].sql; i++)
+	{
+		fff.tags[propertyMap[i].tagIndex] = QString::fromUtf8(
+				(tag->*propertyMap[i].fn)().toCString(true)
+			);
+	}
+	if (tag->track() > 0)
+		fff.tags[3] = QString::number(tag->track());
+	
+	fff.mSortKeys[0] = sortKey(fff.artist());
+	fff.mSortKeys[1] = sortKey(fff.album());
+	fff.mSortKeys[2] = sortKey(fff.label());
+	
+	d->keysTime += timer.nsecsElapsed();
+	timer.restart();
+	
 	FileId last;
 	
 	if (e->type() == FileReloadedEvent::type)
 	{
 		last = fff.fileId();
-		d->updateUrlSql.arg(fff.mFile).arg(fff.fileId()).exec();
+		d->updateUrlSql.arg(fff.mFile).arg(int(fff.mLength)).arg(fff.fileId()).exec();
 		d->deleteTagsSql.arg(fff.fileId()).exec();
+		// it's changed, so it's measured again
+		d->deleteLoudnessSql.arg(fff.fileId()).exec();
 	}
 	else
 	{
-		last = d->insertSql.arg(fff.mFile).exec();
+		last = d->insertSql.arg(int(fff.mLength)).arg(fff.mFile).exec();
 		fff.id = last;
 	}
 	
 	for (int i=0; propertyMap[i].sql; i++)
 	{
-		QString x = QString::fromUtf8(
-				(tag->*propertyMap[i].fn)().toCString(true)
-			);
-		d->insertTagsSql.arg(last).arg(propertyMap[i].sql).arg(x).exec();
-		if (propertyMap[i].tagIndex != -1)
-			fff.tags[propertyMap[i].tagIndex] = x;
+		d->insertTagsSql.arg(last).arg(propertyMap[i].sql)
+			.arg(fff.tags[propertyMap[i].tagIndex]).exec();
 	}
 	
 	if (tag->track() > 0)
-	{
 		d->insertTagsSql.arg(last).arg("track").arg(int(tag->track())).exec();
-		fff.tags[3] = QString::number(tag->track());
+	
+	d->setSortKeysSql.arg(last)
+		.argBlob(fff.mSortKeys[0]).argBlob(fff.mSortKeys[1]).argBlob(fff.mSortKeys[2])
+		.exec();
+	
+	d->setFileTimeSql.arg(last).arg(static_cast<long long>(mtime)).exec();
+	
+	if (hasSearchIndex())
+	{
+		d->deleteSearchSql.arg(last).exec();
+		d->insertSearchSql.arg(last).arg(fff.tags[0]).arg(fff.tags[1]).arg(fff.tags[2]).exec();
 	}
+	
+	d->sqlTime += timer.nsecsElapsed();
+	d->timedFiles++;
 
 	if (e->type() == FileReloadedEvent::type)
+	{
+		flushAdded();
 		emit reloaded(fff);
+	}
 	else if (toPlay)
+	{
+		flushAdded();
 		emit addedToPlay(fff);
+	}
 	else
-		emit added(fff);
+	{ // so that the tree is laid out once for many files
+		if (d->pendingAdded.isEmpty())
+			QTimer::singleShot(100, this, SLOT(flushAdded()));
+		d->pendingAdded.append(fff);
+	}
 	return true;
 }
 
+void Meow::Collection::flushAdded()
+{
+	if (d->pendingAdded.isEmpty())
+		return;
+	const QVector<File> files = d->pendingAdded;
+	d->pendingAdded.clear();
+	emit addedBatch(files);
+}
+
 
 // kate: space-indent off; replace-tabs off;
@@ -3,6 +3,10 @@
 
 #include <qobject.h>
 #include <qthread.h>
+#include <qvector.h>
+#include <qstringlist.h>
+#include <qhash.h>
+#include <qpair.h>
 
 #include <vector>
 
@@ -28,20 +32,52 @@ class Collection : public QObject
 	class ReloadEachFile;
 	class OneFile;
 	class AddThread;
+	class SearchThread;
 	
 	AddThread *addThread;
+	SearchThread *searchThread;
 	
 public:
 	Collection(Base *base);
 	~Collection();
 
 	void add(const QString &file, bool playNow);
+	/**
+	 * add each of @p files, with one event to the thread that
+	 * reads their tags instead of one per file
+	 **/
+	void add(const QStringList &files);
 	void reload(const File &file);
+	/**
+	 * reload each of @p files that's already in the collection,
+	 * and add the ones that aren't
+	 **/
+	void update(const QStringList &files);
 	
 	void remove(const std::vector<FileId> &files);
+	/**
+	 * remove the songs at each of @p urls, or in them if they're
+	 * folders, and emit @ref removed with them
+	 **/
+	void removeUrls(const QStringList &urls);
 	
 	/**
-	 * emit @ref added for all files in the database
+	 * the modification time each song in @p folder had when its tags
+	 * were last read, by url, or 0 if that isn't known. Unlike
+	 * everything else here, this can be called from any thread
+	 **/
+	QHash<QString, uint> modificationTimes(const QString &folder) const;
+	
+	/**
+	 * the folders that Watcher keeps this collection in sync with
+	 **/
+	QStringList watchedFolders();
+	void setWatched(const QString &folder, bool yes);
+	
+	/**
+	 * emit @ref added for @p id right away, and then @ref addedBatch
+	 * for all the other files in the database as they are loaded
+	 * by a background thread
 	 **/
 	void getFilesAndFirst(FileId id);
 	
@@ -57,13 +93,161 @@ public:
 	bool groupByAlbum(const QString &album);
 
 	void startJob();
+	/**
+	 * @ref jobFinished is emitted once every file given to
+	 * @ref add before this is in the collection
+	 **/
 	void scheduleFinishJob();
 	
+	/**
+	 * true if @ref search can be used, otherwise you have to
+	 * look at the strings yourself
+	 **/
+	bool hasSearchIndex() const;
+	
+	/**
+	 * look for songs that have every word in @p text as the prefix
+	 * of a word in its artist, album or title. The search happens in
+	 * another thread, @ref searchFinished is emitted with the results.
+	 *
+	 * Only the most recent search is reported
+	 **/
+	void search(const QString &text);
+	
+	/**
+	 * splits @p text into the words that @ref search looks for,
+	 * case folded
+	 **/
+	static QStringList searchTerms(const QString &text);
+	
+	/**
+	 * where the shuffle bag is in its cycle, kept in the database
+	 * so that it carries on after a restart
+	 **/
+	struct ShuffleState
+	{
+		ShuffleState() : seed(0), range(0), position(0) { }
+		quint64 seed;
+		quint64 range;
+		quint64 position;
+	};
+	/**
+	 * the state last given to @ref setShuffleState, or one with
+	 * a range of 0 if there isn't one
+	 **/
+	ShuffleState shuffleState();
+	void setShuffleState(const ShuffleState &state);
+	
+	/**
+	 * a play that Scrobble hasn't had acknowledged yet, as the
+	 * alternating keys and values it submits
+	 **/
+	struct QueuedScrobble
+	{
+		qint64 id;
+		QStringList keys;
+	};
+	/**
+	 * append a play to the scrobble queue, right away so that
+	 * it isn't lost if Meow isn't shut down properly
+	 **/
+	void queueScrobble(const QStringList &keys);
+	/**
+	 * the oldest @p count plays in the queue after the one with
+	 * the id @p after, in the order they were queued
+	 **/
+	QList<QueuedScrobble> queuedScrobbles(qint64 after, int count);
+	/**
+	 * take the plays from @p firstId to @p lastId out of the queue
+	 **/
+	void dequeueScrobbles(qint64 firstId, qint64 lastId);
+	
+	/**
+	 * how loud a song is, as LoudnessScanner measured it
+	 **/
+	struct Loudness
+	{
+		Loudness()
+			: measured(false), track(0), trackPeak(0),
+				album(0), albumPeak(0), energy(0), blocks(0)
+		{ }
+		// false if it hasn't been measured yet, or couldn't be
+		bool measured;
+		// the integrated loudness in LUFS, and the true peak where 1
+		// is full scale, of the song and of its whole album
+		double track, trackPeak;
+		double album, albumPeak;
+		// the song's gated blocks, which the album is worked out from
+		double energy;
+		qint64 blocks;
+		
+		/**
+		 * the gain in dB that brings the song, or its album, to
+		 * the -18 LUFS of ReplayGain 2.0, but no further than its
+		 * peak allows. 0 if it isn't measured
+		 **/
+		double gain(bool album) const;
+	};
+	Loudness loudness(FileId id);
+	/**
+	 * keep the track, trackPeak, energy and blocks of @p loudness
+	 * for @p id. If it's not measured, that's kept too, so
+	 * that it isn't tried again
+	 **/
+	void setLoudness(FileId id, const Loudness &loudness);
+	/**
+	 * up to @p count songs, with an id greater than @p after, that
+	 * haven't been measured, in order of id
+	 **/
+	QList<QPair<FileId, QString> > unmeasured(FileId after, int count);
+	
+	/**
+	 * how long adding and reloading files has taken so far,
+	 * in nanoseconds
+	 **/
+	struct Timings
+	{
+		Timings() : files(0), taglib(0), keys(0), sql(0) { }
+		// how many files were put in the database
+		qint64 files;
+		// reading the tags, in the add thread, of those
+		// and of the ones TagLib couldn't read
+		qint64 taglib;
+		// converting their tags and making their sort keys
+		qint64 keys;
+		// putting them in the database, and committing
+		// each job
+		qint64 sql;
+	};
+	Timings timings() const;
+	
 
 signals:
 	void added(const File &file);
+	/**
+	 * a chunk of files loaded from the database by
+	 * @ref getFilesAndFirst, or newly added ones
+	 **/
+	void addedBatch(const QVector<File> &files);
+	/**
+	 * the last @ref addedBatch from @ref getFilesAndFirst has
+	 * been emitted
+	 **/
+	void loaded();
 	void addedToPlay(const File &file);
+	/**
+	 * these songs are gone from the collection because of
+	 * @ref removeUrls
+	 **/
+	void removed(const QVector<FileId> &files);
 	void reloaded(const File &file);
+	/**
+	 * the job that @ref scheduleFinishJob was called for is done,
+	 * the last of its files have been in an @ref addedBatch
+	 **/
+	void jobFinished();
+	
+	void searchFinished(const QString &text, const QVector<FileId> &files);
 
 	/**
 	 * emitted when something of the slices gets modified
@@ -74,6 +258,9 @@ signals:
 private:
 	void newDatabase();
 
+private slots:
+	void flushAdded();
+
 protected:
 	virtual bool event(QEvent *e);
 };
@@ -1,3 +1,82 @@
+#include "file.h"
+
+#include <qchar.h>
+
+#include <string.h>
+#include <locale.h>
+#include <limits.h>
+
+
+QString Meow::File::label() const
+{
+	const QString track = this->track();
+	if (track.isEmpty())
+		return title();
+	return track + ". " + title();
+}
+
+static void pad(QString &str)
+{
+	int len=str.length();
+	int at = 0;
+	int blocklen=0;
+
+	static const int paddingsize=12;
+
+	// not static for reason
+	const QChar chars[paddingsize] =
+	{
+		QChar('0'), QChar('0'), QChar('0'), QChar('0'),
+		QChar('0'), QChar('0'), QChar('0'), QChar('0'),
+		QChar('0'), QChar('0'), QChar('0'), QChar('0')
+	};
+
+	for (int i=0; i < len; i++)
+	{
+		if (str[i].isNumber())
+		{
+			if (!blocklen)
+				at = i;
+			blocklen++;
+		}
+		else if (blocklen)
+		{
+			int pads=paddingsize;
+			pads -= blocklen;
+			str.insert(at, chars, pads);
+			i += pads;
+			blocklen = 0;
+		}
+	}
+	if (blocklen)
+	{
+		int pads=paddingsize;
+		pads -= blocklen;
+		str.insert(at, chars, pads);
+	}
+}
+
+QByteArray Meow::sortKey(const QString &label)
+{
+	QString s = label.toCaseFolded().simplified();
+	pad(s);
+	const QByteArray bytes = s.toUtf8();
+	
+	const size_t len = strxfrm(0, bytes.constData(), 0);
+	if (len >= INT_MAX/2)
+		return bytes; // the locale couldn't do it
+	
+	QByteArray key(int(len)+1, '\0');
+	strxfrm(key.data(), bytes.constData(), len+1);
+	key.resize(int(len));
+	return key;
+}
+
+QString Meow::sortKeyCollation()
+{
+	const char *const locale = setlocale(LC_COLLATE, 0);
+	return "1 " + QString::fromLatin1(locale ? locale : "C");
+}
 
 
 // kate: space-indent off; replace-tabs off;
@@ -2,28 +2,34 @@
 #define MEOW_FILE_H
 
 #include <qstring.h>
+#include <qbytearray.h>
 #include <stdint.h>
 
 
 namespace Meow
 {
 class Collection;
+class Snapshot;
 typedef unsigned long long FileId;
 
 class File
 {
 	friend class Collection;
+	friend class Snapshot;
 	FileId id;
 	
 	
 	QString mFile;
 	// refer to Meow::Collection::LoadAll
 	QString tags[4];
+	// sortKey of the artist, album and label
+	QByteArray mSortKeys[3];
 
+	unsigned int mLength;
 	bool mDisplayByAlbum;
 	
 public:
-	File() { id = 0; mDisplayByAlbum=false; }
+	File() { id = 0; mLength=0; mDisplayByAlbum=false; }
 	FileId fileId() const { return id; }
 	operator bool() const { return !!fileId(); }
 	bool operator==(const File &other) const { return id == other.id; }
@@ -35,10 +41,43 @@ public:
 	QString album() const { return tags[1]; }
 	QString title() const { return tags[2]; }
 	QString track() const { return tags[3]; }
+	
+	/**
+	 * the title, after the track number if there is one,
+	 * the way it's shown in the tree
+	 **/
+	QString label() const;
+	
+	/**
+	 * the @ref sortKey of artist(), album() and label(), or empty
+	 * if they weren't in the database
+	 **/
+	QByteArray artistKey() const { return mSortKeys[0]; }
+	QByteArray albumKey() const { return mSortKeys[1]; }
+	QByteArray labelKey() const { return mSortKeys[2]; }
+	
+	/**
+	 * the track-length in milliseconds, as read from the file's
+	 * headers when it was added, or 0 if it isn't known
+	 **/
+	unsigned int length() const { return mLength; }
 
 	bool displayByAlbum() const { return mDisplayByAlbum; }
 };
 
+/**
+ * A key that puts labels in order with memcmp: case and spacing are
+ * ignored, numbers are compared by value and everything else
+ * follows the collation of the current locale
+ **/
+QByteArray sortKey(const QString &label);
+
+/**
+ * identifies how @ref sortKey makes its keys, so that the stored
+ * ones can be thrown away when it changes
+ **/
+QString sortKeyCollation();
+
 
 }
 
@@ -0,0 +1,273 @@
+#include "snapshot.h"
+
+#include <qfile.h>
+#include <qhash.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include <string.h>
+
+namespace
+{
+
+const char magic[8] = { 'M', 'e', 'o', 'w', 'S', 'n', 'a', 'p' };
+const quint32 currentVersion = 1;
+
+struct Header
+{
+	char magic[8];
+	quint32 version;
+	quint32 numSongs;
+	quint64 instance;
+	quint64 counter;
+	// the blobs come right after the records
+	quint64 blobsSize;
+};
+
+// the strings and keys of a song are offsets of blobs, each one
+// a quint32 of its length and then the bytes, padded to 4
+enum { Url=0, Artist, Album, Title, Track, ArtistKey, AlbumKey, LabelKey, NumBlobs };
+
+struct Record
+{
+	quint64 id;
+	quint32 length;
+	quint32 flags; // 1 is displayByAlbum
+	quint32 blobs[NumBlobs];
+};
+
+// the same string is only written once
+class BlobWriter
+{
+	QHash<QByteArray, quint32> mWritten;
+public:
+	QByteArray data;
+
+	quint32 add(const QByteArray &bytes)
+	{
+		QHash<QByteArray, quint32>::const_iterator i = mWritten.constFind(bytes);
+		if (i != mWritten.constEnd())
+			return *i;
+
+		const quint32 at = data.size();
+		const quint32 length = bytes.size();
+		data.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		data.append(bytes);
+		while (data.size() % 4)
+			data.append('\0');
+		mWritten.insert(bytes, at);
+		return at;
+	}
+};
+
+// and only made into a QString once when read, so they're shared
+class BlobReader
+{
+	const char *const mData;
+	const quint64 mSize;
+	QHash<quint32, QString> mStrings;
+	QHash<quint32, QByteArray> mBytes;
+public:
+	bool ok;
+
+	BlobReader(const char *data, quint64 size)
+		: mData(data), mSize(size), ok(true)
+	{ }
+
+	QByteArray bytes(quint32 at)
+	{
+		QHash<quint32, QByteArray>::const_iterator i = mBytes.constFind(at);
+		if (i != mBytes.constEnd())
+			return *i;
+
+		quint32 length;
+		if (quint64(at) + sizeof(length) > mSize)
+		{
+			ok = false;
+			return QByteArray();
+		}
+		memcpy(&length, mData+at, sizeof(length));
+		if (quint64(at) + sizeof(length) + length > mSize)
+		{
+			ok = false;
+			return QByteArray();
+		}
+		const QByteArray b(mData+at+sizeof(length), length);
+		mBytes.insert(at, b);
+		return b;
+	}
+
+	QString string(quint32 at)
+	{
+		QHash<quint32, QString>::const_iterator i = mStrings.constFind(at);
+		if (i != mStrings.constEnd())
+			return *i;
+		const QString s = QString::fromUtf8(bytes(at));
+		mStrings.insert(at, s);
+		return s;
+	}
+};
+
+// memcmp order, like the tree
+inline int compareKeys(const QByteArray &a, const QByteArray &b)
+{
+	const int c = memcmp(a.constData(), b.constData(), qMin(a.size(), b.size()));
+	if (c)
+		return c;
+	return a.size() - b.size();
+}
+
+// the order the tree shows them in, so that it can
+// append each one when they're read back
+struct TreeOrder
+{
+	bool operator()(const Meow::File &a, const Meow::File &b) const
+	{
+		int c = compareKeys(
+				a.displayByAlbum() ? a.albumKey() : a.artistKey(),
+				b.displayByAlbum() ? b.albumKey() : b.artistKey()
+			);
+		if (c == 0)
+			c = compareKeys(a.albumKey(), b.albumKey());
+		if (c == 0)
+			c = compareKeys(a.labelKey(), b.labelKey());
+		return c < 0;
+	}
+};
+
+}
+
+
+QString Meow::Snapshot::pathFor(const QString &database)
+{
+	return database + ".snapshot";
+}
+
+bool Meow::Snapshot::write(
+		const QString &path, quint64 instance, quint64 counter,
+		QVector<File> files
+	)
+{
+	std::sort(files.begin(), files.end(), TreeOrder());
+
+	BlobWriter blobs;
+	QVector<Record> records(files.size());
+	for (int i=0; i < files.size(); i++)
+	{
+		const File &f = files[i];
+		Record &r = records[i];
+		memset(&r, 0, sizeof(r));
+		r.id = f.fileId();
+		r.length = f.length();
+		r.flags = f.displayByAlbum() ? 1 : 0;
+		r.blobs[Url] = blobs.add(f.file().toUtf8());
+		r.blobs[Artist] = blobs.add(f.artist().toUtf8());
+		r.blobs[Album] = blobs.add(f.album().toUtf8());
+		r.blobs[Title] = blobs.add(f.title().toUtf8());
+		r.blobs[Track] = blobs.add(f.track().toUtf8());
+		r.blobs[ArtistKey] = blobs.add(f.artistKey());
+		r.blobs[AlbumKey] = blobs.add(f.albumKey());
+		r.blobs[LabelKey] = blobs.add(f.labelKey());
+	}
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, magic, sizeof(magic));
+	header.version = currentVersion;
+	header.numSongs = records.size();
+	header.instance = instance;
+	header.counter = counter;
+	header.blobsSize = blobs.data.size();
+
+	// written to the side and moved over, so that a reader never
+	// sees half of one
+	const QString temp = path + ".new";
+	QFile out(temp);
+	if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		std::cerr << "Can't write " << temp.toLocal8Bit().data() << std::endl;
+		return false;
+	}
+	const qint64 recordBytes = qint64(records.size())*sizeof(Record);
+	const bool ok
+		= out.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header)
+		&& out.write(reinterpret_cast<const char*>(records.constData()), recordBytes) == recordBytes
+		&& out.write(blobs.data) == blobs.data.size();
+	out.close();
+
+	if (!ok)
+	{
+		QFile::remove(temp);
+		return false;
+	}
+	QFile::remove(path);
+	return QFile::rename(temp, path);
+}
+
+bool Meow::Snapshot::read(
+		const QString &path, quint64 instance, quint64 counter,
+		QVector<File> &files
+	)
+{
+	QFile in(path);
+	if (!in.open(QIODevice::ReadOnly))
+		return false;
+	const qint64 size = in.size();
+	if (size < qint64(sizeof(Header)))
+		return false;
+
+	uchar *const map = in.map(0, size);
+	if (!map)
+		return false;
+
+	Header header;
+	memcpy(&header, map, sizeof(header));
+	const quint64 recordBytes = quint64(header.numSongs)*sizeof(Record);
+	if (
+			memcmp(header.magic, magic, sizeof(magic)) != 0
+			|| header.version != currentVersion
+			|| header.instance != instance
+			|| header.counter != counter
+			|| sizeof(Header) + recordBytes + header.blobsSize != quint64(size)
+		)
+	{
+		in.unmap(map);
+		return false;
+	}
+
+	const Record *const records = reinterpret_cast<const Record*>(map + sizeof(Header));
+	BlobReader blobs(
+			reinterpret_cast<const char*>(map + sizeof(Header) + recordBytes),
+			header.blobsSize
+		);
+
+	files.resize(header.numSongs);
+	for (quint32 i=0; i < header.numSongs && blobs.ok; i++)
+	{
+		const Record &r = records[i];
+		File &f = files[i];
+		f.id = r.id;
+		f.mLength = r.length;
+		f.mDisplayByAlbum = r.flags & 1;
+		f.mFile = blobs.string(r.blobs[Url]);
+		f.tags[0] = blobs.string(r.blobs[Artist]);
+		f.tags[1] = blobs.string(r.blobs[Album]);
+		f.tags[2] = blobs.string(r.blobs[Title]);
+		f.tags[3] = blobs.string(r.blobs[Track]);
+		f.mSortKeys[0] = blobs.bytes(r.blobs[ArtistKey]);
+		f.mSortKeys[1] = blobs.bytes(r.blobs[AlbumKey]);
+		f.mSortKeys[2] = blobs.bytes(r.blobs[LabelKey]);
+	}
+	in.unmap(map);
+
+	if (!blobs.ok)
+	{
+		std::cerr << "Ignoring damaged " << path.toLocal8Bit().data() << std::endl;
+		files.clear();
+		return false;
+	}
+	return true;
+}
+
+// kate: space-indent off; replace-tabs off;
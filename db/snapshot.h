@@ -0,0 +1,51 @@
+#ifndef MEOW_SNAPSHOT_H
+#define MEOW_SNAPSHOT_H
+
+#include <qstring.h>
+#include <qvector.h>
+
+#include <db/file.h>
+
+namespace Meow
+{
+
+/**
+ * A copy of every File in a collection, in the order the tree shows
+ * them, kept in a file next to the database so that the next start
+ * can show the tree without running the big select.
+ *
+ * A snapshot is tagged with the database's instance and change
+ * counter (the change_counter table) when it's written, and it is
+ * only good while they're the same.
+ **/
+class Snapshot
+{
+public:
+	/**
+	 * where the snapshot for the database at @p database goes
+	 **/
+	static QString pathFor(const QString &database);
+
+	/**
+	 * replace the snapshot at @p path with @p files
+	 **/
+	static bool write(
+			const QString &path, quint64 instance, quint64 counter,
+			QVector<File> files
+		);
+
+	/**
+	 * load the files from @p path into @p files, if it was written
+	 * with @p instance and @p counter and isn't damaged
+	 **/
+	static bool read(
+			const QString &path, quint64 instance, quint64 counter,
+			QVector<File> &files
+		);
+};
+
+}
+
+#endif
+
+// kate: space-indent off; replace-tabs off;
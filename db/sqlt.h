@@ -4,20 +4,50 @@
 #include "base.h"
 
 #include <qfile.h>
+#include <qmutex.h>
+#include <qlist.h>
+#include <qhash.h>
 
 #include <vector>
+#include <list>
 #include <iostream>
 
 
 struct Meow::Base::BasePrivate
 {
+	BasePrivate()
+		: db(0), readOnly(false), writeLock(QMutex::Recursive)
+	{ }
 	sqlite3 *db;
+	QString fileName;
+	Tuning tuning;
+	bool readOnly;
+	
+	// there is only one writing connection, serialize
+	// the threads that use it
+	QMutex writeLock;
+	
+	QMutex poolLock;
+	QList<Base*> idleReaders;
+	
+	// the statements made by Base::sql, with the least
+	// recently used at the end of statementAge
+	struct CachedStatement
+	{
+		Statement statement;
+		std::list<QString>::iterator age;
+	};
+	QHash<QString, CachedStatement> statementCache;
+	std::list<QString> statementAge;
+	QMutex cacheLock;
+	StatementCacheStats cacheStats;
 };
 
 template<class T>
 inline int64_t Meow::Base::Statement::exec(T &function)
 {
 	sqlite3_stmt *const stmt = shared->statement;
+	QMutexLocker locker(shared->lock);
 //	std::cerr << "Q: " << sqlite3_sql(stmt) << std::endl;
 	int x;
 	while (1)
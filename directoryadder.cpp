@@ -1,7 +1,53 @@
 #include "directoryadder.h"
 
-#include <qtimer.h>
 #include <qfileinfo.h>
+#include <qfile.h>
+
+#include <string.h>
+
+// what the decoders can play, by the end of the name
+static const char *const audioSuffixes[] =
+{
+	"mp3", "mp2", "mpga", "ogg", "oga", "opus", "spx",
+	"flac", "mpc", "mpp", "mp+", "wav", 0
+};
+
+static bool hasAudioSuffix(const QString &suffix)
+{
+	for (const char *const *s = audioSuffixes; *s; s++)
+		if (suffix.compare(QLatin1String(*s), Qt::CaseInsensitive) == 0)
+			return true;
+	return false;
+}
+
+// for files without a suffix, the same headers aKode looks for
+static bool hasAudioMagic(const QString &path)
+{
+	QFile f(path);
+	if (!f.open(QIODevice::ReadOnly))
+		return false;
+	unsigned char h[12];
+	if (f.read(reinterpret_cast<char*>(h), sizeof(h)) != sizeof(h))
+		return false;
+
+	if (memcmp(h, "ID3", 3) == 0 || memcmp(h, "OggS", 4) == 0
+		|| memcmp(h, "fLaC", 4) == 0 || memcmp(h, "MP+", 3) == 0
+		|| memcmp(h, "MPCK", 4) == 0)
+		return true;
+	if (memcmp(h, "RIFF", 4) == 0 && memcmp(h+8, "WAVE", 4) == 0)
+		return true;
+	// an mpeg frame
+	return h[0] == 0xff && (h[1] & 0xe0) == 0xe0
+		&& (h[1] & 0x18) != 0x08 && (h[1] & 0x06) != 0x00;
+}
+
+bool Meow::DirectoryAdder::isAudioFile(const QString &path)
+{
+	const QString suffix = QFileInfo(path).suffix();
+	if (suffix.isEmpty())
+		return hasAudioMagic(path);
+	return hasAudioSuffix(suffix);
+}
 
 #ifdef MEOW_WITH_KDE
 #include <kfileitem.h>
@@ -62,7 +108,12 @@ void Meow::DirectoryAdder::slotEntries(KIO::Job *, const KIO::UDSEntryList &entr
 	for (KIO::UDSEntryList::ConstIterator it = entries.begin(); it != entries.end(); ++it)
 	{
 		KFileItem file(*it, currentJobUrl, false /* no mimetype detection */, true);
-		emit addFile(file.url());
+		if (file.isDir())
+			continue;
+		// the ones without a suffix could be anything, TagLib can tell
+		const QString suffix = QFileInfo(file.name()).suffix();
+		if (suffix.isEmpty() || hasAudioSuffix(suffix))
+			emit addFile(file.url());
 	}
 
 }
@@ -74,9 +125,186 @@ void Meow::DirectoryAdder::slotRedirection(KIO::Job *, const KUrl & url)
 
 #else
 
+#include <qapplication.h>
+#include <qthread.h>
+#include <qmutex.h>
+#include <qwaitcondition.h>
+#include <qevent.h>
+#include <qdir.h>
+#include <qset.h>
+#include <qpair.h>
+#include <qdatetime.h>
+
+namespace
+{
+
+class FoundEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+12);
+	FoundEvent(const QStringList &files, int directories)
+		: QEvent(type), files(files), directories(directories)
+	{}
+
+	const QStringList files;
+	const int directories;
+};
+
+class WalkDoneEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+13);
+	WalkDoneEvent()
+		: QEvent(type)
+	{}
+};
+
+// found files are posted in batches of this many, or
+// after this long, whichever comes first
+const int batchSize = 256;
+const int batchMsecs = 250;
+}
+
+/**
+ * A directory tree being listed by a few Listers at once.
+ * Each directory is listed by one of them, and the ones found
+ * in it are put back in the queue for whichever one is free
+ **/
+struct Meow::DirectoryAdder::Walk
+{
+	QObject *adder;
+
+	QMutex lock;
+	QWaitCondition changed;
+
+	// the directories waiting to be listed: the path they were
+	// found at, and the path they really are, which goes in
+	// visited so that a symlink back up the tree is only followed once
+	QList<QPair<QString, QString> > queue;
+	QSet<QString> visited;
+
+	// how many Listers are in the middle of a directory, which
+	// may yet add more to the queue
+	int listing;
+	// how many haven't finished, the last one posts WalkDoneEvent
+	int running;
+	bool stopping;
+
+	QList<Lister*> listers;
+};
+
+class Meow::DirectoryAdder::Lister : public QThread
+{
+	Walk *const w;
+
+	QStringList found;
+	int directories;
+	QTime sincePosted;
+
+	void post()
+	{
+		QApplication::postEvent(w->adder, new FoundEvent(found, directories));
+		found.clear();
+		directories = 0;
+		sincePosted.start();
+	}
+
+	void list(const QPair<QString, QString> &dir, QList<QPair<QString, QString> > &subdirs)
+	{
+		const QFileInfoList entries = QDir(dir.first).entryInfoList(
+				QDir::AllEntries | QDir::NoDotAndDotDot, QDir::NoSort
+			);
+		for (QFileInfoList::const_iterator i = entries.begin(); i != entries.end(); ++i)
+		{
+			if (i->isDir())
+			{
+				// only a symlink can be somewhere other than where it looks
+				const QString real = i->isSymLink()
+					? i->canonicalFilePath()
+					: dir.second + '/' + i->fileName();
+				if (!real.isEmpty())
+					subdirs.append(qMakePair(i->filePath(), real));
+			}
+			else if (i->isFile() && isAudioFile(i->filePath()))
+				found.append(i->filePath());
+		}
+		directories++;
+	}
+
+public:
+	Lister(Walk *w)
+		: w(w), directories(0)
+	{
+	}
+
+	virtual void run()
+	{
+		sincePosted.start();
+
+		w->lock.lock();
+		while (true)
+		{
+			while (w->queue.isEmpty() && w->listing && !w->stopping)
+				w->changed.wait(&w->lock);
+			if (w->queue.isEmpty() || w->stopping)
+				break;
+
+			// depth first, so the queue stays short
+			const QPair<QString, QString> dir = w->queue.takeLast();
+			w->listing++;
+			w->lock.unlock();
+
+			QList<QPair<QString, QString> > subdirs;
+			list(dir, subdirs);
+			if (found.size() >= batchSize || sincePosted.elapsed() >= batchMsecs)
+				post();
+
+			w->lock.lock();
+			for (int i=0; i < subdirs.size(); i++)
+			{
+				if (!w->visited.contains(subdirs[i].second))
+				{
+					w->visited.insert(subdirs[i].second);
+					w->queue.append(subdirs[i]);
+				}
+			}
+			w->listing--;
+			w->changed.wakeAll();
+		}
+
+		if (!found.isEmpty() || directories)
+			post();
+		const bool last = --w->running == 0;
+		w->changed.wakeAll();
+		w->lock.unlock();
+
+		if (last)
+			QApplication::postEvent(w->adder, new WalkDoneEvent);
+	}
+};
+
+
 Meow::DirectoryAdder::DirectoryAdder(QObject *parent)
-	: QObject(parent), busy(false)
+	: QObject(parent), walk(0), mDirectories(0), mFound(0)
+{
+}
+
+Meow::DirectoryAdder::~DirectoryAdder()
 {
+	if (!walk)
+		return;
+
+	walk->lock.lock();
+	walk->stopping = true;
+	walk->changed.wakeAll();
+	walk->lock.unlock();
+
+	for (int i=0; i < walk->listers.size(); i++)
+	{
+		walk->listers[i]->wait();
+		delete walk->listers[i];
+	}
+	delete walk;
 }
 
 void Meow::DirectoryAdder::add(const QUrl &dir)
@@ -95,34 +323,57 @@ void Meow::DirectoryAdder::add(const QUrl &dir)
 
 void Meow::DirectoryAdder::addNextPending()
 {
-	if (!pendingAddDirectories.isEmpty() && !busy)
+	if (pendingAddDirectories.isEmpty() || walk)
+		return;
+
+	const QString path = pendingAddDirectories.takeFirst().toLocalFile();
+
+	walk = new Walk;
+	walk->adder = this;
+	walk->listing = 0;
+	walk->stopping = false;
+	walk->queue.append(qMakePair(path, QFileInfo(path).canonicalFilePath()));
+	walk->visited.insert(walk->queue.first().second);
+
+	// listing is mostly waiting on the disk, so a few more
+	// than there are cores is still worth it, but not many
+	const int count = qBound(2, QThread::idealThreadCount(), 8);
+	walk->running = count;
+	for (int i=0; i < count; i++)
 	{
-		const QString path = pendingAddDirectories.takeFirst().toLocalFile();
-		currentIterator.reset(new QDirIterator(
-				QDir(path),
-				QDirIterator::Subdirectories
-			));
-		busy=true;
+		walk->listers.append(new Lister(walk));
+		walk->listers.last()->start(QThread::LowPriority);
 	}
-	QTimer::singleShot(100, this, SLOT(processMore()));
 }
 
-void Meow::DirectoryAdder::processMore()
+bool Meow::DirectoryAdder::event(QEvent *e)
 {
-	int c=10;
-	while (currentIterator->hasNext() && c--)
+	if (e->type() == FoundEvent::type)
 	{
-		currentIterator->next();
-		emit addFile(QUrl::fromLocalFile(currentIterator->filePath()));
+		FoundEvent *const fe = static_cast<FoundEvent*>(e);
+		mDirectories += fe->directories;
+		mFound += fe->files.size();
+		if (!fe->files.isEmpty())
+			emit addFiles(fe->files);
+		emit progress(mDirectories, mFound);
+		return true;
 	}
-	
-	if (currentIterator->hasNext())
-		QTimer::singleShot(100, this, SLOT(processMore()));
-	else
+	else if (e->type() == WalkDoneEvent::type)
 	{
-		busy = false;
-		emit done();
+		for (int i=0; i < walk->listers.size(); i++)
+		{
+			walk->listers[i]->wait();
+			delete walk->listers[i];
+		}
+		delete walk;
+		walk = 0;
+
+		addNextPending();
+		if (!walk)
+			emit done();
+		return true;
 	}
+	return QObject::event(e);
 }
 
 #endif
@@ -7,9 +7,8 @@
 #include <kurl.h>
 #include <kio/job.h>
 #else
-#include <qdiriterator.h>
 #include <qurl.h>
-#include <memory>
+#include <qstringlist.h>
 #endif
 
 namespace Meow
@@ -28,13 +27,31 @@ class DirectoryAdder : public QObject
 	KIO::ListJob *listJob;
 	KUrl currentJobUrl;
 #else
+	struct Walk;
+	class Lister;
 	QList<QUrl> pendingAddDirectories;
-	std::auto_ptr<QDirIterator> currentIterator;
-	bool busy;
+	Walk *walk;
+	int mDirectories, mFound;
 #endif
 public:
 	DirectoryAdder(QObject *parent);
 	
+	/**
+	 * if the local file @p path looks like something that can be
+	 * played, by its suffix or, if it has none, its first bytes
+	 **/
+	static bool isAudioFile(const QString &path);
+#ifndef MEOW_WITH_KDE
+	~DirectoryAdder();
+	
+	/**
+	 * how many directories have been listed, and how many
+	 * songs found in them, since this was made
+	 **/
+	int directoriesListed() const { return mDirectories; }
+	int filesFound() const { return mFound; }
+#endif
+	
 public slots:
 #ifdef MEOW_WITH_KDE
 	void add(const KUrl &dir);
@@ -48,6 +65,17 @@ signals:
 	void addFile(const KUrl &file);
 #else
 	void addFile(const QUrl &file);
+	/**
+	 * some of the songs found in the directories, as they're
+	 * found, in no particular order
+	 **/
+	void addFiles(const QStringList &files);
+	/**
+	 * how many directories have been listed and songs found so
+	 * far, after each batch; the last one before @ref done() is
+	 * the total
+	 **/
+	void progress(int directoriesListed, int filesFound);
 #endif
 
 #ifdef MEOW_WITH_KDE
@@ -56,8 +84,8 @@ private slots:
 	void slotEntries(KIO::Job *job, const KIO::UDSEntryList &entries);
 	void slotRedirection(KIO::Job *, const KUrl & url);
 #else
-private slots:
-	void processMore();
+protected:
+	virtual bool event(QEvent *e);
 #endif
 
 private:
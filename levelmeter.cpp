@@ -0,0 +1,86 @@
+#include "levelmeter.h"
+#include "analyzer.h"
+
+#include <qpainter.h>
+
+#include <cmath>
+
+// the bottom of the scale, anything quieter is empty
+static const float floorDb = -60;
+// how fast the peak line falls back, in dB per result
+static const float peakFall = 1.5;
+
+static float toDb(float level)
+{
+	return level > 0 ? qMax(floorDb, 20*std::log10(level)) : floorDb;
+}
+
+Meow::LevelMeter::LevelMeter(Analyzer *analyzer, QWidget *parent)
+	: QWidget(parent), analyzer(analyzer)
+{
+	clear();
+	connect(analyzer, SIGNAL(analyzed()), SLOT(analyzed()));
+}
+
+QSize Meow::LevelMeter::sizeHint() const
+{
+	return QSize(80, 16);
+}
+
+void Meow::LevelMeter::clear()
+{
+	for (int c=0; c < 2; c++)
+		rms[c] = peak[c] = floorDb;
+}
+
+void Meow::LevelMeter::analyzed()
+{
+	const Analyzer::Result result = analyzer->result();
+	for (int c=0; c < 2; c++)
+	{
+		// a mono song shows the same in both
+		const int from = qMin(c, result.rms.size()-1);
+		if (from < 0)
+		{
+			rms[c] = floorDb;
+			peak[c] = qMax(floorDb, peak[c]-peakFall);
+			continue;
+		}
+		rms[c] = toDb(result.rms[from]);
+		peak[c] = qMax(toDb(result.peak[from]), peak[c]-peakFall);
+	}
+	update();
+}
+
+void Meow::LevelMeter::paintEvent(QPaintEvent *)
+{
+	QPainter p(this);
+	const QRect area = contentsRect().adjusted(1, 1, -1, -1);
+	const int barHeight = (area.height()-1)/2;
+
+	for (int c=0; c < 2; c++)
+	{
+		const QRect bar(area.left(), area.top() + c*(barHeight+1), area.width(), barHeight);
+		p.fillRect(bar, palette().color(QPalette::Base));
+
+		const int level = int(bar.width() * (rms[c]-floorDb) / -floorDb);
+		p.fillRect(bar.adjusted(0, 0, level-bar.width(), 0), palette().color(QPalette::Highlight));
+
+		const int at = bar.left() + int((bar.width()-1) * (qMin(0.f, peak[c])-floorDb) / -floorDb);
+		p.setPen(peak[c] >= 0 ? QColor(Qt::red) : palette().color(QPalette::Text));
+		p.drawLine(at, bar.top(), at, bar.bottom());
+	}
+}
+
+void Meow::LevelMeter::showEvent(QShowEvent *)
+{
+	analyzer->setEnabled(true);
+}
+
+void Meow::LevelMeter::hideEvent(QHideEvent *)
+{
+	analyzer->setEnabled(false);
+	clear();
+}
+
+// kate: space-indent off; replace-tabs off;
@@ -0,0 +1,46 @@
+#ifndef MEOW_LEVELMETER_H
+#define MEOW_LEVELMETER_H
+
+#include <qwidget.h>
+
+namespace Meow
+{
+
+class Analyzer;
+
+/**
+ * Shows the level of the left and right channel of what's playing,
+ * as measured by an @ref Analyzer: a bar for the RMS and a line for
+ * the peak, from -60dB to full scale.
+ *
+ * The analyzer is only enabled while this is visible
+ **/
+class LevelMeter : public QWidget
+{
+	Q_OBJECT
+	Analyzer *const analyzer;
+	// in dB, for each channel
+	float rms[2], peak[2];
+
+public:
+	LevelMeter(Analyzer *analyzer, QWidget *parent);
+
+	virtual QSize sizeHint() const;
+
+private slots:
+	void analyzed();
+
+protected:
+	virtual void paintEvent(QPaintEvent *event);
+	virtual void showEvent(QShowEvent *event);
+	virtual void hideEvent(QHideEvent *event);
+
+private:
+	void clear();
+};
+
+}
+
+#endif
+
+// kate: space-indent off; replace-tabs off;
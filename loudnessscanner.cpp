@@ -0,0 +1,299 @@
+#include "loudnessscanner.h"
+#include "player.h"
+
+#include <akode/audioframe.h>
+#include <akode/decoder.h>
+#include <akode/mmapfile.h>
+#include <akode/localfile.h>
+#include <akode/loudness.h>
+
+#include <qapplication.h>
+#include <qthread.h>
+#include <qmutex.h>
+#include <qwaitcondition.h>
+#include <qevent.h>
+#include <qfile.h>
+#include <qpair.h>
+
+#include <memory>
+
+namespace
+{
+
+class MeasuredEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+16);
+	MeasuredEvent(int generation, Meow::FileId id, const Meow::Collection::Loudness &loudness)
+		: QEvent(type), generation(generation), id(id), loudness(loudness)
+	{}
+
+	const int generation;
+	const Meow::FileId id;
+	const Meow::Collection::Loudness loudness;
+};
+
+// songs are fetched from the collection this many at a time,
+// when fewer than lowWater are waiting
+const int batchSize = 64;
+const int lowWater = 16;
+
+// a decoder that keeps not giving a frame without saying
+// why is given up on after this many tries
+const int maxBlips = 1000;
+
+}
+
+struct Meow::LoudnessScanner::Private
+{
+	Collection *collection;
+
+	QMutex lock;
+	QWaitCondition changed;
+	QList<QPair<FileId, QString> > queue;
+	// also read by measure without the lock, so that halt
+	// doesn't wait for whole songs to be decoded
+	std::atomic<bool> stopping;
+	// between restart and stop
+	bool enabled;
+
+	QList<Measurer*> measurers;
+	// incremented by halt, so that what's measured by a Measurer
+	// that was already under way can be ignored
+	int generation;
+
+	// the greatest id put in the queue, the next batch comes after it
+	FileId last;
+	// there were no more songs after last
+	bool exhausted;
+	// put in the queue, but not measured yet
+	int outstanding;
+};
+
+class Meow::LoudnessScanner::Measurer : public QThread
+{
+	LoudnessScanner *const scanner;
+	Private *const d;
+	const int generation;
+
+public:
+	Measurer(LoudnessScanner *scanner, Private *d)
+		: scanner(scanner), d(d), generation(d->generation)
+	{
+	}
+
+	virtual void run()
+	{
+		d->lock.lock();
+		while (true)
+		{
+			while (d->queue.isEmpty() && !d->stopping)
+				d->changed.wait(&d->lock);
+			if (d->stopping)
+				break;
+
+			const QPair<FileId, QString> song = d->queue.takeFirst();
+			d->lock.unlock();
+
+			const Collection::Loudness loudness = measure(song.second, &d->stopping);
+			if (!d->stopping)
+				QApplication::postEvent(scanner, new MeasuredEvent(generation, song.first, loudness));
+
+			d->lock.lock();
+		}
+		d->lock.unlock();
+	}
+};
+
+
+Meow::LoudnessScanner::LoudnessScanner(Collection *collection, QObject *parent)
+	: QObject(parent)
+{
+	d = new Private;
+	d->collection = collection;
+	d->stopping = false;
+	d->enabled = false;
+	d->generation = 0;
+	d->last = 0;
+	d->exhausted = true;
+	d->outstanding = 0;
+}
+
+Meow::LoudnessScanner::~LoudnessScanner()
+{
+	stop();
+	delete d;
+}
+
+Meow::Collection::Loudness Meow::LoudnessScanner::measure(
+		const QString &path, const std::atomic<bool> *stop
+	)
+{
+	Collection::Loudness loudness;
+
+#ifdef _WIN32
+	const aKode::FileName name = (wchar_t*)path.utf16();
+#else
+	const aKode::FileName name = QFile::encodeName(path).data();
+#endif
+
+	// the same way aKode::Player opens it
+	std::unique_ptr<aKode::File> src(new aKode::MMapFile(name));
+	if (!src->openRO())
+	{
+#ifndef _WIN32
+		src.reset(new aKode::LocalFile(name));
+		if (!src->openRO())
+			return loudness;
+#else
+		return loudness;
+#endif
+	}
+	src->close();
+
+	std::unique_ptr<aKode::Decoder> decoder;
+	const std::vector<aKode::DecoderPlugin*> plugins = Player::decoderPlugins();
+	for (std::vector<aKode::DecoderPlugin*>::const_iterator i = plugins.begin(); i != plugins.end(); ++i)
+	{
+		if ((*i)->canDecode(src.get()))
+		{
+			decoder.reset((*i)->openDecoder(src.get()));
+			break;
+		}
+	}
+	if (!decoder)
+		return loudness;
+
+	aKode::LoudnessMeter meter;
+	aKode::AudioFrame frame;
+	int blips=0;
+	while (true)
+	{
+		if (stop && *stop)
+			return loudness;
+		if (decoder->readFrame(&frame))
+		{
+			meter.process(&frame);
+			blips = 0;
+		}
+		else if (decoder->eof())
+			break;
+		else if (decoder->error() || ++blips == maxBlips)
+			return loudness;
+	}
+	decoder.reset();
+
+	// silence can't be made louder
+	if (meter.gatedBlocks() == 0)
+		return loudness;
+
+	loudness.measured = true;
+	loudness.track = loudness.album = meter.integrated();
+	loudness.trackPeak = loudness.albumPeak = meter.truePeak();
+	loudness.energy = meter.gatedEnergy();
+	loudness.blocks = meter.gatedBlocks();
+	return loudness;
+}
+
+void Meow::LoudnessScanner::stop()
+{
+	d->enabled = false;
+	halt();
+}
+
+void Meow::LoudnessScanner::halt()
+{
+	d->generation++;
+
+	d->lock.lock();
+	d->stopping = true;
+	d->queue.clear();
+	d->changed.wakeAll();
+	d->lock.unlock();
+
+	for (int i=0; i < d->measurers.size(); i++)
+	{
+		d->measurers[i]->wait();
+		delete d->measurers[i];
+	}
+	d->measurers.clear();
+
+	d->stopping = false;
+	d->exhausted = true;
+	d->outstanding = 0;
+}
+
+void Meow::LoudnessScanner::restart()
+{
+	halt();
+	d->enabled = true;
+	d->last = 0;
+	d->exhausted = false;
+	fill();
+}
+
+void Meow::LoudnessScanner::resume()
+{
+	if (!d->enabled)
+		return;
+	// a song that was changed keeps its id, so it can
+	// only be found by starting over
+	if (d->measurers.isEmpty())
+	{
+		restart();
+		return;
+	}
+	d->exhausted = false;
+	fill();
+}
+
+void Meow::LoudnessScanner::fill()
+{
+	if (d->exhausted || d->outstanding >= lowWater)
+		return;
+
+	const QList<QPair<FileId, QString> > songs = d->collection->unmeasured(d->last, batchSize);
+	if (songs.isEmpty())
+	{
+		d->exhausted = true;
+		return;
+	}
+	d->last = songs.last().first;
+	d->outstanding += songs.size();
+
+	d->lock.lock();
+	d->queue += songs;
+	d->changed.wakeAll();
+	d->lock.unlock();
+
+	if (d->measurers.isEmpty())
+	{
+		// leave a core for playing and everything else
+		const int count = qMax(1, QThread::idealThreadCount()-1);
+		for (int i=0; i < count; i++)
+		{
+			d->measurers.append(new Measurer(this, d));
+			d->measurers.last()->start(QThread::IdlePriority);
+		}
+	}
+}
+
+bool Meow::LoudnessScanner::event(QEvent *e)
+{
+	if (e->type() != MeasuredEvent::type)
+		return QObject::event(e);
+
+	MeasuredEvent *const me = static_cast<MeasuredEvent*>(e);
+	if (me->generation != d->generation)
+		return true;
+
+	d->collection->setLoudness(me->id, me->loudness);
+	d->outstanding--;
+
+	fill();
+	if (d->exhausted && d->outstanding == 0)
+		halt();
+	return true;
+}
+
+// kate: space-indent off; replace-tabs off;
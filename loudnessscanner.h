@@ -0,0 +1,70 @@
+#ifndef MEOW_LOUDNESSSCANNER_H
+#define MEOW_LOUDNESSSCANNER_H
+
+#include <db/collection.h>
+
+#include <qobject.h>
+
+#include <atomic>
+
+namespace Meow
+{
+
+/**
+ * Measures the loudness (@ref Collection::Loudness) of each song in
+ * a collection that hasn't been yet, so that they can all be played
+ * at about the same loudness.
+ *
+ * The songs are decoded on as many threads as there are spare cores,
+ * at idle priority, without being played. What's been measured is
+ * kept in the collection as it goes, so a scan that's stopped carries
+ * on from where it was when it's restarted
+ **/
+class LoudnessScanner : public QObject
+{
+	Q_OBJECT
+	struct Private;
+	class Measurer;
+	Private *d;
+
+public:
+	LoudnessScanner(Collection *collection, QObject *parent);
+	~LoudnessScanner();
+
+	/**
+	 * decode all of @p path and measure it, in this thread.
+	 * Gives up, unmeasured, as soon as @p stop is set
+	 **/
+	static Collection::Loudness measure(
+			const QString &path, const std::atomic<bool> *stop=0
+		);
+
+public slots:
+	/**
+	 * stop measuring anything until @ref restart
+	 **/
+	void stop();
+	/**
+	 * start measuring every song that isn't yet, for when a
+	 * collection was opened
+	 **/
+	void restart();
+	/**
+	 * look for songs that need measuring again, because some
+	 * were added or changed. Does nothing after @ref stop
+	 **/
+	void resume();
+
+protected:
+	virtual bool event(QEvent *e);
+
+private:
+	void halt();
+	void fill();
+};
+
+}
+
+#endif
+
+// kate: space-indent off; replace-tabs off;
@@ -3,8 +3,11 @@
 #include "player.h"
 #include "scrobble.h"
 #include "directoryadder.h"
+#include "watcher.h"
+#include "loudnessscanner.h"
 #include "filter.h"
 #include "shortcut.h"
+#include "levelmeter.h"
 
 #include <db/file.h>
 #include <db/base.h>
@@ -50,6 +53,8 @@ struct Meow::MainWindow::MainWindowPrivate
 	Base db;
 	Collection *collection;
 	DirectoryAdder *adder;
+	Watcher *watcher;
+	LoudnessScanner *loudness;
 	
 	QAction *itemProperties, *itemRemove;
 	QMenu *playbackOrder;
@@ -61,6 +66,7 @@ struct Meow::MainWindow::MainWindowPrivate
 	QAction *playPauseAction, *prevAction, *nextAction, *volumeUpAction, *volumeDownAction, *volumeAction;
 	
 	QAction *toggleToolbarAction, *toggleMenubarAction, *shortcutConfigAction;
+	QAction *levelsAction, *toggleLevelsAction;
 	
 	bool nowFiltering, quitting;
 	
@@ -114,6 +120,14 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 	d->settingsDialog=0;
 
 	d->collection = new Collection(&d->db);
+	d->watcher = new Watcher(d->collection, this);
+	// the songs are all in the tree by then, so
+	// what it removes is taken out of it too
+	connect(d->collection, SIGNAL(loaded()), d->watcher, SLOT(restart()));
+	d->loudness = new LoudnessScanner(d->collection, this);
+	connect(d->collection, SIGNAL(loaded()), d->loudness, SLOT(restart()));
+	connect(d->collection, SIGNAL(addedBatch(QVector<File>)), d->loudness, SLOT(resume()));
+	connect(d->collection, SIGNAL(reloaded(File)), d->loudness, SLOT(resume()));
 
 	QWidget *owner = new QWidget(this);
 	QVBoxLayout *ownerLayout = new QVBoxLayout(owner);
@@ -162,6 +176,14 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 		topToolbar->addAction(ac);
 		fileMenu->addAction(ac);
 		
+		if (Watcher::isSupported())
+		{
+			ac = new QAction(this);
+			connect(ac, SIGNAL(triggered()), SLOT(watchFolder()));
+			ac->setText(tr("&Watch Folder..."));
+			fileMenu->addAction(ac);
+		}
+		
 		ac = new QAction(this);
 		connect(ac, SIGNAL(triggered()), d->filter, SLOT(show()));
 		ac->setText(tr("&Find"));
@@ -199,6 +221,8 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 		ac->setIcon(iconByName("player-volume.png"));
 		topToolbar->addAction(ac);
 		
+		d->levelsAction = topToolbar->addWidget(new LevelMeter(d->player->analyzer(), topToolbar));
+		
 		trayMenu->addAction(d->nextAction);
 		trayMenu->addAction(d->prevAction);
 
@@ -214,7 +238,8 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 				{ tr("Each File"), TreeView::Linear },
 				{ tr("Random Song"), TreeView::RandomSong },
 				{ tr("Random Album"), TreeView::RandomAlbum },
-				{ tr("Random Artist"), TreeView::RandomArtist }
+				{ tr("Random Artist"), TreeView::RandomArtist },
+				{ tr("Shuffle"), TreeView::Shuffle }
 			};
 			
 			d->playbackOrder = fileMenu->addMenu(tr("Playback Order"));
@@ -283,6 +308,12 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 		ac->setCheckable(true);
 		settingsMenu->addAction(ac);
 		
+		ac = d->toggleLevelsAction = new QAction(this);
+		connect(ac, SIGNAL(toggled(bool)), d->levelsAction, SLOT(setVisible(bool)));
+		ac->setText(tr("Show &Levels"));
+		ac->setCheckable(true);
+		settingsMenu->addAction(ac);
+		
 		settingsMenu->addSeparator();
 		
 		ac = new QAction(this);
@@ -334,6 +365,11 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 	d->toggleMenubarAction->setChecked(menuBar()->isVisibleTo(this));
 
 	QSettings settings;
+	{
+		const bool levels = settings.value("state/levels", false).toBool();
+		d->toggleLevelsAction->setChecked(levels);
+		d->levelsAction->setVisible(levels);
+	}
 	{
 		const int v = settings.value("state/volume", 50).toInt();
 		d->player->setVolume(v);
@@ -347,7 +383,9 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 	{
 		QString order = settings.value("state/selector", "linear").toString();
 		int index;
-		if (order == "randomartist")
+		if (order == "shuffle")
+			index = TreeView::Shuffle;
+		else if (order == "randomartist")
 			index = TreeView::RandomArtist;
 		else if (order == "randomalbum")
 			index = TreeView::RandomAlbum;
@@ -389,6 +427,11 @@ void Meow::MainWindow::addFile(const QUrl &url)
 	d->collection->add( url.toLocalFile(), false );
 }
 
+void Meow::MainWindow::addPaths(const QStringList &paths)
+{
+	d->collection->add(paths);
+}
+
 void Meow::MainWindow::addAndPlayFile(const QUrl &url)
 {
 	d->collection->add( url.toLocalFile(), true );
@@ -471,9 +514,12 @@ void Meow::MainWindow::closeEvent(QCloseEvent *event)
 	QSettings settings;
 	settings.setValue("state/volume", d->player->volume());
 	settings.setValue("state/lastPlayed", d->player->currentFile().fileId());
+	settings.setValue("state/levels", d->toggleLevelsAction->isChecked());
 
 	TreeView::SelectorType selector = d->selectors[d->selectorActions.checkedAction()];
-	if (selector == TreeView::RandomArtist)
+	if (selector == TreeView::Shuffle)
+		settings.setValue("state/selector", "shuffle");
+	else if (selector == TreeView::RandomArtist)
 		settings.setValue("state/selector", "randomartist");
 	else if (selector == TreeView::RandomAlbum)
 		settings.setValue("state/selector", "randomalbum");
@@ -538,6 +584,7 @@ void Meow::MainWindow::beginDirectoryAdd(const QString &file)
 		d->adder = new DirectoryAdder(this);
 		connect(d->adder, SIGNAL(done()), SLOT(adderDone()));
 		connect(d->adder, SIGNAL(addFile(QUrl)), SLOT(addFile(QUrl)));
+		connect(d->adder, SIGNAL(addFiles(QStringList)), SLOT(addPaths(QStringList)));
 	}
 	d->adder->add(QUrl::fromLocalFile(file));
 }
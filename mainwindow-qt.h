@@ -12,6 +12,7 @@
 class QSlider;
 class QSignalMapper;
 class QUrl;
+class QStringList;
 
 namespace Meow
 {
@@ -38,7 +39,9 @@ private slots:
 public slots:
 	void addFiles();
 	void addDirs();
+	void watchFolder();
 	void addFile(const QUrl &url);
+	void addPaths(const QStringList &paths);
 	void addAndPlayFile(const QUrl &url);
 	void toggleVisible();
 
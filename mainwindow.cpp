@@ -2,9 +2,12 @@
 #include "treeview.h"
 #include "player.h"
 #include "directoryadder.h"
+#include "watcher.h"
+#include "loudnessscanner.h"
 #include "scrobble.h"
 #include "fileproperties.h"
 #include "filter.h"
+#include "levelmeter.h"
 
 #include <db/file.h>
 #include <db/base.h>
@@ -30,6 +33,7 @@
 #include <kmimetypetrader.h>
 #include <kshortcutsdialog.h>
 #include <kactionmenu.h>
+#include <ktoggleaction.h>
 #include <krun.h>
 #include <kmenu.h>
 
@@ -54,9 +58,13 @@ struct Meow::MainWindow::MainWindowPrivate
 	Base db;
 	Collection *collection;
 	DirectoryAdder *adder;
+	Watcher *watcher;
+	LoudnessScanner *loudness;
 	
 	KAction *itemProperties;
 	KAction *playPauseAction;
+	KAction *levelsAction;
+	KToggleAction *showLevelsAction;
 	KSelectAction *playbackOrder;
 	KActionMenu *openWith, *collectionsAction;
 	QActionGroup *collectionsActionGroup;
@@ -83,6 +91,14 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 	d->openFileDialog = 0;
 	
 	d->collection = new Collection(&d->db);
+	d->watcher = new Watcher(d->collection, this);
+	// the songs are all in the tree by then, so
+	// what it removes is taken out of it too
+	connect(d->collection, SIGNAL(loaded()), d->watcher, SLOT(restart()));
+	d->loudness = new LoudnessScanner(d->collection, this);
+	connect(d->collection, SIGNAL(loaded()), d->loudness, SLOT(restart()));
+	connect(d->collection, SIGNAL(addedBatch(QVector<File>)), d->loudness, SLOT(resume()));
+	connect(d->collection, SIGNAL(reloaded(File)), d->loudness, SLOT(resume()));
 
 	QWidget *owner = new QWidget(this);
 	QVBoxLayout *ownerLayout = new QVBoxLayout(owner);
@@ -120,6 +136,10 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 		ac = actionCollection()->addAction("add_files", this, SLOT(addFiles()));
 		ac->setText(i18n("Add &Files..."));
 		ac->setIcon(KIcon("list-add"));
+		
+		ac = actionCollection()->addAction("watch_folder", this, SLOT(watchFolder()));
+		ac->setText(i18n("&Watch Folder..."));
+		ac->setVisible(Watcher::isSupported());
 
 		ac = actionCollection()->addAction("find", d->filter, SLOT(show()));
 		ac->setText(i18n("&Find"));
@@ -177,11 +197,20 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 		connect(va, SIGNAL(volumeChanged(int)), d->player, SLOT(setVolume(int)));
 		connect(d->player, SIGNAL(volumeChanged(int)), va, SLOT(setVolume(int)));
 		
+		d->levelsAction = new KAction(i18n("Levels"), this);
+		d->levelsAction->setDefaultWidget(new LevelMeter(d->player->analyzer(), this));
+		actionCollection()->addAction("levels", d->levelsAction);
+		
+		d->showLevelsAction = new KToggleAction(i18n("Show &Levels"), this);
+		actionCollection()->addAction("show_levels", d->showLevelsAction);
+		connect(d->showLevelsAction, SIGNAL(toggled(bool)), d->levelsAction, SLOT(setVisible(bool)));
+		
 		{
 			QStringList playbackOrderItems;
 			// this order is significant
 			playbackOrderItems << i18n("Each File") << i18n("Random Song")
-				<< i18n("Random Album") << i18n("Random Artist");
+				<< i18n("Random Album") << i18n("Random Artist")
+				<< i18n("Shuffle");
 			d->playbackOrder = new KSelectAction(i18n("Playback Order"), this);
 			d->playbackOrder->setItems(playbackOrderItems);
 			actionCollection()->addAction("playbackorder", d->playbackOrder);
@@ -265,6 +294,11 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 	toggleMenubarAction->setChecked(menuBar()->isVisibleTo(this));
 	
 	KConfigGroup meow = KGlobal::config()->group("state");
+	{
+		const bool levels = meow.readEntry<bool>("levels", false);
+		d->showLevelsAction->setChecked(levels);
+		d->levelsAction->setVisible(levels);
+	}
 	{
 		const int v = meow.readEntry<int>("volume", 50);
 		d->player->setVolume(v);
@@ -276,7 +310,9 @@ Meow::MainWindow::MainWindow(bool dontPlayLastPlayed)
 	{
 		QString order = meow.readEntry<QString>("selector", "linear");
 		int index;
-		if (order == "randomartist")
+		if (order == "shuffle")
+			index = TreeView::Shuffle;
+		else if (order == "randomartist")
 			index = TreeView::RandomArtist;
 		else if (order == "randomalbum")
 			index = TreeView::RandomAlbum;
@@ -310,8 +346,11 @@ void Meow::MainWindow::quitting()
 	KConfigGroup meow = KGlobal::config()->group("state");
 	meow.writeEntry<int>("volume", d->player->volume());
 	meow.writeEntry<FileId>("lastPlayed", d->player->currentFile().fileId());
+	meow.writeEntry<bool>("levels", d->showLevelsAction->isChecked());
 
-	if (d->playbackOrder->currentItem() == TreeView::RandomArtist)
+	if (d->playbackOrder->currentItem() == TreeView::Shuffle)
+		meow.writeEntry("selector", "shuffle");
+	else if (d->playbackOrder->currentItem() == TreeView::RandomArtist)
 		meow.writeEntry("selector", "randomartist");
 	else if (d->playbackOrder->currentItem() == TreeView::RandomAlbum)
 		meow.writeEntry("selector", "randomalbum");
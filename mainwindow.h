@@ -42,6 +42,7 @@ private slots:
 
 public slots:
 	void addFiles();
+	void watchFolder();
 	void addFile(const KUrl &url);
 	void addAndPlayFile(const KUrl &url);
 	void toggleVisible();
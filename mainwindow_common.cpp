@@ -1,4 +1,5 @@
 #include <qinputdialog.h>
+#include <qfiledialog.h>
 #include <qtimer.h>
 
 #include "configdevices.h"
@@ -152,6 +153,8 @@ public:
 void Meow::MainWindow::loadCollection(const QString &name, Meow::FileId first)
 {
 	d->collection->stop();
+	d->watcher->stop();
+	d->loudness->stop();
 	d->view->clear();
 
 #if defined(MEOW_WITH_KDE)
@@ -387,5 +390,26 @@ void Meow::MainWindow::deleteCollection()
 #endif
 }
 
+void Meow::MainWindow::watchFolder()
+{
+	const QString folder = QFileDialog::getExistingDirectory(this, i18n("Watch Folder"));
+	if (folder.isEmpty())
+		return;
+	
+	if (d->watcher->folders().contains(QDir::cleanPath(folder)))
+	{
+		if ( QMessageBox::Ok == QMessageBox::question(
+				this,
+				i18n("Watch Folder"),
+				i18n("\"%1\" is already watched. Stop watching it?").arg(folder),
+				QMessageBox::Ok | QMessageBox::Cancel
+			))
+		{
+			d->watcher->unwatch(folder);
+		}
+		return;
+	}
+	d->watcher->watch(folder);
+}
 
 // kate: space-indent off; replace-tabs off;
@@ -27,6 +27,7 @@
 
 #include "player_p.h"
 #include "player.h"
+#include "analyzer.h"
 
 #include <qregexp.h>
 #include <qfile.h>
@@ -98,19 +99,15 @@ void PlayerPrivate::initAvKode()
 	#else
 	#error No sink
 	#endif
-		akPlayer->registerDecoderPlugin(&aKode::mpg123_decoder());
-		akPlayer->registerDecoderPlugin(&aKode::vorbis_decoder());
-	#ifdef AKODE_WITH_OPUS
-		akPlayer->registerDecoderPlugin(&aKode::opus_decoder());
-	#endif
-		akPlayer->registerDecoderPlugin(&aKode::flac_decoder());
-	#ifdef AKODE_WITH_MUSEPACK
-		akPlayer->registerDecoderPlugin(&aKode::mpc_decoder());
-	#endif
-		akPlayer->registerDecoderPlugin(&aKode::speex_decoder());
+		const std::vector<aKode::DecoderPlugin*> decoders = Player::decoderPlugins();
+		for (std::vector<aKode::DecoderPlugin*>::const_iterator i = decoders.begin(); i != decoders.end(); ++i)
+			akPlayer->registerDecoderPlugin(*i);
 		akPlayer->setManager(shared_from_this());
+		// it can only be given before anything plays
+		akPlayer->setMonitor(analyzer->monitor());
 
 		q->setVolume(volumePercent);
+		q->setGain(gain);
 		
 		QObject::connect(
 				q, SIGNAL(stStateChangeEvent(int)),
@@ -158,7 +155,7 @@ void PlayerPrivate::tStateChangeEvent(int newState)
 		case aKode::Player::Playing:
 			emit q->playing();
 			emit q->playing(true);
-			timer->start(500);
+			tick();
 			break;
 		case aKode::Player::Paused:
 			emit q->playing(false);
@@ -200,18 +197,29 @@ void PlayerPrivate::tErrorEvent()
 
 void PlayerPrivate::tick()
 {
-	try
+	const unsigned int pos = q->position();
+	if (int(pos/1000) != shownSecond)
 	{
-		if (std::shared_ptr<aKode::Decoder> dec = akPlayer->decoder())
+		shownSecond = pos/1000;
+		emit q->positionChanged(pos);
+
+		// the decoder may only know the length once it's read a
+		// bit, so it's asked again until it does
+		const int len = q->currentLength();
+		if (len != shownLength)
 		{
-			emit q->positionChanged(dec->length());
-			emit q->lengthChanged(dec->position());
+			shownLength = len;
+			emit q->lengthChanged(len);
 		}
 	}
-	catch (aKode::ExceptionBase &e)
-	{
-		std::cerr << "akode error: " << e.what() << std::endl;
-	}
+	if (akPlayer && akPlayer->state() == aKode::Player::Playing)
+		scheduleTick(pos);
+}
+
+void PlayerPrivate::scheduleTick(unsigned int msec)
+{
+	// a little past the boundary, so the second has surely changed
+	timer->start(1000 - msec%1000 + 10);
 }
 
 // -----------------------------------------------------------------------------
@@ -222,11 +230,16 @@ Player::Player()
 	d->q = this;
 	setObjectName("Player");
 	d->timer = new QTimer(this);
+	d->timer->setSingleShot(true);
 	connect(d->timer, SIGNAL(timeout()), SLOT(tick()));
+	d->shownSecond = -1;
+	d->shownLength = -1;
+	d->analyzer = new Analyzer(this);
 
 	d->akPlayer = 0;
 	d->nowLoading = false;
 	d->volumePercent = 50;
+	d->gain = 0.0;
 #ifdef MEOW_WITH_DBUS
 	QDBusConnection connection = QDBusConnection::sessionBus();
 	connection.registerObject("/player", this, QDBusConnection::ExportScriptableContents);
@@ -388,6 +401,7 @@ void Player::play(const File &item)
 		d->akPlayer->stop();
 		d->currentItem.reset(new File(item));
 		d->nowLoading = true;
+		d->shownSecond = d->shownLength = -1;
 	#ifdef _WIN32
 		dirty_trick<sizeof(wchar_t) == sizeof(ushort)>();
 		d->akPlayer->load( (wchar_t*)item.file().utf16() );
@@ -434,6 +448,10 @@ void Player::setPosition(unsigned int msec)
 		{
 			if (std::shared_ptr<aKode::Decoder> dec = d->akPlayer->decoder())
 				dec->seek(msec);
+			// the new position is only heard once the sink
+			// has played what it had, so look again soon
+			if (isPlaying())
+				d->timer->start(100);
 		}
 	}
 	catch (aKode::ExceptionBase &e)
@@ -444,15 +462,8 @@ void Player::setPosition(unsigned int msec)
 
 unsigned int Player::position() const
 {
-	if (d->akPlayer)
-	{
-		if (std::shared_ptr<aKode::Decoder> dec = d->akPlayer->decoder())
-		{
-			unsigned int p = dec->position();
-			//std::cerr << "pos: " << p << std::endl;
-			return p;
-		}
-	}
+	if (d->akPlayer && isActive())
+		return d->akPlayer->position();
 	return 0;
 }
 
@@ -522,16 +533,18 @@ unsigned int Player::currentLength() const
 		if (d->akPlayer)
 			if (std::shared_ptr<aKode::Decoder> dec = d->akPlayer->decoder())
 			{
-				unsigned int l = dec->length();
+				const long l = dec->length();
 				// std::cerr << "len: " << l << std::endl;
-				return l;
+				if (l > 0)
+					return l;
 			}
 	}
 	catch (aKode::ExceptionBase &e)
 	{
 		std::cerr << "akode error: " << e.what() << std::endl;
 	}
-	return 0;
+	// the decoder doesn't know (yet), but the collection might
+	return currentFile().length();
 }
 
 QString Player::lengthString() const
@@ -565,6 +578,36 @@ void Player::setVolume(int percent)
 	}
 }
 
+void Player::setGain(double decibels)
+{
+	d->gain = decibels;
+	try
+	{
+		if (d->akPlayer)
+			d->akPlayer->setGain(std::pow(10.0, decibels/20.0));
+	}
+	catch (aKode::ExceptionBase &e)
+	{
+		std::cerr << "akode error: " << e.what() << std::endl;
+	}
+}
+
+std::vector<aKode::DecoderPlugin*> Player::decoderPlugins()
+{
+	std::vector<aKode::DecoderPlugin*> decoders;
+	decoders.push_back(&aKode::mpg123_decoder());
+	decoders.push_back(&aKode::vorbis_decoder());
+#ifdef AKODE_WITH_OPUS
+	decoders.push_back(&aKode::opus_decoder());
+#endif
+	decoders.push_back(&aKode::flac_decoder());
+#ifdef AKODE_WITH_MUSEPACK
+	decoders.push_back(&aKode::mpc_decoder());
+#endif
+	decoders.push_back(&aKode::speex_decoder());
+	return decoders;
+}
+
 File Player::currentFile() const
 {
 	if (!d->currentItem.get())
@@ -573,6 +616,11 @@ File Player::currentFile() const
 		return *d->currentItem;
 }
 
+Analyzer *Player::analyzer() const
+{
+	return d->analyzer;
+}
+
 QString Player::currentTitle() const
 {
 	if (File f = currentFile())
@@ -34,11 +34,17 @@
 #include <string>
 #include <memory>
 
+namespace aKode
+{
+class DecoderPlugin;
+}
+
 namespace Meow
 {
 
 class File;
 class PlayerPrivate;
+class Analyzer;
 
 /**
  * @brief player backend
@@ -167,6 +173,22 @@ public:
 	QStringList mimeTypes() const;
 	
 	File currentFile() const;
+
+	/**
+	 * levels and spectrum of what's playing, once it's enabled
+	 **/
+	Analyzer *analyzer() const;
+	
+	/**
+	 * the decoders that files are played with
+	 **/
+	static std::vector<aKode::DecoderPlugin*> decoderPlugins();
+	
+	/**
+	 * make up for how loud the songs played from now on are,
+	 * by @p decibels on top of the volume
+	 **/
+	void setGain(double decibels);
 	
 	Q_SCRIPTABLE QString currentTitle() const;
 	Q_SCRIPTABLE QString currentArtist() const;
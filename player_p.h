@@ -49,11 +49,17 @@ public:
 	Player              *q;
 	aKode::Player       *akPlayer;
 	std::auto_ptr<File> currentItem; // TODO: remove
+	Analyzer *analyzer;
 	
+	// fires when the displayed second is next due to change,
+	// and not at all while paused
 	QTimer *timer;
+	int shownSecond;
+	int shownLength;
 	
 	bool nowLoading;
 	int volumePercent;
+	double gain;
 	int speedPercent;
 	std::string device;
 
@@ -68,6 +74,7 @@ public:
 	void tErrorEvent();
 	
 	void tick();
+	void scheduleTick(unsigned int msec);
 	
 	static Player::State convertState(aKode::Player::State s);
 };
@@ -34,8 +34,12 @@
 #include <qgridlayout.h>
 #include <qlineedit.h>
 #include <qpushbutton.h>
+#include <qhash.h>
+#include <qmap.h>
+#include <qpair.h>
 
 #include <iostream>
+#include <random>
 
 
 #ifdef MEOW_WITH_KDE
@@ -319,10 +323,18 @@ void Meow::ScrobbleConfigure::showResults(ScrobbleSession::HandshakeState state)
 
 
 
-static const char handshakeUrl[] = "http://ws.audioscrobbler.com/2.0/";
+static const char defaultEndpoint[] = "http://ws.audioscrobbler.com/2.0/";
 static const char apiKey[] = "e31674916d417e952120fc56b53750b0";
 static const char sharedSecret[] = "2dd588e3897657af9422bf4a467f9d8d"; // this api is retarded
 
+// MEOW_SCROBBLE_URL points it at something other than last.fm,
+// such as a stand-in for testing
+static QString endpoint()
+{
+	const QByteArray e = qgetenv("MEOW_SCROBBLE_URL");
+	return e.isEmpty() ? QString(defaultEndpoint) : QString::fromUtf8(e);
+}
+
 #ifdef MEOW_WITH_KDE
 static QString userAgent()
 {
@@ -338,46 +350,54 @@ static QString userAgent()
 #endif
 
 
-struct Meow::ScrobbleSession::ScrobbleSessionPrivate
+struct Meow::ScrobbleSession::Request
 {
+	bool post;
+	// everything except starting a session waits for one
+	bool needsSession;
+	Query query;
+	void (ScrobbleSession::*response)(const Request &, QDomElement);
+	qint64 cookie;
+
+	QByteArray received;
+	// no answer from last.fm itself, such as the network being
+	// down or its server falling over
+	bool transportFailed;
 #ifndef MEOW_WITH_KDE
-	QNetworkAccessManager networkAccess;
-	QByteArray postedData;
+	QByteArray posted;
 	QBuffer postedBuffer;
-	QNetworkReply *currentHttp;
 #endif
+};
 
-	void (ScrobbleSession::*response)(QDomElement);
+struct Meow::ScrobbleSession::ScrobbleSessionPrivate
+{
+#ifndef MEOW_WITH_KDE
+	QNetworkAccessManager networkAccess;
+#endif
 
 	QString sessionKey;
-	QByteArray recievedData;
-	
-	struct QueueEl
-	{
-		bool post;
-		Query query;
-		void (ScrobbleSession::*response)(QDomElement);
-	};
-	
-	QList<QueueEl> queue;
+
+	// requests that haven't been sent because there's no session yet
+	QList<Request*> waiting;
+	// the ones that have, by their KIO job or QNetworkReply
+	QHash<QObject*, Request*> active;
 };
 
 Meow::ScrobbleSession::ScrobbleSession(QObject *parent)
 	: QObject(parent)
 {
 	d = new ScrobbleSessionPrivate;
-	d->response=0;
-#ifndef MEOW_WITH_KDE
-	d->currentHttp=0;
-#endif
 }
 
 Meow::ScrobbleSession::~ScrobbleSession()
 {
-#ifndef MEOW_WITH_KDE
-	if (d->currentHttp)
-		d->currentHttp->deleteLater();
-#endif
+	for (QHash<QObject*, Request*>::iterator i = d->active.begin(); i != d->active.end(); ++i)
+	{
+		i.key()->disconnect(this);
+		i.key()->deleteLater();
+		delete *i;
+	}
+	qDeleteAll(d->waiting);
 	delete d;
 }
 
@@ -388,47 +408,52 @@ void Meow::ScrobbleSession::startSession(const QString &username, const QString
 	q["username"]=username;
 	q["authToken"] = md5(username.toUtf8() + passwordMd5.toUtf8());
 
-	makeRequest(false, q, &ScrobbleSession::startSessionRes);
+	makeRequest(false, false, q, &ScrobbleSession::startSessionRes);
 }
 
-void Meow::ScrobbleSession::startSessionRes(QDomElement root)
+void Meow::ScrobbleSession::startSessionRes(const Request &req, QDomElement root)
 {
-	const QString status = root.attribute("status");
-	if (status == "ok")
-	{ }
-	else
+	const Outcome o = outcome(req, root);
+	if (o != Ok)
 	{
-		if (status == "4" || status == "9")
-			handshakeState(HandshakeAuth);
-		else if (status == "26")
-			handshakeState(HandshakeClientBanned);
+		const int code = errorCode(root);
+		if (code == 4 || code == 9)
+			emit handshakeState(HandshakeAuth);
+		else if (code == 26)
+			emit handshakeState(HandshakeClientBanned);
 		else
-			handshakeState(HandshakeFailure);
+			emit handshakeState(HandshakeFailure);
+		return;
 	}
 
-
 	QDomElement se = root.firstChildElement("session");
 	if (se.isNull())
 	{
 		error(root, "error starting session");
+		emit handshakeState(HandshakeFailure);
 		return;
 	}
 	QDomElement key = se.firstChildElement("key");
 	if (key.isNull())
 	{
 		error(root, "bad response");
+		emit handshakeState(HandshakeFailure);
 		return;
 	}
 	d->sessionKey = key.text();
 	emit handshakeState(HandshakeOk);
+
+	const QList<Request*> waiting = d->waiting;
+	d->waiting.clear();
+	for (QList<Request*>::const_iterator i = waiting.begin(); i != waiting.end(); ++i)
+		send(*i);
 }
 
-void Meow::ScrobbleSession::submitTracks(const QList<QStringList> trackKeys)
+void Meow::ScrobbleSession::submitTracks(const QList<QStringList> &trackKeys, qint64 cookie)
 {
 	Query q;
 	q["method"]="track.scrobble";
-	q["sk"] = d->sessionKey;
-	
+
 	unsigned index=0;
 	for (QList<QStringList>::const_iterator i = trackKeys.begin(); i != trackKeys.end(); ++i)
 	{
@@ -440,36 +465,40 @@ void Meow::ScrobbleSession::submitTracks(const QList<QStringList> trackKeys)
 		{
 			QString key = *i;
 			QString val = *++i;
-			q[ key ] = val;
+			q[ key + suffix ] = val;
 			++i;
 		}
+		index++;
 	}
-	
-	makeRequest(true, q, &ScrobbleSession::submitTrackRes);
+
+	makeRequest(true, true, q, &ScrobbleSession::submitTrackRes, cookie);
 }
 
-void Meow::ScrobbleSession::submitTrackRes(QDomElement root)
+void Meow::ScrobbleSession::submitTrackRes(const Request &req, QDomElement root)
 {
-	if (root.tagName() != "lfm")
-	{
-		invalidResponse(root);
-		emit submitCompleted(false);
-		return;
-	}
-	if (root.attribute("status") != "ok")
+	switch (outcome(req, root))
 	{
+	case Ok:
+		emit submitCompleted(req.cookie, SubmitOk);
+		break;
+	case Retry:
+		emit submitCompleted(req.cookie, SubmitRetry);
+		break;
+	case Rejected:
 		error(root, "Error submitting");
-		emit submitCompleted(false);
-		return;
+		emit submitCompleted(req.cookie, SubmitRejected);
+		break;
+	case Refused:
+		error(root, "Refused submitting");
+		emit submitCompleted(req.cookie, SubmitRefused);
+		break;
 	}
-	emit submitCompleted(true);
 }
 
-void Meow::ScrobbleSession::nowPlaying(const QStringList trackKeys)
+void Meow::ScrobbleSession::nowPlaying(const QStringList &trackKeys)
 {
 	Query q;
 	q["method"]="track.updateNowPlaying";
-	q["sk"] = d->sessionKey;
 	for (QStringList::const_iterator i = trackKeys.begin(); i != trackKeys.end(); )
 	{
 		QString key = *i;
@@ -477,18 +506,71 @@ void Meow::ScrobbleSession::nowPlaying(const QStringList trackKeys)
 		q[ key ] = val;
 		++i;
 	}
-	makeRequest(true, q, &ScrobbleSession::nowPlayingRes);
+
+	// only the latest song is worth announcing
+	for (QList<Request*>::iterator i = d->waiting.begin(); i != d->waiting.end(); ++i)
+	{
+		if ((*i)->response == &ScrobbleSession::nowPlayingRes)
+		{
+			(*i)->query = q;
+			return;
+		}
+	}
+	makeRequest(true, true, q, &ScrobbleSession::nowPlayingRes);
+}
+
+void Meow::ScrobbleSession::nowPlayingRes(const Request &req, QDomElement root)
+{
+	// a missed announcement isn't worth retrying
+	outcome(req, root);
+}
+
+int Meow::ScrobbleSession::errorCode(QDomElement root)
+{
+	if (root.isNull())
+		return 0;
+	return root.firstChildElement("error").attribute("code").toInt();
 }
 
-void Meow::ScrobbleSession::nowPlayingRes(QDomElement)
+Meow::ScrobbleSession::Outcome Meow::ScrobbleSession::outcome(const Request &req, QDomElement root)
 {
+	if (req.transportFailed || root.isNull())
+		return Retry;
+	if (root.tagName() != "lfm")
+	{
+		invalidResponse(root);
+		return Retry;
+	}
+	if (root.attribute("status") == "ok")
+		return Ok;
+
+	switch (errorCode(root))
+	{
+	case 9: // invalid session key
+		if (!d->sessionKey.isEmpty())
+		{
+			d->sessionKey.clear();
+			emit sessionExpired();
+		}
+		return Retry;
+	case 8: // operation failed, try again
+	case 11: // service offline
+	case 16: // temporarily unavailable
+	case 29: // rate limit exceeded
+		return Retry;
+	case 6: // invalid parameters, which are the tracks themselves
+		return Rejected;
+	default: // authentication, a bad api key or signature, suspended,
+		// and so on, which is our problem and not the tracks'
+		return Refused;
+	}
 }
 
 void Meow::ScrobbleSession::error(QDomElement root, const QString &e)
 {
 	QDomElement el = root.isNull() ? QDomElement() : root.firstChildElement("error");
 	QString x = el.isNull() ? "unspecified" : el.text();
-	std::cout << "lastfm error: " << e.toUtf8().constData() << ": " << x.toUtf8().constData() << std::endl;
+	std::cerr << "lastfm error: " << e.toUtf8().constData() << ": " << x.toUtf8().constData() << std::endl;
 }
 
 void Meow::ScrobbleSession::invalidResponse(QDomElement root)
@@ -496,29 +578,38 @@ void Meow::ScrobbleSession::invalidResponse(QDomElement root)
 	error(root, i18n("Invalid response from last.fm"));
 }
 
-void Meow::ScrobbleSession::makeRequest(bool post, Query &query, void (ScrobbleSession::*response)(QDomElement))
+void Meow::ScrobbleSession::makeRequest(
+		bool post, bool needsSession, const Query &query,
+		void (ScrobbleSession::*response)(const Request &, QDomElement),
+		qint64 cookie
+	)
 {
-	if (d->sessionKey.isEmpty())
-		return;
-	if (d->response)
-	{
-		ScrobbleSessionPrivate::QueueEl ql;
-		ql.post = post;
-		ql.query = query;
-		ql.response = response;
-		d->queue.append(ql);
-		return;
-	}
-	d->response = response;
-	
-#ifdef MEOW_WITH_KDE
-	KUrl url(handshakeUrl);
-#else
-	QUrl url(handshakeUrl);
-#endif
+	Request *const req = new Request;
+	req->post = post;
+	req->needsSession = needsSession;
+	req->query = query;
+	req->response = response;
+	req->cookie = cookie;
+	req->transportFailed = false;
+
+	if (needsSession && d->sessionKey.isEmpty())
+		d->waiting.append(req);
+	else
+		send(req);
+}
 
+void Meow::ScrobbleSession::send(Request *req)
+{
+	Query query = req->query;
 	query["api_key"]=apiKey;
+	if (req->needsSession)
+		query["sk"] = d->sessionKey;
 
+#ifdef MEOW_WITH_KDE
+	KUrl url(endpoint());
+#else
+	QUrl url(endpoint());
+#endif
 
 	QString callsig;
 
@@ -527,89 +618,101 @@ void Meow::ScrobbleSession::makeRequest(bool post, Query &query, void (ScrobbleS
 		url.addQueryItem(i.key(), i.value());
 		callsig += i.key() + i.value();
 	}
-	
+
 	callsig += sharedSecret;
 	callsig = md5(callsig.toUtf8());
-	
+
 	url.addQueryItem("api_sig", callsig);
 
-	d->recievedData.clear();
-	
 	QByteArray posted;
-	if (post)
+	if (req->post)
 	{
 		posted = url.encodedQuery();
-		url = QUrl(handshakeUrl);
+		url = QUrl(endpoint());
 	}
-	
-	std::cout << "Posting: " << posted.constData() << std::endl;
-	
+
 #ifdef MEOW_WITH_KDE
 	KIO::TransferJob *job = KIO::http_post(url, posted, KIO::HideProgressInfo);
 	job->addMetaData( "content-type", "Content-type: application/x-www-form-urlencoded" );
 	job->addMetaData( "accept", "" );
 	job->addMetaData( "UserAgent", "User-Agent: " + userAgent());
-	connect(job, SIGNAL(data(KIO::Job*, QByteArray)), SLOT(handshakeData(KIO::Job*, QByteArray)));
-	connect(job, SIGNAL(result(KJob*)), SLOT(slotHandshakeResult()));
+	connect(job, SIGNAL(data(KIO::Job*, QByteArray)), SLOT(requestData(KIO::Job*, QByteArray)));
+	connect(job, SIGNAL(result(KJob*)), SLOT(requestFinished(KJob*)));
+	d->active.insert(job, req);
 
 #else
 
-	QNetworkRequest req(url);
-	
-	d->postedData = posted;
-	d->postedBuffer.setBuffer(&d->postedData);
-
-	req.setRawHeader( "User-Agent", userAgent().toUtf8());
-	req.setRawHeader( "Content-type", "application/x-www-form-urlencoded");
-	req.setRawHeader( "accept", "");
-	d->currentHttp = d->networkAccess.post(req, &d->postedBuffer);
-	connect(d->currentHttp, SIGNAL(readyRead()), SLOT(handshakeData()));
-	connect(d->currentHttp, SIGNAL(finished()), SLOT(slotHandshakeResult()));
+	QNetworkRequest nr(url);
+
+	req->posted = posted;
+	req->postedBuffer.setBuffer(&req->posted);
+
+	nr.setRawHeader( "User-Agent", userAgent().toUtf8());
+	nr.setRawHeader( "Content-type", "application/x-www-form-urlencoded");
+	nr.setRawHeader( "accept", "");
+	QNetworkReply *const reply = d->networkAccess.post(nr, &req->postedBuffer);
+	connect(reply, SIGNAL(readyRead()), SLOT(requestData()));
+	connect(reply, SIGNAL(finished()), SLOT(requestFinished()));
+	d->active.insert(reply, req);
 #endif
 }
 
 #ifdef MEOW_WITH_KDE
-void Meow::ScrobbleSession::handshakeData(KIO::Job*, const QByteArray &data)
+void Meow::ScrobbleSession::requestData(KIO::Job *job, const QByteArray &data)
+{
+	if (Request *const req = d->active.value(job))
+		req->received += data;
+}
+
+void Meow::ScrobbleSession::requestFinished(KJob *job)
 {
-	d->recievedData += data;
+	Request *const req = d->active.take(job);
+	if (!req)
+		return;
+	KIO::TransferJob *const tj = static_cast<KIO::TransferJob*>(job);
+	req->transportFailed = job->error() != 0
+		|| tj->queryMetaData("responsecode").toInt() >= 500;
+	finished(req);
 }
 
 #else
-void Meow::ScrobbleSession::handshakeData()
+void Meow::ScrobbleSession::requestData()
 {
-	d->recievedData += d->currentHttp->readAll();
+	QNetworkReply *const reply = static_cast<QNetworkReply*>(sender());
+	if (Request *const req = d->active.value(reply))
+		req->received += reply->readAll();
 }
-#endif
 
-void Meow::ScrobbleSession::slotHandshakeResult()
+void Meow::ScrobbleSession::requestFinished()
 {
-#ifndef MEOW_WITH_KDE
-	if (d->currentHttp)
-	{
-		d->currentHttp->deleteLater();
-		d->currentHttp=0;
-	}
+	QNetworkReply *const reply = static_cast<QNetworkReply*>(sender());
+	Request *const req = d->active.take(reply);
+	reply->deleteLater();
+	if (!req)
+		return;
+	req->received += reply->readAll();
+	// last.fm's own errors come with a 4xx and an explanation
+	const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	req->transportFailed = status == 0 || status >= 500;
+	finished(req);
+}
 #endif
 
+void Meow::ScrobbleSession::finished(Request *req)
+{
 	QDomDocument doc;
-	doc.setContent(d->recievedData);
-	QDomElement root = doc.documentElement();
-	if (root.isNull())
-		;
-	else if (root.tagName() != "lfm")
-	{
-		invalidResponse(root);
-	}
-	(this->*d->response)(root);
-	d->response=0;
-	if (!d->queue.isEmpty())
-	{
-		ScrobbleSessionPrivate::QueueEl el = d->queue.takeFirst();
-		makeRequest(el.post, el.query, el.response);
-	}
+	doc.setContent(req->received);
+	(this->*req->response)(*req, doc.documentElement());
+	delete req;
 }
 
 
+// how many batches of plays can be waiting for last.fm at once
+static const int maxBatchesSubmitting = 4;
+// in msec, how long to wait after the first failure, and at most
+static const int retryDelay = 15*1000;
+static const int maxRetryDelay = 30*60*1000;
+
 struct Meow::Scrobble::ScrobblePrivate
 {
 	Player *player;
@@ -621,10 +724,22 @@ struct Meow::Scrobble::ScrobblePrivate
 	MeowUrlType nowPlaying;
 	MeowUrlType submission;
 	
-	int numTracksSubmitting;
-	bool failureSubmitting;
+	// the ids of the first and last play in each batch being
+	// submitted, by the cookie it was submitted with
+	QMap<qint64, QPair<qint64, qint64> > submitting;
+	qint64 lastCookie;
+	// the last play that's been handed to the session
+	qint64 submittedThrough;
+	// a batch failed, so once the others are answered, the
+	// plays are submitted again from the oldest
+	bool rewind;
+	// failures in a row, and if we're waiting because of them
+	int failures;
+	bool backingOff;
+	// last.fm won't take anything until we log in again
+	bool refused;
+	std::mt19937 random;
 	
-	QList<QStringList > submissionQueue;
 	File currentlyPlaying;
 	time_t startedPlayingLast, beginDurationOfPlayback, pausedPlayingLast;
 	int lengthOfLastSong;
@@ -641,11 +756,20 @@ Meow::Scrobble::Scrobble(QWidget *parent, Player *player, Collection *collection
 	d->player = player;
 	d->collection = collection;
 	d->isEnabled = false;
-	d->numTracksSubmitting = 0;
-	d->failureSubmitting = false;
+	d->lastCookie = 0;
+	d->submittedThrough = 0;
+	d->rewind = false;
+	d->failures = 0;
+	d->backingOff = false;
+	d->refused = false;
+	d->random.seed(std::random_device()());
 
 	d->session = new ScrobbleSession(this);
-	connect(d->session, SIGNAL(submitCompleted(bool)), SLOT(submitCompleted(bool)));
+	connect(
+			d->session, SIGNAL(submitCompleted(qint64, ScrobbleSession::SubmitResult)),
+			SLOT(submitCompleted(qint64, ScrobbleSession::SubmitResult))
+		);
+	connect(d->session, SIGNAL(sessionExpired()), SLOT(begin()));
 
 #ifdef MEOW_WITH_KDE
 	KConfigGroup conf = KGlobal::config()->group("audioscrobbler");
@@ -702,68 +826,55 @@ Meow::Scrobble::Scrobble(QWidget *parent, Player *player, Collection *collection
 	connect(d->player, SIGNAL(playing()), SLOT(startCountingTimeAgain()));
 	connect(d->player, SIGNAL(paused()), SLOT(stopCountingTime()));
 	
-	int index=0;
+	// the queue is in the collection, so there's nothing to
+	// send until one is open
+	connect(d->collection, SIGNAL(loaded()), SLOT(collectionLoaded()));
+}
+
+Meow::Scrobble::~Scrobble()
+{
 #ifdef MEOW_WITH_KDE
-	while (conf.hasKey("qi" + QString::number(index)))
-	{
-		QStringList s = conf.readEntry<QStringList>("qi" + QString::number(index), QStringList());
-		if ( s.count()!=0 && (s.count() % 2) == 0)
-			d->submissionQueue += s;
-		index++;
-	}
+	KConfigGroup conf = KGlobal::config()->group("audioscrobbler");
+	conf.writeEntry<bool>("enabled", d->isEnabled);
 #else
-	while (conf.contains("qi" + QString::number(index)))
-	{
-		QStringList s = conf.value("qi" + QString::number(index), QStringList()).toStringList();
-		if ( s.count()!=0 && (s.count() % 2) == 0)
-			d->submissionQueue += s;
-		index++;
-	}
+	QSettings conf;
+	conf.setValue("audioscrobbler/enabled", d->isEnabled);
 #endif
 
+	delete d;
 }
 
-Meow::Scrobble::~Scrobble()
+void Meow::Scrobble::collectionLoaded()
 {
+	// versions before the queue was in the collection kept it in
+	// the config file, as "qi0", "qi1", etc. It's moved over once
 #ifdef MEOW_WITH_KDE
 	KConfigGroup conf = KGlobal::config()->group("audioscrobbler");
-	conf.writeEntry<bool>("enabled", d->isEnabled);
-	
-	int index=0;
-	for (
-			QList<QStringList>::iterator i = d->submissionQueue.begin();
-			i != d->submissionQueue.end(); ++i
-		)
-	{
-		conf.writeEntry("qi" + QString::number(index), *i);
-		index++;
-	}
-	while (conf.hasKey("qi" + QString::number(index)))
+	for (int index=0; conf.hasKey("qi" + QString::number(index)); index++)
 	{
-		conf.deleteEntry("qi" + QString::number(index));
-		index++;
+		const QString key = "qi" + QString::number(index);
+		const QStringList s = conf.readEntry<QStringList>(key, QStringList());
+		if ( s.count()!=0 && (s.count() % 2) == 0)
+			d->collection->queueScrobble(s);
+		conf.deleteEntry(key);
 	}
 #else
 	QSettings conf;
-	conf.setValue("audioscrobbler/enabled", d->isEnabled);
-	
-	int index=0;
-	for (
-			QList<QStringList>::iterator i = d->submissionQueue.begin();
-			i != d->submissionQueue.end(); ++i
-		)
+	for (int index=0; conf.contains("audioscrobbler/qi" + QString::number(index)); index++)
 	{
-		conf.setValue("audioscrobbler/qi" + QString::number(index), *i);
-		index++;
-	}
-	while (conf.contains("audioscrobbler/qi" + QString::number(index)))
-	{
-		conf.remove("audioscrobbler/qi" + QString::number(index));
-		index++;
+		const QString key = "audioscrobbler/qi" + QString::number(index);
+		const QStringList s = conf.value(key, QStringList()).toStringList();
+		if ( s.count()!=0 && (s.count() % 2) == 0)
+			d->collection->queueScrobble(s);
+		conf.remove(key);
 	}
 #endif
 
-	delete d;
+	// the answers for batches from the last collection are ignored
+	d->submitting.clear();
+	d->submittedThrough = 0;
+	d->rewind = false;
+	sendSubmissions();
 }
 
 bool Meow::Scrobble::isEnabled() const
@@ -801,6 +912,13 @@ void Meow::Scrobble::begin()
 {
 	if (!d->username.isEmpty())
 		d->session->startSession(d->username, d->passwordMd5);
+
+	// maybe the login's been fixed
+	if (d->refused)
+	{
+		d->refused = false;
+		sendSubmissions();
+	}
 }
 
 void Meow::Scrobble::currentItemChanged(const File &file)
@@ -818,6 +936,8 @@ void Meow::Scrobble::currentItemChanged(const File &file)
 		std::cerr << "No previous song to submit" << std::endl;
 	
 	d->currentlyPlaying = file;
+	if (file.length())
+		d->lengthOfLastSong = file.length()/1000;
 	d->startedPlayingLast = QDateTime::currentDateTime().toTime_t();
 	d->beginDurationOfPlayback = d->startedPlayingLast;
 	stopCountingTime(); // I'm going to get d->playing() right away
@@ -833,37 +953,81 @@ void Meow::Scrobble::announceNowPlaying()
 
 void Meow::Scrobble::sendSubmissions()
 {
-	if (d->numTracksSubmitting > 0 || d->failureSubmitting)
-		return;
-	if (d->submissionQueue.count() == 0)
+	if (d->backingOff || d->refused)
 		return;
+	if (d->rewind)
+	{
+		if (!d->submitting.isEmpty())
+			return;
+		d->submittedThrough = 0;
+		d->rewind = false;
+	}
 
-	QList<QStringList> toSubmit = d->submissionQueue.mid(0, 50);
-	d->numTracksSubmitting = toSubmit.length();
-	
-	d->session->submitTracks(toSubmit);
+	while (d->submitting.size() < maxBatchesSubmitting)
+	{
+		// last.fm takes at most 50 at a time
+		const QList<Collection::QueuedScrobble> queued
+			= d->collection->queuedScrobbles(d->submittedThrough, 50);
+		if (queued.isEmpty())
+			return;
+
+		QList<QStringList> toSubmit;
+		for (int i=0; i < queued.size(); i++)
+			toSubmit.append(queued[i].keys);
+
+		const qint64 cookie = ++d->lastCookie;
+		d->submitting.insert(cookie, qMakePair(queued.first().id, queued.last().id));
+		d->submittedThrough = queued.last().id;
+		d->session->submitTracks(toSubmit, cookie);
+	}
 }
 
 void Meow::Scrobble::sendSubmissionsRetry()
 {
-	d->failureSubmitting = false;
+	d->backingOff = false;
 	sendSubmissions();
 }
 
-void Meow::Scrobble::submitCompleted(bool success)
+void Meow::Scrobble::submitCompleted(qint64 cookie, ScrobbleSession::SubmitResult result)
 {
-	if (success)
+	QMap<qint64, QPair<qint64, qint64> >::iterator batch = d->submitting.find(cookie);
+	if (batch == d->submitting.end())
+		return;
+	const QPair<qint64, qint64> ids = *batch;
+	d->submitting.erase(batch);
+
+	if (result == ScrobbleSession::SubmitRetry)
 	{
-		for (; d->numTracksSubmitting; d->numTracksSubmitting--)
-			d->submissionQueue.removeFirst();
-		QTimer::singleShot(10*1000, this, SLOT(sendSubmissions()));
+		d->rewind = true;
+		if (!d->backingOff)
+		{
+			// twice as long each time up to half an hour, and somewhere
+			// in the second half of that so that everyone who was
+			// cut off at once doesn't come back at once
+			const int ceiling = qMin(retryDelay << qMin(d->failures, 7), maxRetryDelay);
+			std::uniform_int_distribution<int> jitter(ceiling/2, ceiling);
+			d->failures++;
+			d->backingOff = true;
+			QTimer::singleShot(jitter(d->random), this, SLOT(sendSubmissionsRetry()));
+		}
+		return;
 	}
-	else
-	{
-		d->numTracksSubmitting = 0;
-		d->failureSubmitting = true;
-		QTimer::singleShot(240*1000, this, SLOT(sendSubmissionsRetry()));
+
+	if (result == ScrobbleSession::SubmitRefused)
+	{ // they're kept, and nothing more is sent until begin()
+		if (!d->refused)
+			std::cerr << "last.fm refused plays, keeping them until the next login" << std::endl;
+		d->refused = true;
+		d->rewind = true;
+		return;
 	}
+
+	if (result == ScrobbleSession::SubmitRejected)
+		std::cerr << "last.fm rejected " << (ids.second-ids.first+1) << " plays, dropping them" << std::endl;
+	else
+		d->failures = 0;
+	d->collection->dequeueScrobbles(ids.first, ids.second);
+	sendSubmissions();
 }
 
 QStringList Meow::Scrobble::trackInfo(File f)
@@ -873,7 +1037,7 @@ QStringList Meow::Scrobble::trackInfo(File f)
 		<< "album" << f.album()
 		<< "track" << f.title()
 		<< "artist" << f.artist()
-		<< "duration" << QString::number(d->lengthOfLastSong)
+		<< "duration" << QString::number(f.length() ? int(f.length()/1000) : d->lengthOfLastSong)
 		<< "trackNumber" << f.track();
 	return variables;
 }
@@ -890,7 +1054,7 @@ void Meow::Scrobble::lastSongFinishedPlaying()
 		QList<QString> variables = trackInfo(f);
 		variables << "timestamp" << QString::number((int)now);
 
-		d->submissionQueue.append(variables);
+		d->collection->queueScrobble(variables);
 		sendSubmissions();
 	}
 	else
@@ -8,6 +8,7 @@
 class QDomDocument;
 class QDomElement;
 
+class KJob;
 namespace KIO
 {
 class Job;
@@ -20,11 +21,17 @@ class Player;
 class File;
 class Collection;
 
+/**
+ * Talks to last.fm. Requests are sent as soon as they're made,
+ * several at a time, except that the ones that need a session wait
+ * for @ref startSession to get one
+ **/
 class ScrobbleSession : public QObject
 {
 	Q_OBJECT
 
 	struct ScrobbleSessionPrivate;
+	struct Request;
 	ScrobbleSessionPrivate *d;
 	typedef QMap<QString,QString> Query;
 	
@@ -36,36 +43,79 @@ public:
 		HandshakeAuth,
 		HandshakeFailure
 	};
+	
+	enum SubmitResult
+	{
+		SubmitOk,
+		/**
+		 * the network or last.fm had a problem, try again later
+		 **/
+		SubmitRetry,
+		/**
+		 * last.fm won't take these tracks, sending them
+		 * again won't help
+		 **/
+		SubmitRejected,
+		/**
+		 * last.fm won't take anything from us, because of the
+		 * login, the api key or the like, but the tracks may
+		 * be fine once that's sorted out
+		 **/
+		SubmitRefused
+	};
 
 	ScrobbleSession(QObject *parent);
 	~ScrobbleSession();
 
 	void startSession(const QString &username, const QString &passwordMd5);
-	void submitTracks(const QList<QStringList> trackKeys);
-	void nowPlaying(const QStringList trackKeys);
+	/**
+	 * @ref submitCompleted is emitted with @p cookie when
+	 * last.fm has answered
+	 **/
+	void submitTracks(const QList<QStringList> &trackKeys, qint64 cookie);
+	/**
+	 * if an earlier one is still waiting for the session,
+	 * this replaces it
+	 **/
+	void nowPlaying(const QStringList &trackKeys);
 	
 signals:
-	void submitCompleted(bool success);
+	void submitCompleted(qint64 cookie, ScrobbleSession::SubmitResult result);
 	void handshakeState(ScrobbleSession::HandshakeState error);
+	/**
+	 * last.fm doesn't take the session key anymore, the
+	 * requests will wait for @ref startSession again
+	 **/
+	void sessionExpired();
 	
 private:
-	void startSessionRes(QDomElement root);
-	void submitTrackRes(QDomElement root);
-	void nowPlayingRes(QDomElement root);
+	enum Outcome { Ok, Retry, Rejected, Refused };
+	Outcome outcome(const Request &req, QDomElement root);
+	static int errorCode(QDomElement root);
+
+	void startSessionRes(const Request &req, QDomElement root);
+	void submitTrackRes(const Request &req, QDomElement root);
+	void nowPlayingRes(const Request &req, QDomElement root);
 
 	void error(QDomElement root, const QString &e);
 	void invalidResponse(QDomElement root);
 	
 private:
-	void makeRequest(bool post, Query &query, void (ScrobbleSession::*response)(QDomElement));
+	void makeRequest(
+			bool post, bool needsSession, const Query &query,
+			void (ScrobbleSession::*response)(const Request &, QDomElement),
+			qint64 cookie=0
+		);
+	void send(Request *req);
+	void finished(Request *req);
 
 private slots:
 #ifdef MEOW_WITH_KDE
-	void handshakeData(KIO::Job*, const QByteArray &data);
-	void slotHandshakeResult();
+	void requestData(KIO::Job *job, const QByteArray &data);
+	void requestFinished(KJob *job);
 #else
-	void handshakeData();
-	void slotHandshakeResult();
+	void requestData();
+	void requestFinished();
 #endif
 };
 
@@ -96,11 +146,12 @@ public slots:
 	void begin();
 	
 private slots:
+	void collectionLoaded();
 	void currentItemChanged(const File &file);
 	void announceNowPlaying();
 	void sendSubmissions();
 	void sendSubmissionsRetry();
-	void submitCompleted(bool success);
+	void submitCompleted(qint64 cookie, ScrobbleSession::SubmitResult result);
 
 	void lastSongFinishedPlaying();
 	void stopCountingTime();
@@ -0,0 +1,1265 @@
+#include "treemodel.h"
+#include <db/collection.h>
+
+#include <qhash.h>
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace
+{
+using Meow::TreeModel;
+
+// a node is its type in the top two bits, and its slot
+const int typeShift = 30;
+const quint32 slotMask = (1u << typeShift) - 1;
+// the parent of the top-level nodes
+const quint32 rootNode = 0;
+
+inline quint32 makeNode(TreeModel::NodeType type, int slot)
+{
+	return (quint32(type) << typeShift) | quint32(slot);
+}
+inline TreeModel::NodeType typeOf(quint32 node)
+{
+	return TreeModel::NodeType(node >> typeShift);
+}
+inline int slotOf(quint32 node)
+{
+	return int(node & slotMask);
+}
+
+// an album's songs are only shown to the views once it's
+// Materialized, and only Sorted once they're needed in order
+enum { AutoExpandedFlag=1, HiddenFlag=2, MaterializedFlag=4, SortedFlag=8 };
+
+// how many songs can be in materialized albums before
+// TreeModel::reclaim puts them back
+const int materializedBudget = 5000;
+
+template<typename T>
+inline size_t bytesOf(const QVector<T> &v)
+{
+	return sizeof(v) + v.capacity()*sizeof(T);
+}
+inline size_t keyBytes(const QByteArray &key)
+{
+	if (key.isNull())
+		return 0;
+	return sizeof(int)*4 + key.capacity()+1;
+}
+template<typename K, typename V>
+inline size_t bytesOf(const QHash<K, V> &h)
+{
+	// the buckets, and a node for each entry
+	return sizeof(h) + h.capacity()*sizeof(void*)
+		+ h.size()*(sizeof(void*)+sizeof(uint)+sizeof(K)+sizeof(V));
+}
+
+/**
+ * A weight for each slot, and a Fenwick tree of their sums so that
+ * changing one and finding the slot at a given running total are
+ * both O(log n). Free slots have a weight of 0
+ **/
+class WeightIndex
+{
+	QVector<quint32> mWeights;
+	// mSums[i] is the sum of the weights from i-(i&-i) to i-1
+	QVector<quint64> mSums;
+	quint64 mTotal;
+
+public:
+	WeightIndex() : mTotal(0)
+	{
+		mSums.append(0);
+	}
+
+	quint64 total() const { return mTotal; }
+	quint32 weight(int slot) const { return mWeights[slot]; }
+
+	// make room for one more slot, at weight 0
+	void grow()
+	{
+		const int i = mSums.size();
+		// what the new cell covers is all already there
+		mSums.append(prefix(i-1) - prefix(i - (i&-i)));
+		mWeights.append(0);
+	}
+
+	void set(int slot, quint32 weight)
+	{
+		const qint64 delta = qint64(weight) - qint64(mWeights[slot]);
+		if (delta == 0)
+			return;
+		mWeights[slot] = weight;
+		mTotal += delta;
+		for (int i=slot+1; i < mSums.size(); i += i&-i)
+			mSums[i] += delta;
+	}
+
+	/**
+	 * the slot whose share of the total includes @p at,
+	 * which must be less than total()
+	 **/
+	int find(quint64 at) const
+	{
+		const int size = mSums.size()-1;
+		int step=1;
+		while (step*2 <= size)
+			step *= 2;
+
+		int pos=0;
+		for (; step; step /= 2)
+		{
+			if (pos+step <= size && mSums[pos+step] <= at)
+			{
+				pos += step;
+				at -= mSums[pos];
+			}
+		}
+		return pos;
+	}
+
+	size_t memoryUsed() const
+	{
+		return bytesOf(mWeights) + bytesOf(mSums);
+	}
+
+private:
+	// the sum of the first @p n weights
+	quint64 prefix(int n) const
+	{
+		quint64 sum=0;
+		for (; n > 0; n -= n&-n)
+			sum += mSums[n];
+		return sum;
+	}
+};
+
+}
+
+// memcmp order, which is how sortKey's keys go
+static inline bool keyLess(const QByteArray &a, const QByteArray &b)
+{
+	const int c = memcmp(a.constData(), b.constData(), qMin(a.length(), b.length()));
+	return c < 0 || (c == 0 && a.length() < b.length());
+}
+
+// the key we got from the database, unless it didn't have one
+static inline QByteArray keyFor(const QByteArray &stored, const QString &label)
+{
+	if (stored.isEmpty())
+		return Meow::sortKey(label);
+	return stored;
+}
+
+
+struct Meow::TreeModel::Private
+{
+	// every label, once
+	QVector<QString> strings;
+	QVector<int> stringRefs;
+	QVector<int> freeStrings;
+	QHash<QString, int> stringIndex;
+
+	// the artists and albums, by slot
+	QVector<int> branchLabel;
+	QVector<QByteArray> branchKey;
+	QVector<int> branchParent; // the artist's slot, or -1
+	QVector<int> branchRow;
+	QVector<int> branchSongs;
+	QVector<quint8> branchFlags;
+	QVector<QVector<quint32> > branchChildren;
+	// the albums in each artist, by key
+	QVector<QHash<QByteArray, quint32> > branchIndex;
+	QVector<int> freeBranches;
+
+	// the songs, by slot
+	QVector<FileId> songFile;
+	QVector<int> songLabel;
+	QVector<QByteArray> songKey;
+	QVector<int> songParent; // the album's slot
+	QVector<int> songRow;
+	QVector<quint8> songFlags;
+	QVector<int> freeSongs;
+	QHash<FileId, int> songSlots;
+	// the highest id that's been added, even if it's gone since
+	FileId largestFile;
+	// in addFiles, where the views are told about it all at once
+	bool batching;
+	// also in addFiles: the nodes that are waiting to go in each
+	// branch, so that each run of them can be told about at once,
+	// and which of the branches are new themselves
+	bool deferring;
+	QHash<quint32, QVector<quint32> > deferred;
+	QSet<quint32> deferredBranches;
+	// the songs in albums that have been materialized
+	int materializedSongs;
+
+	TreeModel *const q;
+
+	Private(TreeModel *q)
+		: largestFile(0), batching(false), deferring(false),
+			materializedSongs(0), q(q)
+	{ }
+
+	bool isMaterialized(quint32 album) const
+	{
+		return branchFlags[slotOf(album)] & MaterializedFlag;
+	}
+	bool isSorted(quint32 album) const
+	{
+		return branchFlags[slotOf(album)] & SortedFlag;
+	}
+	// can the views know about this node
+	bool isShown(quint32 node) const
+	{
+		if (typeOf(node) != SongNode)
+			return true;
+		return branchFlags[songParent[slotOf(node)]] & MaterializedFlag;
+	}
+	int materializedUnder(quint32 node) const
+	{
+		if (typeOf(node) == SongNode)
+			return 0;
+		if (typeOf(node) == AlbumNode)
+			return isMaterialized(node) ? branchChildren[slotOf(node)].size() : 0;
+		int songs=0;
+		const QVector<quint32> &children = branchChildren[slotOf(node)];
+		for (int i=0; i < children.size(); i++)
+			songs += materializedUnder(children[i]);
+		return songs;
+	}
+
+	QVector<quint32> topLevel;
+	QHash<QByteArray, quint32> topLevelArtists, topLevelAlbums;
+
+	// for picking at random: songs, albums and top-level branches
+	WeightIndex songWeights, albumWeights, topLevelWeights;
+
+	WeightIndex &weightsFor(NodeType type)
+	{
+		if (type == SongNode)
+			return songWeights;
+		if (type == AlbumNode)
+			return albumWeights;
+		return topLevelWeights;
+	}
+
+	int intern(const QString &s)
+	{
+		QHash<QString, int>::const_iterator i = stringIndex.constFind(s);
+		if (i != stringIndex.constEnd())
+		{
+			stringRefs[*i]++;
+			return *i;
+		}
+
+		int at;
+		if (!freeStrings.isEmpty())
+		{
+			at = freeStrings.last();
+			freeStrings.pop_back();
+			strings[at] = s;
+			stringRefs[at] = 1;
+		}
+		else
+		{
+			at = strings.size();
+			strings.append(s);
+			stringRefs.append(1);
+		}
+		stringIndex.insert(s, at);
+		return at;
+	}
+
+	void release(int string)
+	{
+		if (--stringRefs[string])
+			return;
+		stringIndex.remove(strings[string]);
+		strings[string] = QString();
+		freeStrings.append(string);
+	}
+
+	const QString &label(quint32 node) const
+	{
+		const int slot = slotOf(node);
+		if (typeOf(node) == SongNode)
+			return strings[songLabel[slot]];
+		return strings[branchLabel[slot]];
+	}
+
+	const QByteArray &key(quint32 node) const
+	{
+		if (typeOf(node) == SongNode)
+			return songKey[slotOf(node)];
+		return branchKey[slotOf(node)];
+	}
+
+	quint8 &flags(quint32 node)
+	{
+		if (typeOf(node) == SongNode)
+			return songFlags[slotOf(node)];
+		return branchFlags[slotOf(node)];
+	}
+	quint8 flags(quint32 node) const
+	{
+		if (typeOf(node) == SongNode)
+			return songFlags[slotOf(node)];
+		return branchFlags[slotOf(node)];
+	}
+
+	quint32 parentOf(quint32 node) const
+	{
+		const int slot = slotOf(node);
+		if (typeOf(node) == SongNode)
+			return makeNode(AlbumNode, songParent[slot]);
+		if (typeOf(node) == AlbumNode && branchParent[slot] != -1)
+			return makeNode(ArtistNode, branchParent[slot]);
+		return rootNode;
+	}
+
+	int rowOf(quint32 node) const
+	{
+		if (typeOf(node) == SongNode)
+			return songRow[slotOf(node)];
+		return branchRow[slotOf(node)];
+	}
+
+	void setPosition(quint32 node, quint32 parent, int row)
+	{
+		const int slot = slotOf(node);
+		if (typeOf(node) == SongNode)
+		{
+			songParent[slot] = slotOf(parent);
+			songRow[slot] = row;
+		}
+		else
+		{
+			branchParent[slot] = parent == rootNode ? -1 : slotOf(parent);
+			branchRow[slot] = row;
+		}
+	}
+
+	QVector<quint32> &childrenOf(quint32 node)
+	{
+		if (node == rootNode)
+			return topLevel;
+		return branchChildren[slotOf(node)];
+	}
+	const QVector<quint32> &childrenOf(quint32 node) const
+	{
+		if (node == rootNode)
+			return topLevel;
+		return branchChildren[slotOf(node)];
+	}
+
+	// where fold looks for a @p type in @p parent
+	QHash<QByteArray, quint32> &foldIndex(quint32 parent, NodeType type)
+	{
+		if (parent != rootNode)
+			return branchIndex[slotOf(parent)];
+		return type == ArtistNode ? topLevelArtists : topLevelAlbums;
+	}
+
+	int songsIn(quint32 node) const
+	{
+		if (node == rootNode)
+			return songSlots.size();
+		if (typeOf(node) == SongNode)
+			return 1;
+		return branchSongs[slotOf(node)];
+	}
+
+	int newBranch(const QString &label, const QByteArray &key)
+	{
+		int slot;
+		if (!freeBranches.isEmpty())
+		{
+			slot = freeBranches.last();
+			freeBranches.pop_back();
+		}
+		else
+		{
+			slot = branchLabel.size();
+			branchLabel.append(-1);
+			branchKey.append(QByteArray());
+			branchParent.append(-1);
+			branchRow.append(0);
+			branchSongs.append(0);
+			branchFlags.append(0);
+			branchChildren.append(QVector<quint32>());
+			branchIndex.append(QHash<QByteArray, quint32>());
+			albumWeights.grow();
+			topLevelWeights.grow();
+		}
+		branchLabel[slot] = intern(label);
+		branchKey[slot] = key;
+		branchParent[slot] = -1;
+		branchRow[slot] = 0;
+		branchSongs[slot] = 0;
+		branchFlags[slot] = 0;
+		return slot;
+	}
+
+	int newSong(FileId id)
+	{
+		int slot;
+		if (!freeSongs.isEmpty())
+		{
+			slot = freeSongs.last();
+			freeSongs.pop_back();
+		}
+		else
+		{
+			slot = songFile.size();
+			songFile.append(0);
+			songLabel.append(-1);
+			songKey.append(QByteArray());
+			songParent.append(0);
+			songRow.append(0);
+			songFlags.append(0);
+			songWeights.grow();
+		}
+		songFile[slot] = id;
+		songLabel[slot] = -1;
+		songFlags[slot] = 0;
+		songSlots.insert(id, slot);
+		songWeights.set(slot, 1);
+		if (id > largestFile)
+			largestFile = id;
+		return slot;
+	}
+
+	// forget this node and everything under it, it must
+	// not be in the tree anymore
+	void freeNode(quint32 node)
+	{
+		const int slot = slotOf(node);
+		if (typeOf(node) == SongNode)
+		{
+			release(songLabel[slot]);
+			songSlots.remove(songFile[slot]);
+			songFile[slot] = 0;
+			songKey[slot] = QByteArray();
+			songWeights.set(slot, 0);
+			freeSongs.append(slot);
+		}
+		else
+		{
+			QVector<quint32> &children = branchChildren[slot];
+			for (int i=0; i < children.size(); i++)
+				freeNode(children[i]);
+			children = QVector<quint32>();
+			branchIndex[slot] = QHash<QByteArray, quint32>();
+			branchKey[slot] = QByteArray();
+			albumWeights.set(slot, 0);
+			topLevelWeights.set(slot, 0);
+			release(branchLabel[slot]);
+			freeBranches.append(slot);
+		}
+	}
+
+	void songsUnder(quint32 node, std::vector<FileId> &files) const
+	{
+		if (typeOf(node) == SongNode)
+		{
+			files.push_back(songFile[slotOf(node)]);
+			return;
+		}
+		const QVector<quint32> &children = childrenOf(node);
+		for (int i=0; i < children.size(); i++)
+			songsUnder(children[i], files);
+	}
+
+	int sortedPosition(quint32 parent, const QByteArray &childKey) const
+	{
+		const QVector<quint32> &children = childrenOf(parent);
+		if (typeOf(parent) == AlbumNode && !isSorted(parent))
+			return children.size(); // sorted when it's needed
+		int upper=children.size();
+		int lower=0;
+		while (upper!=lower)
+		{ // a binary search
+			int i = lower+(upper-lower)/2;
+			if (keyLess(key(children[i]), childKey))
+				lower = i+1;
+			else
+				upper = i;
+		}
+		return lower;
+	}
+
+	void setHidden(quint32 node, bool hidden, QVector<quint32> &changed)
+	{
+		quint8 &f = flags(node);
+		if (!!(f & HiddenFlag) == hidden)
+			return;
+		f ^= HiddenFlag;
+		changed.append(node);
+	}
+
+	bool filterSongs(quint32 node, const QSet<FileId> *matches, QVector<quint32> &changed)
+	{
+		bool visible;
+		if (typeOf(node) == SongNode)
+			visible = !matches || matches->contains(songFile[slotOf(node)]);
+		else
+		{
+			visible = false;
+			const QVector<quint32> &children = branchChildren[slotOf(node)];
+			for (int i=0; i < children.size(); i++)
+				visible = filterSongs(children[i], matches, changed) || visible;
+		}
+		setHidden(node, !visible, changed);
+		return visible;
+	}
+
+	bool filterLabels(quint32 node, const QString &text, QVector<quint32> &changed)
+	{
+		if (text.isEmpty() || label(node).contains(text, Qt::CaseInsensitive))
+			return filterSongs(node, 0, changed);
+
+		bool has = false;
+		if (typeOf(node) != SongNode)
+		{
+			const QVector<quint32> &children = branchChildren[slotOf(node)];
+			for (int i=0; i < children.size(); i++)
+				has = filterLabels(children[i], text, changed) || has;
+		}
+		setHidden(node, !has, changed);
+		return has;
+	}
+
+	// every term has to start some word of the song, its album or its artist
+	bool matches(quint32 node, const QStringList &terms) const
+	{
+		QStringList words;
+		for (; node != rootNode; node = parentOf(node))
+			words += Collection::searchTerms(label(node));
+
+		for (QStringList::const_iterator t = terms.begin(); t != terms.end(); ++t)
+		{
+			bool found = false;
+			for (QStringList::const_iterator w = words.begin(); w != words.end() && !found; ++w)
+				found = w->startsWith(*t);
+			if (!found)
+				return false;
+		}
+		return true;
+	}
+
+	quint32 next(quint32 node, bool descend) const
+	{
+		if (descend && typeOf(node) != SongNode)
+		{
+			if (typeOf(node) == AlbumNode)
+				q->putInOrder(node);
+			const QVector<quint32> &children = childrenOf(node);
+			if (!children.isEmpty())
+				return children.first();
+		}
+		while (node != rootNode)
+		{
+			const quint32 parent = parentOf(node);
+			const QVector<quint32> &siblings = childrenOf(parent);
+			const int row = rowOf(node)+1;
+			if (row < siblings.size())
+				return siblings[row];
+			node = parent;
+		}
+		return rootNode;
+	}
+
+	quint32 previous(quint32 node) const
+	{
+		if (node == rootNode)
+			return rootNode;
+		const quint32 parent = parentOf(node);
+		const int row = rowOf(node);
+		if (row == 0)
+			return parent;
+
+		// the last thing in the sibling before it
+		node = childrenOf(parent)[row-1];
+		while (typeOf(node) != SongNode && !childrenOf(node).isEmpty())
+		{
+			if (typeOf(node) == AlbumNode)
+				q->putInOrder(node);
+			node = childrenOf(node).last();
+		}
+		return node;
+	}
+
+	// the outermost hidden branch that @p node is in, or itself
+	quint32 hiddenFrom(quint32 node) const
+	{
+		for (quint32 up = parentOf(node); up != rootNode && (flags(up) & HiddenFlag); up = parentOf(up))
+			node = up;
+		return node;
+	}
+
+	quint32 nextSong(quint32 node, bool skipHidden) const
+	{
+		bool descend = true;
+		while (true)
+		{
+			node = next(node, descend);
+			if (node == rootNode)
+				return rootNode;
+			if (skipHidden && (flags(node) & HiddenFlag))
+			{ // and everything under it
+				descend = false;
+				continue;
+			}
+			if (typeOf(node) == SongNode)
+				return node;
+			descend = true;
+		}
+	}
+
+	quint32 previousSong(quint32 node, bool skipHidden) const
+	{
+		while (true)
+		{
+			node = previous(node);
+			if (node == rootNode)
+				return rootNode;
+			if (skipHidden && (flags(node) & HiddenFlag))
+			{ // go past the whole hidden branch
+				node = hiddenFrom(node);
+				continue;
+			}
+			if (typeOf(node) == SongNode)
+				return node;
+		}
+	}
+
+	struct KeyOrder
+	{
+		const Private *const d;
+		KeyOrder(const Private *d) : d(d) { }
+		bool operator()(quint32 a, quint32 b) const
+		{
+			return keyLess(d->key(a), d->key(b));
+		}
+	};
+};
+
+
+Meow::TreeModel::TreeModel(QObject *parent)
+	: QAbstractItemModel(parent)
+{
+	d = new Private(this);
+}
+
+Meow::TreeModel::~TreeModel()
+{
+	delete d;
+}
+
+QModelIndex Meow::TreeModel::index(int row, int column, const QModelIndex &parent) const
+{
+	if (column != 0 || row < 0)
+		return QModelIndex();
+	const quint32 p = parent.isValid() ? quint32(parent.internalId()) : rootNode;
+	if (typeOf(p) == SongNode)
+		return QModelIndex();
+	if (typeOf(p) == AlbumNode && !d->isMaterialized(p))
+		return QModelIndex();
+
+	const QVector<quint32> &children = d->childrenOf(p);
+	if (row >= children.size())
+		return QModelIndex();
+	return createIndex(row, 0, children[row]);
+}
+
+QModelIndex Meow::TreeModel::parent(const QModelIndex &index) const
+{
+	if (!index.isValid())
+		return QModelIndex();
+	return indexOf(d->parentOf(quint32(index.internalId())));
+}
+
+int Meow::TreeModel::rowCount(const QModelIndex &parent) const
+{
+	if (parent.column() > 0)
+		return 0;
+	const quint32 p = parent.isValid() ? quint32(parent.internalId()) : rootNode;
+	if (typeOf(p) == SongNode)
+		return 0;
+	if (typeOf(p) == AlbumNode && !d->isMaterialized(p))
+		return 0;
+	return d->childrenOf(p).size();
+}
+
+int Meow::TreeModel::columnCount(const QModelIndex &) const
+{
+	return 1;
+}
+
+bool Meow::TreeModel::hasChildren(const QModelIndex &parent) const
+{
+	if (parent.column() > 0)
+		return false;
+	const quint32 p = parent.isValid() ? quint32(parent.internalId()) : rootNode;
+	if (typeOf(p) == SongNode)
+		return false;
+	return !d->childrenOf(p).isEmpty();
+}
+
+bool Meow::TreeModel::canFetchMore(const QModelIndex &parent) const
+{
+	if (type(parent) != AlbumNode)
+		return false;
+	return !d->isMaterialized(quint32(parent.internalId()));
+}
+
+void Meow::TreeModel::fetchMore(const QModelIndex &parent)
+{
+	if (type(parent) == AlbumNode)
+		materialize(quint32(parent.internalId()));
+}
+
+QVariant Meow::TreeModel::data(const QModelIndex &index, int role) const
+{
+	if (!index.isValid() || role != Qt::DisplayRole)
+		return QVariant();
+	return d->label(quint32(index.internalId()));
+}
+
+Meow::TreeModel::NodeType Meow::TreeModel::type(const QModelIndex &index)
+{
+	if (!index.isValid())
+		return Invalid;
+	return typeOf(quint32(index.internalId()));
+}
+
+Meow::FileId Meow::TreeModel::fileId(const QModelIndex &index) const
+{
+	if (type(index) != SongNode)
+		return 0;
+	return d->songFile[slotOf(quint32(index.internalId()))];
+}
+
+QModelIndex Meow::TreeModel::song(FileId id) const
+{
+	QHash<FileId, int>::const_iterator i = d->songSlots.constFind(id);
+	if (i == d->songSlots.constEnd())
+		return QModelIndex();
+	return indexOf(makeNode(SongNode, *i));
+}
+
+QModelIndex Meow::TreeModel::reveal(const QModelIndex &index)
+{
+	if (!index.isValid())
+		return QModelIndex();
+	const quint32 node = quint32(index.internalId());
+	if (!d->isShown(node))
+		materialize(d->parentOf(node));
+	return indexOf(node);
+}
+
+Meow::TreeModel::LabelMatch Meow::TreeModel::matchLabels(FileId id, const QStringList &terms) const
+{
+	const int slot = d->songSlots.value(id, -1);
+	if (slot == -1)
+		return NotInTree;
+	const quint32 node = makeNode(SongNode, slot);
+	if (d->matches(node, terms))
+		return Matched;
+	// grouped by album, its artist isn't in the tree to look at
+	if (d->parentOf(d->parentOf(node)) == rootNode)
+		return Unsure;
+	return NotMatched;
+}
+
+void Meow::TreeModel::songsUnder(const QModelIndex &index, std::vector<FileId> &files) const
+{
+	d->songsUnder(index.isValid() ? quint32(index.internalId()) : rootNode, files);
+}
+
+int Meow::TreeModel::numSongs(const QModelIndex &branch) const
+{
+	return d->songsIn(branch.isValid() ? quint32(branch.internalId()) : rootNode);
+}
+
+QModelIndex Meow::TreeModel::addFile(const File &file)
+{
+	return indexOf(place(file));
+}
+
+quint32 Meow::TreeModel::place(const File &file)
+{
+	const QString title = file.label();
+
+	int slot = d->songSlots.value(file.fileId(), -1);
+	if (slot != -1)
+	{ // it's moving
+		detach(makeNode(SongNode, slot));
+		d->release(d->songLabel[slot]);
+		d->songFlags[slot] = 0;
+	}
+	else
+		slot = d->newSong(file.fileId());
+	d->songLabel[slot] = d->intern(title);
+
+	const QByteArray albumKey = keyFor(file.albumKey(), file.album());
+	quint32 album;
+	if (file.displayByAlbum())
+		album = fold(rootNode, AlbumNode, file.album(), albumKey);
+	else
+	{
+		const quint32 artist = fold(
+				rootNode, ArtistNode, file.artist(),
+				keyFor(file.artistKey(), file.artist())
+			);
+		album = fold(artist, AlbumNode, file.album(), albumKey);
+	}
+
+	// the stored key is kept for when its album is put in order,
+	// one is only made now if it's needed now
+	d->songKey[slot] = file.labelKey();
+	if (d->isSorted(album) && d->songKey[slot].isEmpty())
+		d->songKey[slot] = Meow::sortKey(title);
+
+	const quint32 node = makeNode(SongNode, slot);
+	insertChild(album, d->sortedPosition(album, d->songKey[slot]), node);
+	for (quint32 up = album; up != rootNode; up = d->parentOf(up))
+		d->branchSongs[slotOf(up)]++;
+
+	return node;
+}
+
+void Meow::TreeModel::addFiles(const QVector<File> &files)
+{
+	// the ones that are already there move, which can take
+	// branches away, so they're put in one at a time
+	QVector<int> fresh, moving;
+	QSet<FileId> freshIds;
+	fresh.reserve(files.size());
+	for (int i=0; i < files.size(); i++)
+	{
+		const FileId id = files[i].fileId();
+		if (d->songSlots.contains(id) || freshIds.contains(id))
+			moving.append(i);
+		else
+		{
+			fresh.append(i);
+			freshIds.insert(id);
+		}
+	}
+
+	if (!fresh.isEmpty() && d->songSlots.isEmpty())
+	{ // there's nothing for the views to lose
+		beginResetModel();
+		d->batching = true;
+		for (int i=0; i < fresh.size(); i++)
+			place(files[fresh[i]]);
+		d->batching = false;
+		endResetModel();
+	}
+	else if (!fresh.isEmpty())
+	{
+		d->deferring = true;
+		for (int i=0; i < fresh.size(); i++)
+			place(files[fresh[i]]);
+		d->deferring = false;
+
+		QHash<quint32, QVector<quint32> > deferred;
+		deferred.swap(d->deferred);
+		// the new branches are filled in before the views can see them
+		for (QHash<quint32, QVector<quint32> >::const_iterator i = deferred.constBegin(); i != deferred.constEnd(); ++i)
+		{
+			if (d->deferredBranches.contains(i.key()))
+				insertChildren(i.key(), i.value(), false);
+		}
+		for (QHash<quint32, QVector<quint32> >::const_iterator i = deferred.constBegin(); i != deferred.constEnd(); ++i)
+		{
+			if (!d->deferredBranches.contains(i.key()))
+				insertChildren(i.key(), i.value(), true);
+		}
+		d->deferredBranches.clear();
+	}
+
+	for (int i=0; i < moving.size(); i++)
+		place(files[moving[i]]);
+}
+
+void Meow::TreeModel::remove(const QModelIndex &index)
+{
+	if (!index.isValid())
+		return;
+	const quint32 node = quint32(index.internalId());
+	detach(node);
+	d->freeNode(node);
+}
+
+void Meow::TreeModel::clear()
+{
+	beginResetModel();
+	delete d;
+	d = new Private(this);
+	endResetModel();
+}
+
+QModelIndex Meow::TreeModel::nextNode(const QModelIndex &index, bool skipHidden) const
+{
+	quint32 node = index.isValid() ? quint32(index.internalId()) : rootNode;
+	bool descend = true;
+	while (1)
+	{
+		node = d->next(node, descend);
+		if (node == rootNode)
+			return QModelIndex();
+		if (!skipHidden || !(d->flags(node) & HiddenFlag))
+			return indexOf(node);
+		// everything under it is hidden too
+		descend = false;
+	}
+}
+
+QModelIndex Meow::TreeModel::previousNode(const QModelIndex &index, bool skipHidden) const
+{
+	quint32 node = index.isValid() ? quint32(index.internalId()) : rootNode;
+	do
+	{
+		node = d->previous(node);
+	} while (node != rootNode && skipHidden && (d->flags(node) & HiddenFlag));
+	return indexOf(node);
+}
+
+QModelIndex Meow::TreeModel::nextSong(const QModelIndex &index, bool skipHidden) const
+{
+	const quint32 node = index.isValid() ? quint32(index.internalId()) : rootNode;
+	return indexOf(d->nextSong(node, skipHidden));
+}
+
+QModelIndex Meow::TreeModel::previousSong(const QModelIndex &index, bool skipHidden) const
+{
+	if (!index.isValid())
+		return QModelIndex();
+	return indexOf(d->previousSong(quint32(index.internalId()), skipHidden));
+}
+
+bool Meow::TreeModel::isHidden(const QModelIndex &index) const
+{
+	if (!index.isValid())
+		return false;
+	return d->flags(quint32(index.internalId())) & HiddenFlag;
+}
+
+void Meow::TreeModel::filterSongs(const QSet<FileId> *matches, QModelIndexList &changed)
+{
+	QVector<quint32> nodes;
+	for (int i=0; i < d->topLevel.size(); i++)
+		d->filterSongs(d->topLevel[i], matches, nodes);
+	for (int i=0; i < nodes.size(); i++)
+	{
+		if (d->isShown(nodes[i]))
+			changed += indexOf(nodes[i]);
+	}
+}
+
+void Meow::TreeModel::filterLabels(const QString &text, QModelIndexList &changed)
+{
+	QVector<quint32> nodes;
+	for (int i=0; i < d->topLevel.size(); i++)
+		d->filterLabels(d->topLevel[i], text, nodes);
+	for (int i=0; i < nodes.size(); i++)
+	{
+		if (d->isShown(nodes[i]))
+			changed += indexOf(nodes[i]);
+	}
+}
+
+void Meow::TreeModel::setWeight(FileId id, quint32 weight)
+{
+	const int slot = d->songSlots.value(id, -1);
+	if (slot != -1)
+		d->songWeights.set(slot, weight);
+}
+
+Meow::FileId Meow::TreeModel::largestFile() const
+{
+	return d->largestFile;
+}
+
+quint64 Meow::TreeModel::totalWeight(NodeType type) const
+{
+	return d->weightsFor(type).total();
+}
+
+QModelIndex Meow::TreeModel::weighted(NodeType type, quint64 at) const
+{
+	const WeightIndex &weights = d->weightsFor(type);
+	if (at >= weights.total())
+		return QModelIndex();
+	const int slot = weights.find(at);
+	if (type == SongNode)
+		return indexOf(makeNode(SongNode, slot));
+
+	// a top-level branch could be either, but only albums hold songs
+	const QVector<quint32> &children = d->branchChildren[slot];
+	if (type == ArtistNode && !children.isEmpty() && typeOf(children[0]) != SongNode)
+		return indexOf(makeNode(ArtistNode, slot));
+	return indexOf(makeNode(AlbumNode, slot));
+}
+
+bool Meow::TreeModel::wasAutoExpanded(const QModelIndex &branch) const
+{
+	if (type(branch) != ArtistNode && type(branch) != AlbumNode)
+		return false;
+	return d->flags(quint32(branch.internalId())) & AutoExpandedFlag;
+}
+
+void Meow::TreeModel::setWasAutoExpanded(const QModelIndex &branch, bool yes)
+{
+	if (type(branch) != ArtistNode && type(branch) != AlbumNode)
+		return;
+	if (wasAutoExpanded(branch) == yes)
+		return;
+	const quint32 node = quint32(branch.internalId());
+	d->flags(node) ^= AutoExpandedFlag;
+
+	// its children are drawn differently now
+	const int children = rowCount(branch);
+	if (children)
+		emit dataChanged(index(0, 0, branch), index(children-1, 0, branch));
+}
+
+size_t Meow::TreeModel::memoryUsed() const
+{
+	size_t bytes = sizeof(Private);
+
+	bytes += bytesOf(d->strings) + bytesOf(d->stringRefs)
+		+ bytesOf(d->freeStrings) + bytesOf(d->stringIndex);
+	for (int i=0; i < d->strings.size(); i++)
+	{ // the text itself, shared with the key in stringIndex
+		if (!d->strings[i].isNull())
+			bytes += sizeof(int)*4 + (d->strings[i].capacity()+1)*sizeof(QChar);
+	}
+
+	bytes += bytesOf(d->branchLabel) + bytesOf(d->branchKey) + bytesOf(d->branchParent)
+		+ bytesOf(d->branchRow) + bytesOf(d->branchSongs)
+		+ bytesOf(d->branchFlags) + bytesOf(d->branchChildren)
+		+ bytesOf(d->branchIndex) + bytesOf(d->freeBranches);
+	for (int i=0; i < d->branchChildren.size(); i++)
+	{
+		bytes += keyBytes(d->branchKey[i]);
+		bytes += d->branchChildren[i].capacity()*sizeof(quint32);
+		bytes += bytesOf(d->branchIndex[i]);
+	}
+
+	for (int i=0; i < d->songKey.size(); i++)
+		bytes += keyBytes(d->songKey[i]);
+	bytes += bytesOf(d->songFile) + bytesOf(d->songLabel) + bytesOf(d->songKey)
+		+ bytesOf(d->songParent) + bytesOf(d->songRow)
+		+ bytesOf(d->songFlags) + bytesOf(d->freeSongs)
+		+ bytesOf(d->songSlots);
+
+	bytes += bytesOf(d->topLevel) + bytesOf(d->topLevelArtists)
+		+ bytesOf(d->topLevelAlbums);
+
+	bytes += d->songWeights.memoryUsed() + d->albumWeights.memoryUsed()
+		+ d->topLevelWeights.memoryUsed();
+	return bytes;
+}
+
+QModelIndex Meow::TreeModel::indexOf(quint32 node) const
+{
+	if (node == rootNode)
+		return QModelIndex();
+	return createIndex(d->rowOf(node), 0, node);
+}
+
+void Meow::TreeModel::insertChild(quint32 parent, int row, quint32 node)
+{
+	// a song isn't in its album yet, so go by the album
+	const bool shown = typeOf(parent) != AlbumNode || d->isMaterialized(parent);
+	if (shown && d->deferring)
+	{ // addFiles puts it in with the others
+		d->setPosition(node, parent, -1);
+		d->deferred[parent].append(node);
+		if (typeOf(node) != SongNode)
+			d->deferredBranches.insert(node);
+		return;
+	}
+	const bool notify = !d->batching && shown;
+	if (notify)
+		beginInsertRows(indexOf(parent), row, row);
+	QVector<quint32> &children = d->childrenOf(parent);
+	children.insert(row, node);
+	for (int i=row; i < children.size(); i++)
+		d->setPosition(children[i], parent, i);
+	d->materializedSongs += typeOf(node) == SongNode ? int(shown) : d->materializedUnder(node);
+	if (notify)
+		endInsertRows();
+}
+
+void Meow::TreeModel::insertChildren(quint32 parent, QVector<quint32> nodes, bool notify)
+{
+	std::stable_sort(nodes.begin(), nodes.end(), Private::KeyOrder(d));
+	QVector<quint32> &children = d->childrenOf(parent);
+	for (int first=0; first < nodes.size(); )
+	{
+		// the ones that go in together, before the same child
+		const int row = d->sortedPosition(parent, d->key(nodes[first]));
+		int last = first+1;
+		while (
+				last < nodes.size() && (row == children.size()
+				|| !keyLess(d->key(children[row]), d->key(nodes[last])))
+			)
+			last++;
+
+		if (notify)
+			beginInsertRows(indexOf(parent), row, row+last-first-1);
+		children.insert(row, last-first, rootNode);
+		for (int i=first; i < last; i++)
+		{
+			const quint32 node = nodes[i];
+			children[row+i-first] = node;
+			// only songs that can be seen are put off
+			d->materializedSongs += typeOf(node) == SongNode ? 1 : d->materializedUnder(node);
+		}
+		for (int i=row; i < children.size(); i++)
+			d->setPosition(children[i], parent, i);
+		if (notify)
+			endInsertRows();
+		first = last;
+	}
+}
+
+void Meow::TreeModel::takeChild(quint32 parent, int row)
+{
+	QVector<quint32> &children = d->childrenOf(parent);
+	const quint32 node = children[row];
+	const bool shown = typeOf(parent) != AlbumNode || d->isMaterialized(parent);
+	const bool notify = !d->batching && shown;
+	if (notify)
+		beginRemoveRows(indexOf(parent), row, row);
+	d->materializedSongs -= typeOf(node) == SongNode ? int(shown) : d->materializedUnder(node);
+	if (typeOf(node) != SongNode)
+		d->foldIndex(parent, typeOf(node)).remove(d->key(node));
+	children.remove(row);
+	for (int i=row; i < children.size(); i++)
+		d->setPosition(children[i], parent, i);
+	if (notify)
+		endRemoveRows();
+}
+
+void Meow::TreeModel::materialize(quint32 album)
+{
+	const int slot = slotOf(album);
+	if (d->branchFlags[slot] & MaterializedFlag)
+		return;
+
+	putInOrder(album);
+	const QVector<quint32> &children = d->branchChildren[slot];
+	if (children.isEmpty() || d->batching)
+	{
+		d->branchFlags[slot] |= MaterializedFlag;
+		d->materializedSongs += children.size();
+		return;
+	}
+	beginInsertRows(indexOf(album), 0, children.size()-1);
+	d->branchFlags[slot] |= MaterializedFlag;
+	d->materializedSongs += children.size();
+	endInsertRows();
+}
+
+void Meow::TreeModel::putInOrder(quint32 album)
+{
+	const int slot = slotOf(album);
+	if (d->branchFlags[slot] & SortedFlag)
+		return;
+
+	QVector<quint32> &children = d->branchChildren[slot];
+	for (int i=0; i < children.size(); i++)
+	{ // only the songs that came without a key need one made
+		QByteArray &key = d->songKey[slotOf(children[i])];
+		if (key.isEmpty())
+			key = Meow::sortKey(d->label(children[i]));
+	}
+	std::stable_sort(children.begin(), children.end(), Private::KeyOrder(d));
+	for (int i=0; i < children.size(); i++)
+		d->setPosition(children[i], album, i);
+	d->branchFlags[slot] |= SortedFlag;
+}
+
+void Meow::TreeModel::reclaim(const QModelIndex &branch)
+{
+	if (type(branch) != ArtistNode && type(branch) != AlbumNode)
+		return;
+	if (d->materializedSongs <= materializedBudget)
+		return;
+
+	const quint32 node = quint32(branch.internalId());
+	if (type(branch) == ArtistNode)
+	{
+		const QVector<quint32> &albums = d->branchChildren[slotOf(node)];
+		for (int i=0; i < albums.size(); i++)
+			reclaim(index(i, 0, branch));
+		return;
+	}
+
+	const int slot = slotOf(node);
+	if (!(d->branchFlags[slot] & MaterializedFlag))
+		return;
+	QVector<quint32> &children = d->branchChildren[slot];
+	if (!children.isEmpty())
+		beginRemoveRows(branch, 0, children.size()-1);
+	d->branchFlags[slot] &= ~MaterializedFlag;
+	d->materializedSongs -= children.size();
+	if (!children.isEmpty())
+		endRemoveRows();
+}
+
+void Meow::TreeModel::detach(quint32 node)
+{
+	const int songs = d->songsIn(node);
+	quint32 parent = d->parentOf(node);
+	takeChild(parent, d->rowOf(node));
+
+	// the branches above lose its songs, and the empty ones go away
+	while (parent != rootNode)
+	{
+		const int slot = slotOf(parent);
+		const quint32 up = d->parentOf(parent);
+		d->branchSongs[slot] -= songs;
+		if (d->branchChildren[slot].isEmpty())
+		{
+			takeChild(up, d->branchRow[slot]);
+			d->freeNode(parent);
+		}
+		parent = up;
+	}
+}
+
+quint32 Meow::TreeModel::fold(
+		quint32 parent, NodeType type, const QString &label,
+		const QByteArray &key
+	)
+{
+	{ // return the child that already exists
+		const QHash<QByteArray, quint32> &existing = d->foldIndex(parent, type);
+		const QHash<QByteArray, quint32>::const_iterator i = existing.constFind(key);
+		if (i != existing.constEnd())
+			return *i;
+	}
+
+	// or make a new one (newBranch can move the indexes)
+	const int slot = d->newBranch(label, key);
+	const quint32 node = makeNode(type, slot);
+	d->foldIndex(parent, type).insert(key, node);
+	if (type == AlbumNode)
+		d->albumWeights.set(slot, 1);
+	if (parent == rootNode)
+		d->topLevelWeights.set(slot, 1);
+	insertChild(parent, d->sortedPosition(parent, key), node);
+	return node;
+}
+
+// kate: space-indent off; replace-tabs off;
@@ -0,0 +1,199 @@
+#ifndef MEOW_TREEMODEL_H
+#define MEOW_TREEMODEL_H
+
+#include <qabstractitemmodel.h>
+#include <qvector.h>
+#include <qset.h>
+
+#include <vector>
+
+#include <db/file.h>
+
+namespace Meow
+{
+
+/**
+ * The artist/album/song tree that TreeView shows.
+ *
+ * Nothing here is a heap object per item: labels are interned,
+ * songs and branches are stored as parallel arrays indexed by slot,
+ * and each branch keeps the slots of its children in display order.
+ * A QModelIndex's internalId is the node's type and slot.
+ *
+ * The songs of an album are in the order they were added until
+ * they're needed in order, and have no rows as far as the views
+ * know until it is materialized by @ref fetchMore or @ref reveal.
+ * Looking songs up, stepping through them and filtering them
+ * never does that.
+ **/
+class TreeModel : public QAbstractItemModel
+{
+	Q_OBJECT
+
+	struct Private;
+	Private *d;
+
+public:
+	enum NodeType
+	{
+		Invalid=0, ArtistNode=1, AlbumNode=2, SongNode=3
+	};
+
+	TreeModel(QObject *parent);
+	~TreeModel();
+
+	virtual QModelIndex index(int row, int column, const QModelIndex &parent=QModelIndex()) const;
+	virtual QModelIndex parent(const QModelIndex &index) const;
+	virtual int rowCount(const QModelIndex &parent=QModelIndex()) const;
+	virtual int columnCount(const QModelIndex &parent=QModelIndex()) const;
+	virtual bool hasChildren(const QModelIndex &parent=QModelIndex()) const;
+	virtual QVariant data(const QModelIndex &index, int role=Qt::DisplayRole) const;
+	/**
+	 * an album's songs are only put in order and shown when it's
+	 * expanded, or when one of them is asked for
+	 **/
+	virtual bool canFetchMore(const QModelIndex &parent) const;
+	virtual void fetchMore(const QModelIndex &parent);
+
+	static NodeType type(const QModelIndex &index);
+
+	/**
+	 * the song under @p index, or 0 if @p index isn't a song
+	 **/
+	FileId fileId(const QModelIndex &index) const;
+	/**
+	 * where the song @p id is, if it's in the tree. If its album
+	 * isn't materialized, the index can only be given back to this
+	 * model until it's passed through @ref reveal
+	 **/
+	QModelIndex song(FileId id) const;
+	/**
+	 * @p index, with its album materialized so that a view can
+	 * be given it
+	 **/
+	QModelIndex reveal(const QModelIndex &index);
+
+	enum LabelMatch
+	{
+		NotInTree, Matched, NotMatched,
+		// it doesn't match, but it's grouped by album so
+		// its artist isn't known here
+		Unsure
+	};
+	/**
+	 * whether each of @p terms starts a word of the song @p id's
+	 * label or of the branches it's in, like @ref Collection::search
+	 **/
+	LabelMatch matchLabels(FileId id, const QStringList &terms) const;
+	/**
+	 * every song at or under @p index is appended to @p files
+	 **/
+	void songsUnder(const QModelIndex &index, std::vector<FileId> &files) const;
+	/**
+	 * how many songs are under this branch, or in the whole tree
+	 * for the invalid index
+	 **/
+	int numSongs(const QModelIndex &branch=QModelIndex()) const;
+	/**
+	 * no song in the tree has an id above this, since the last @ref clear
+	 **/
+	FileId largestFile() const;
+
+	/**
+	 * put this song in its place (or move it there, if it's already
+	 * in the tree) and give it its new label
+	 **/
+	QModelIndex addFile(const File &file);
+	/**
+	 * like addFile for each of @p files, but the views are told
+	 * with a reset if the tree was empty, and otherwise with a
+	 * rowsInserted for each run of rows that go in together
+	 **/
+	void addFiles(const QVector<File> &files);
+	/**
+	 * take this node and everything under it out of the tree, as
+	 * well as any branches that become empty as a result
+	 **/
+	void remove(const QModelIndex &index);
+	void clear();
+
+	/**
+	 * the next or previous node in the order they're displayed,
+	 * including those in collapsed branches. Hidden nodes are skipped
+	 * if @p skipHidden. The node after the invalid index is the first
+	 * one in the tree
+	 **/
+	QModelIndex nextNode(const QModelIndex &index, bool skipHidden) const;
+	QModelIndex previousNode(const QModelIndex &index, bool skipHidden) const;
+	/**
+	 * like @ref nextNode and @ref previousNode, but only stopping at
+	 * songs. The songs in a branch come after the branch
+	 **/
+	QModelIndex nextSong(const QModelIndex &index, bool skipHidden) const;
+	QModelIndex previousSong(const QModelIndex &index, bool skipHidden) const;
+
+	bool isHidden(const QModelIndex &index) const;
+	/**
+	 * hide everything except the songs in @p matches and the
+	 * branches they're in. If @p matches is null, show everything.
+	 *
+	 * The nodes whose state changes are added to @p changed, so
+	 * that the view can be told
+	 **/
+	void filterSongs(const QSet<FileId> *matches, QModelIndexList &changed);
+	/**
+	 * like filterSongs, but by @p text appearing in the labels
+	 **/
+	void filterLabels(const QString &text, QModelIndexList &changed);
+
+	/**
+	 * how likely the song @p id is to be picked by @ref weighted,
+	 * relative to the others. Every song starts at 1
+	 **/
+	void setWeight(FileId id, quint32 weight);
+	/**
+	 * the sum of the weights of every song, album or top-level branch,
+	 * depending on @p type (ArtistNode means the top-level ones, which
+	 * includes albums that aren't under an artist). Albums and
+	 * top-level branches all have a weight of 1
+	 **/
+	quint64 totalWeight(NodeType type) const;
+	/**
+	 * the song, album or top-level branch at @p at, which is less
+	 * than totalWeight(@p type), as if they were laid end to end
+	 * each as long as its weight. O(log n)
+	 **/
+	QModelIndex weighted(NodeType type, quint64 at) const;
+
+	/**
+	 * the views are done with the songs in this collapsed branch;
+	 * if a lot of songs are materialized, they go back to how they
+	 * were before @ref fetchMore
+	 **/
+	void reclaim(const QModelIndex &branch);
+
+	bool wasAutoExpanded(const QModelIndex &branch) const;
+	void setWasAutoExpanded(const QModelIndex &branch, bool yes);
+
+	/**
+	 * approximately how many bytes the tree is using
+	 **/
+	size_t memoryUsed() const;
+
+private:
+	QModelIndex indexOf(quint32 node) const;
+	quint32 place(const File &file);
+	void materialize(quint32 album);
+	void putInOrder(quint32 album);
+	void insertChild(quint32 parent, int row, quint32 node);
+	void insertChildren(quint32 parent, QVector<quint32> nodes, bool notify);
+	void takeChild(quint32 parent, int row);
+	void detach(quint32 node);
+	quint32 fold(quint32 parent, NodeType type, const QString &label, const QByteArray &key);
+};
+
+}
+
+#endif
+
+// kate: space-indent off; replace-tabs off;
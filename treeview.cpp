@@ -1,4 +1,5 @@
 #include "treeview.h"
+#include "treemodel.h"
 #include "player.h"
 #include <db/file.h>
 #include <db/collection.h>
@@ -10,330 +11,271 @@
 #include <qcursor.h>
 #include <qapplication.h>
 
-#ifdef MEOW_WITH_KDE
-#include <krandom.h>
-#endif
-
 #include <set>
 #include <limits>
+#include <random>
 #include <iostream>
 
-static void pad(QString &str)
-{
-	int len=str.length();
-	int at = 0;
-	int blocklen=0;
-
-	static const int paddingsize=12;
-
-	// not static for reason
-	const QChar chars[paddingsize] =
-	{
-		QChar('0'), QChar('0'), QChar('0'), QChar('0'),
-		QChar('0'), QChar('0'), QChar('0'), QChar('0'),
-		QChar('0'), QChar('0'), QChar('0'), QChar('0')
-	};
-
-	for (int i=0; i < len; i++)
-	{
-		if (str[i].isNumber())
-		{
-			if (!blocklen)
-				at = i;
-			blocklen++;
-		}
-		else if (blocklen)
-		{
-			int pads=paddingsize;
-			pads -= blocklen;
-			str.insert(at, chars, pads);
-			i += pads;
-			blocklen = 0;
-		}
-	}
-	if (blocklen)
-	{
-		int pads=paddingsize;
-		pads -= blocklen;
-		str.insert(at, chars, pads);
-	}
-}
 
-struct Meow::TreeView::Node : public QTreeWidgetItem
+class Meow::TreeView::Selector
 {
-	bool wasAutoExpanded:1;
-	Node(int type)
-		: QTreeWidgetItem(type), mNumSongs(0)
-	{
-		wasAutoExpanded = false;
-	}
-	Node *parent() { return static_cast<Node*>(QTreeWidgetItem::parent()); }
-	
-	void setWasAutoExpanded(bool yes)
-	{
-		if (yes == wasAutoExpanded) return;
-		wasAutoExpanded = yes;
-		handleAutoExpansionOfChildren();
-	}
-	
-	void handleAutoExpansionOfChildren()
-	{
-		const bool yes = wasAutoExpanded;
-		const int children = childCount();
-		for (int i=0; i < children; i++)
-		{
-			Node *const ch = static_cast<Node*>(child(i));
-			ch->changeColorsToReflectAutoExpansion(yes);
-		}
-	}
-	
-	void changeColorsToReflectAutoExpansion()
-	{
-		if (parent())
-			changeColorsToReflectAutoExpansion(parent()->wasAutoExpanded);
-	}
-	
-	int numSongs() const { return mNumSongs; }
+	TreeView *const mTree;
+	std::mt19937_64 mRandom;
+public:
+	Selector(TreeView *tv) : mTree(tv), mRandom(std::random_device()()) { }
+	virtual ~Selector() { }
 
-	void songAdded() { mNumSongs++; }
-	void songRemoved() { mNumSongs--; }
+	virtual QModelIndex nextSong()=0;
+	virtual QModelIndex previousSong()=0;
+	// the tree was emptied, maybe for another collection
+	virtual void cleared() { }
 
+protected:
+	TreeView *tree() { return mTree; }
+	TreeModel *model() { return mTree->mModel; }
+	QModelIndex current() { return mTree->current(); }
 
-private:
-	void changeColorsToReflectAutoExpansion(bool parentState)
+	// a random song, album or top-level branch, by their weights
+	QModelIndex pick(TreeModel::NodeType type)
 	{
-		if (parentState)
-		{
-			const QColor bg = treeWidget()->palette().base().color();
-			QBrush brush = foreground(0);
-			QColor text = brush.color();
-	
-			int r = text.red() + bg.red();
-			int g = text.green() + bg.green();
-			int b = text.blue() + bg.blue();
-			text.setRgb(r/2,g/2,b/2);
-			
-			brush.setColor(text);
-			setForeground(0, brush);
-		}
-		else
-		{
-			QBrush b = treeWidget()->palette().text().color();
-			setForeground(0, b);
-		}
+		const quint64 total = model()->totalWeight(type);
+		if (total == 0)
+			return QModelIndex();
+		std::uniform_int_distribution<quint64> below(0, total-1);
+		return model()->weighted(type, below(mRandom));
 	}
-
-	int mNumSongs;
+	quint64 randomNumber() { return mRandom(); }
 };
 
-struct Meow::TreeView::Artist : public Node
+class Meow::TreeView::LinearSelector : public Meow::TreeView::Selector
 {
-	Artist(const QString &artist)
-		: Node(UserType+1)
+public:
+	LinearSelector(TreeView *tv) : Selector(tv) { }
+	virtual QModelIndex nextSong()
 	{
-		setText(0, artist);
+		return model()->nextSong(current(), true);
 	}
-	
-private:
-	int mNumSongs;
-};
-
-
-struct Meow::TreeView::Album : public Node
-{
-public:
-	Album(const QString &album)
-		: Node(UserType+2)
+	virtual QModelIndex previousSong()
 	{
-		setText(0, album);
+		return model()->previousSong(current(), true);
 	}
 };
 
-struct Meow::TreeView::Song : public Node
+
+class Meow::TreeView::RandomSongSelector : public Meow::TreeView::Selector
 {
-	const FileId mFileId;
 public:
-	Song(const Meow::File &file)
-		: Node(UserType+3), mFileId(file.fileId())
+	RandomSongSelector(TreeView *tv) : Selector(tv) { }
+	virtual QModelIndex nextSong()
 	{
-		setText(file);
+		const QModelIndex at = pick(TreeModel::SongNode);
+		if (!at.isValid())
+			return QModelIndex();
+		
+		tree()->mRandomPrevious = tree()->mCurrent;
+		return at;
 	}
-	
-	void setText(const Meow::File &file)
+	virtual QModelIndex previousSong()
 	{
-		QString title = file.title();
-		const QString track = file.track();
-		if (!track.isEmpty())
-			title = track + ". " + title;
-		Node::setText(0, title);
+		const FileId p = tree()->mRandomPrevious;
+		tree()->mRandomPrevious = 0;
+		return model()->song(p);
 	}
-	
-	FileId fileId() const { return mFileId; }
-	
-};
-
-
-class Meow::TreeView::Selector
-{
-	TreeView *const mTree;
-public:
-	Selector(TreeView *tv) : mTree(tv) { }
-	virtual ~Selector() { }
-
-	virtual QTreeWidgetItem *nextSong()=0;
-	virtual QTreeWidgetItem *previousSong()=0;
-
-protected:
-	TreeView *tree() { return mTree; }
-	Song *current() { return mTree->mCurrent; }
 };
 
-class Meow::TreeView::LinearSelector : public Meow::TreeView::Selector
+template<Meow::TreeModel::NodeType BranchType>
+class Meow::TreeView::RandomBranchSelector : public Meow::TreeView::Selector
 {
+	// tree()->mRandomPrevious in this case stores the previous artist's last song
 public:
-	LinearSelector(TreeView *tv) : Selector(tv) { }
-	virtual QTreeWidgetItem *nextSong()
+	RandomBranchSelector(TreeView *tv) : Selector(tv) { }
+	virtual QModelIndex nextSong()
 	{
-		if (!current())
-			return tree()->invisibleRootItem();
+		const QModelIndex cur = current();
+		const QModelIndex curArtist = inside(cur, BranchType);
+		
+		const QModelIndex next = model()->nextSong(cur, false);
+		if (next.isValid() && inside(next, BranchType) == curArtist)
+			return next;
 		
-		QTreeWidgetItemIterator it(tree()->mCurrent, QTreeWidgetItemIterator::NotHidden);
-		return *++it;
+		return randomBranch();
 	}
-	virtual QTreeWidgetItem *previousSong()
+	virtual QModelIndex previousSong()
 	{
-		if (!current())
-			return 0;
+		const QModelIndex cur = current();
+		const QModelIndex curArtist = inside(cur, BranchType);
 		
-		QTreeWidgetItemIterator it(current(), QTreeWidgetItemIterator::NotHidden);
-		--it;
-		for (; *it; --it)
-		{
-			QTreeWidgetItem *n = *it;
-			if (Song *s = dynamic_cast<Song*>(n))
-				return s;
-		}
-		return 0;
+		const QModelIndex previous = model()->previousSong(cur, false);
+		if (previous.isValid() && inside(previous, BranchType) == curArtist)
+			return previous;
+		
+		const FileId p = tree()->mRandomPrevious;
+		tree()->mRandomPrevious = 0;
+		return model()->song(p);
+	}
+
+private:
+	QModelIndex randomBranch()
+	{
+		const QModelIndex at = pick(BranchType);
+		if (!at.isValid())
+			return QModelIndex();
+		
+		tree()->mRandomPrevious = tree()->mCurrent;
+		return at;
 	}
 };
 
 
-class Meow::TreeView::RandomSongSelector : public Meow::TreeView::Selector
-{
+/**
+ * Plays every song once, in a random order, before starting over.
+ *
+ * The order is a permutation of the song ids below a range, made by a
+ * small Feistel network that's cycle-walked down to the range, so all
+ * that has to be kept is its seed and how far along it we are. Ids
+ * that aren't in the tree are stepped over. A song added during a
+ * cycle is played in it if its id is in the range and its turn hasn't
+ * passed yet.
+ *
+ * Going back retraces the permutation, as far as the start of the cycle
+ **/
+class Meow::TreeView::ShuffleSelector : public Meow::TreeView::Selector
+{
+	Collection::ShuffleState mState;
+	// the Feistel network works on two halves of this many bits
+	int mHalfBits;
+	bool mLoaded;
+
 public:
-	RandomSongSelector(TreeView *tv) : Selector(tv) { }
-	virtual QTreeWidgetItem *nextSong()
+	ShuffleSelector(TreeView *tv) : Selector(tv), mHalfBits(1), mLoaded(false) { }
+
+	virtual QModelIndex nextSong()
 	{
-		int totalSongs=0;
-		const int totalRoot = tree()->childCount();
-		for (int i=0; i < totalRoot; i++)
-		{
-			if (Node *n = dynamic_cast<Node*>(tree()->child(i)))
-				totalSongs += n->numSongs();
-		}
-#ifdef MEOW_WITH_KDE
-		const int songIndex = KRandom::random() % totalSongs;
-#else
-		const int songIndex = rand() % totalSongs;
-#endif
-		int atSong=0;
+		load();
 		
-		for (int i=0; i < totalRoot; i++)
+		bool restarted = false;
+		while (true)
 		{
-			Node *const node = dynamic_cast<Node*>(tree()->child(i));
-			if (!node)
-				continue;
-				
-			const int afterNode = atSong + node->numSongs();
-			if (songIndex < afterNode)
+			if (mState.position >= mState.range)
 			{
-				QTreeWidgetItemIterator it(node);
-				++i;
-				for (; *it; ++it)
+				if (restarted) // there's nothing to play
+					return QModelIndex();
+				startCycle();
+				restarted = true;
+			}
+			
+			while (mState.position < mState.range)
+			{
+				const QModelIndex at = songAt(mState.position++);
+				if (at.isValid())
 				{
-					if (Song *s = dynamic_cast<Song*>(*it))
-					{
-						if (atSong == songIndex)
-						{
-							tree()->mRandomPrevious = tree()->mCurrent;
-							return s;
-						}
-						atSong++;
-					}
+					save();
+					return at;
 				}
-				// should never get here
-				std::cerr << "Missed one?" << std::endl;
 			}
-			else
+		}
+	}
+	virtual QModelIndex previousSong()
+	{
+		load();
+		
+		quint64 p = mState.position;
+		// the song before position is playing now, unless
+		// someone picked another one themselves
+		if (p > 0 && model()->fileId(songAt(p-1)) == tree()->mCurrent)
+			p--;
+		
+		while (p > 0)
+		{
+			const QModelIndex at = songAt(--p);
+			if (at.isValid())
 			{
-				atSong = afterNode;
+				mState.position = p+1;
+				save();
+				return at;
 			}
 		}
-		return 0;
+		return QModelIndex();
 	}
-	virtual QTreeWidgetItem *previousSong()
+	virtual void cleared()
 	{
-		Song *const p = tree()->mRandomPrevious;
-		tree()->mRandomPrevious = 0;
-		return p;
+		mLoaded = false;
 	}
-};
 
-template<class BranchType>
-class Meow::TreeView::RandomBranchSelector : public Meow::TreeView::Selector
-{
-	// tree()->mRandomPrevious in this case stores the previous artist's last song
-public:
-	RandomBranchSelector(TreeView *tv) : Selector(tv) { }
-	virtual QTreeWidgetItem *nextSong()
+private:
+	void load()
 	{
-		Song *cur = current();
-		BranchType *curArtist = inside<BranchType>(cur);
-		
-		QTreeWidgetItemIterator it(cur);
-		while (*++it && inside<BranchType>(*it) == curArtist)
-		{
-			if (Song *s = dynamic_cast<Song*>(*it))
-				return s;
-		}
-		
-		return randomBranch();
+		if (mLoaded)
+			return;
+		mState = collection()->shuffleState();
+		mHalfBits = halfBitsFor(mState.range);
+		mLoaded = true;
+	}
+	void save()
+	{
+		collection()->setShuffleState(mState);
+	}
+	Collection *collection() { return tree()->collection; }
+	
+	void startCycle()
+	{
+		const quint64 largest = model()->largestFile();
+		// with some room for songs that are added during the cycle
+		mState.range = largest + largest/8;
+		mState.seed = randomNumber();
+		mState.position = 0;
+		mHalfBits = halfBitsFor(mState.range);
+	}
+	
+	QModelIndex songAt(quint64 position)
+	{
+		return model()->song(FileId(permute(position)+1));
+	}
+	
+	quint64 permute(quint64 x) const
+	{
+		// the network permutes a power of 4 at least as big as the
+		// range, and going around again until we're back in the
+		// range permutes just the range
+		do
+			x = feistel(x);
+		while (x >= mState.range);
+		return x;
 	}
-	virtual QTreeWidgetItem *previousSong()
+	
+	quint64 feistel(quint64 x) const
 	{
-		Song *cur = current();
-		BranchType *curArtist = inside<BranchType>(cur);
-		QTreeWidgetItemIterator it(cur);
-		while (*--it && inside<BranchType>(*it) == curArtist)
+		const quint64 mask = (quint64(1) << mHalfBits) - 1;
+		quint64 left = x >> mHalfBits;
+		quint64 right = x & mask;
+		for (quint64 round=0; round < 4; round++)
 		{
-			if (Song *s = dynamic_cast<Song*>(*it))
-				return s;
+			const quint64 f = mix(right ^ mix(mState.seed + round)) & mask;
+			const quint64 t = left ^ f;
+			left = right;
+			right = t;
 		}
-		
-		Song *const p = tree()->mRandomPrevious;
-		tree()->mRandomPrevious = 0;
-		return p;
+		return (left << mHalfBits) | right;
 	}
-
-private:
-	QTreeWidgetItem *randomBranch()
+	
+	static quint64 mix(quint64 z)
+	{ // splitmix64's finalizer
+		z += 0x9e3779b97f4a7c15ULL;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+	
+	static int halfBitsFor(quint64 range)
 	{
-		const int totalArtists = tree()->childCount();
-		
-#ifdef MEOW_WITH_KDE
-		const int artistIndex = KRandom::random() % totalArtists;
-#else
-		const int artistIndex = rand() % totalArtists;
-#endif
-		
-		tree()->mRandomPrevious = current();
-		
-		return tree()->child(artistIndex);
+		int bits=1;
+		while (bits < 32 && (quint64(1) << (bits*2)) < range)
+			bits++;
+		return bits;
 	}
 };
 
 
-
 class Meow::TreeView::SongWidget : public QWidget
 {
 	TreeView *const mOwner;
@@ -404,7 +346,7 @@ public:
 			= player->positionString() + "/" + player->lengthString();
 		
 		QString titleText
-			= mOwner->mCurrent->text(0);
+			= mOwner->current().data().toString();
 		
 		int timeTextSize=0;
 		
@@ -459,20 +401,29 @@ public:
 
 
 Meow::TreeView::TreeView(QWidget *parent, Player *player, Collection *collection)
-	: QTreeWidget(parent), player(player), collection(collection)
+	: QTreeView(parent), player(player), collection(collection),
+		mModel(new TreeModel(this))
 {
 	currentlyProcessingAutomaticExpansion = false;
+	mFilterMatchesValid = false;
+	setModel(mModel);
+	connect(
+			this, SIGNAL(kdeActivated(QModelIndex)),
+			SLOT(playAt(QModelIndex))
+		);
 	connect(
-			this, SIGNAL(kdeActivated(QTreeWidgetItem*)),
-			SLOT(playAt(QTreeWidgetItem*))
+			this, SIGNAL(expanded(QModelIndex)), 
+			SLOT(manuallyExpanded(QModelIndex))
 		);
 	connect(
-			this, SIGNAL(itemExpanded(QTreeWidgetItem*)), 
-			SLOT(manuallyExpanded(QTreeWidgetItem*))
+			this, SIGNAL(collapsed(QModelIndex)),
+			SLOT(branchCollapsed(QModelIndex))
 		);
 	connect(player, SIGNAL(finished()), SLOT(nextSong()));
 	
-	headerItem()->setHidden(true);
+	setHeaderHidden(true);
+	// so that the view doesn't need to ask about every row
+	setUniformRowHeights(true);
 	mCurrent = 0;
 	mRandomPrevious = 0;
 	
@@ -492,7 +443,23 @@ Meow::TreeView::TreeView(QWidget *parent, Player *player, Collection *collection
 				const QModelIndex &index
 			) const
 		{
-			if (mOwner->itemFromIndex(index) != mOwner->mCurrent)
+			if (index == mOwner->current())
+				return;
+			
+			if (mOwner->mModel->wasAutoExpanded(index.parent()))
+			{ // fade the things that were only expanded to show the current song
+				QStyleOptionViewItem faded(option);
+				const QColor bg = faded.palette.base().color();
+				QColor text = faded.palette.text().color();
+		
+				int r = text.red() + bg.red();
+				int g = text.green() + bg.green();
+				int b = text.blue() + bg.blue();
+				text.setRgb(r/2,g/2,b/2);
+				faded.palette.setColor(QPalette::Text, text);
+				QItemDelegate::paint(painter, faded, index);
+			}
+			else
 				QItemDelegate::paint(painter, option, index);
 		}
 		
@@ -506,18 +473,24 @@ Meow::TreeView::TreeView(QWidget *parent, Player *player, Collection *collection
 	setMouseTracking(true);
 	
 	connect(collection, SIGNAL(added(File)), SLOT(addFile(File)));
+	connect(collection, SIGNAL(addedBatch(QVector<File>)), SLOT(addFiles(QVector<File>)));
 	connect(collection, SIGNAL(addedToPlay(File)), SLOT(addFileAndPlay(File)));
 	connect(collection, SIGNAL(reloaded(File)), SLOT(reloadFile(File)));
+	connect(collection, SIGNAL(removed(QVector<FileId>)), SLOT(removeFiles(QVector<FileId>)));
+	connect(
+			collection, SIGNAL(searchFinished(QString, QVector<FileId>)),
+			SLOT(searchFinished(QString, QVector<FileId>))
+		);
 }
 
 QList<Meow::File> Meow::TreeView::selectedFiles()
 {
 	QList<File> files;
-	QList<QTreeWidgetItem*> selected = selectedItems();
-	for (QList<QTreeWidgetItem*>::iterator i = selected.begin(); i != selected.end(); ++i)
+	const QModelIndexList selected = selectionModel()->selectedIndexes();
+	for (QModelIndexList::const_iterator i = selected.begin(); i != selected.end(); ++i)
 	{
-		if (Song *s = dynamic_cast<Song*>(*i))
-			files += collection->getSong(s->fileId());
+		if (FileId id = mModel->fileId(*i))
+			files += collection->getSong(id);
 	}
 	return files;
 }
@@ -525,11 +498,11 @@ QList<Meow::File> Meow::TreeView::selectedFiles()
 QList<QString> Meow::TreeView::selectedAlbums()
 {
 	QList<QString> albums;
-	QList<QTreeWidgetItem*> selected = selectedItems();
-	for (QList<QTreeWidgetItem*>::iterator i = selected.begin(); i != selected.end(); ++i)
+	const QModelIndexList selected = selectionModel()->selectedIndexes();
+	for (QModelIndexList::const_iterator i = selected.begin(); i != selected.end(); ++i)
 	{
-		if (Album *s = dynamic_cast<Album*>(*i))
-			albums += s->text(0);
+		if (TreeModel::type(*i) == TreeModel::AlbumNode)
+			albums += i->data().toString();
 	}
 	return albums;
 }
@@ -545,12 +518,13 @@ void Meow::TreeView::setSelector(SelectorType t)
 		mSelector = new RandomAlbumSelector(this);
 	else if (t == RandomArtist)
 		mSelector = new RandomArtistSelector(this);
+	else if (t == Shuffle)
+		mSelector = new ShuffleSelector(this);
 }
 
 void Meow::TreeView::playFirst()
 {
-	if (QTreeWidgetItem *item = invisibleRootItem())
-		playAt(item);
+	playAt(mModel->nextNode(QModelIndex(), true));
 }
 
 void Meow::TreeView::clear()
@@ -558,48 +532,55 @@ void Meow::TreeView::clear()
 	player->stop();
 	mCurrent = 0;
 	mRandomPrevious = 0;
-	QTreeWidget::clear();
+	mFilterMatches.clear();
+	mFilterMatchesValid = false;
+	mModel->clear();
+	mSelector->cleared();
+}
+
+QModelIndex Meow::TreeView::current() const
+{
+	if (!mCurrent)
+		return QModelIndex();
+	return mModel->song(mCurrent);
 }
 
-void Meow::TreeView::playAt(QTreeWidgetItem *_item)
+void Meow::TreeView::playAt(const QModelIndex &index)
 {
-	Song *const cur = findAfter(_item);
-	if (!cur) return;
+	const QModelIndex cur = mModel->reveal(findAfter(index));
+	if (!cur.isValid()) return;
 
 	// see who is already auto-expanded
-	std::set<Node*> previouslyExpanded;
-	if (mCurrent)
+	std::set<QModelIndex> previouslyExpanded;
+	for (QModelIndex up = current().parent(); up.isValid(); up = up.parent())
 	{
-		for (Node *up = mCurrent; up; up = up->parent())
-		{
-			if (up->wasAutoExpanded)
-				previouslyExpanded.insert(up);
-		}
+		if (mModel->wasAutoExpanded(up))
+			previouslyExpanded.insert(up);
 	}
 
 	currentlyProcessingAutomaticExpansion = true;
 
-	for (Node *up = cur; up; up = up->parent())
+	for (QModelIndex up = cur.parent(); up.isValid(); up = up.parent())
 	{
-		if (up->wasAutoExpanded)
+		if (mModel->wasAutoExpanded(up))
 		{ // remove those from the list that will remain autoexpanded
 			previouslyExpanded.erase(up);
 		}
 		else
 		{ // and actually expand the rest
-			up->setExpanded(true);
-			up->setWasAutoExpanded(true);
+			setExpanded(up, true);
+			mModel->setWasAutoExpanded(up, true);
 		}
 	}
 
 	// those that were expanded but no longer need to be are collapsed
 	for (
-			std::set<Node*>::iterator i = previouslyExpanded.begin();
+			std::set<QModelIndex>::iterator i = previouslyExpanded.begin();
 			i != previouslyExpanded.end(); ++i
 		)
 	{
-		(*i)->setExpanded(false);
-		(*i)->setWasAutoExpanded(false);
+		setExpanded(*i, false);
+		mModel->setWasAutoExpanded(*i, false);
 	}
 	currentlyProcessingAutomaticExpansion = false;
 
@@ -607,198 +588,197 @@ void Meow::TreeView::playAt(QTreeWidgetItem *_item)
 #if QT_VERSION!=0x040703
 //#error This line might need to be removed with a Qt update
 #endif
-//	delete itemWidget(mCurrent, 0);
+//	delete indexWidget(current());
 #endif
-	removeItemWidget(mCurrent, 0);
-	mCurrent = cur;
-	File curFile = collection->getSong(cur->fileId());
+	const QModelIndex previous = current();
+	if (previous.isValid())
+		setIndexWidget(previous, 0);
+	mCurrent = mModel->fileId(cur);
+	File curFile = collection->getSong(mCurrent);
+	player->setGain(collection->loudness(mCurrent).gain(false));
 	player->play(curFile);
-	scrollToItem(cur);
-	setItemWidget(cur, 0, new SongWidget(this, this, player));
+	scrollTo(cur);
+	setIndexWidget(cur, new SongWidget(this, this, player));
 }
 
 void Meow::TreeView::nextSong()
 {
-	if (QTreeWidgetItem *item = mSelector->nextSong())
-		playAt(item);
+	const QModelIndex index = mSelector->nextSong();
+	if (index.isValid())
+		playAt(index);
 }
 
 void Meow::TreeView::filter(const QString &text)
 {
-	QTreeWidgetItem *item = invisibleRootItem();
-	if (!item) return;
+	const QStringList terms = Collection::searchTerms(text);
+	if (terms.isEmpty())
+	{
+		mFilterText = QString();
+		mFilterMatchesValid = false;
+		QModelIndexList changed;
+		mModel->filterSongs(0, changed);
+		applyFilter(changed);
+		return;
+	}
+	
+	if (
+			mFilterMatchesValid && !mFilterText.isEmpty()
+			&& text.startsWith(mFilterText)
+			&& narrowFilter(text, terms)
+		)
+		return;
+	
+	if (collection->hasSearchIndex())
+	{ // wait for searchFinished
+		mFilterText = text;
+		mFilterMatchesValid = false;
+		collection->search(text);
+		return;
+	}
+	
+	QModelIndexList changed;
+	mModel->filterLabels(text, changed);
+	applyFilter(changed);
+}
+
+bool Meow::TreeView::narrowFilter(const QString &text, const QStringList &terms)
+{
+	// only the songs that matched before can match now
+	QSet<FileId> matches;
+	for (QSet<FileId>::const_iterator i = mFilterMatches.begin(); i != mFilterMatches.end(); ++i)
+	{
+		const TreeModel::LabelMatch m = mModel->matchLabels(*i, terms);
+		if (m == TreeModel::Matched)
+			matches.insert(*i);
+		else if (m == TreeModel::Unsure)
+			return false; // so ask the index
+	}
+	mFilterText = text;
+	mFilterMatches = matches;
+	QModelIndexList changed;
+	mModel->filterSongs(&mFilterMatches, changed);
+	applyFilter(changed);
+	return true;
+}
+
+void Meow::TreeView::searchFinished(const QString &text, const QVector<FileId> &files)
+{
+	if (text != mFilterText)
+		return;
 	
-	for (int i=0; i < item->childCount(); i++)
-		filter(item->child(i), text);
+	mFilterMatches.clear();
+	mFilterMatches.reserve(files.size());
+	for (QVector<FileId>::const_iterator i = files.begin(); i != files.end(); ++i)
+		mFilterMatches.insert(*i);
+	mFilterMatchesValid = true;
+	QModelIndexList changed;
+	mModel->filterSongs(&mFilterMatches, changed);
+	applyFilter(changed);
 }
 
-void Meow::TreeView::stopFilter()
+void Meow::TreeView::applyFilter(const QModelIndexList &changed)
 {
-	filter("");
+	setUpdatesEnabled(false);
+	for (QModelIndexList::const_iterator i = changed.begin(); i != changed.end(); ++i)
+		setRowHidden(i->row(), i->parent(), mModel->isHidden(*i));
+	setUpdatesEnabled(true);
 }
 
-bool Meow::TreeView::filter(QTreeWidgetItem *branch, const QString &text)
+void Meow::TreeView::stopFilter()
 {
-	if (text.isEmpty() || branch->text(0).contains(text, Qt::CaseInsensitive))
-	{
-		branch->setHidden(false);
-		for (int i=0; i < branch->childCount(); i++)
-			filter(branch->child(i), "");
-		return true;
-	}
-	else
-	{
-		bool has = false;
-		for (int i=0; i < branch->childCount(); i++)
-			has = filter(branch->child(i), text) || has;
-		branch->setHidden(!has);
-		return has;
-	}
+	filter("");
 }
 
 void Meow::TreeView::previousSong()
 {
-	if (QTreeWidgetItem *item = mSelector->previousSong())
-		playAt(item);
+	const QModelIndex index = mSelector->previousSong();
+	if (index.isValid())
+		playAt(index);
 }
 
-void Meow::TreeView::manuallyExpanded(QTreeWidgetItem *_item)
+void Meow::TreeView::manuallyExpanded(const QModelIndex &index)
 {
 	if (currentlyProcessingAutomaticExpansion)
 		return;
-	if (Node *n = dynamic_cast<Node*>(_item))
-		n->setWasAutoExpanded(false);
+	mModel->setWasAutoExpanded(index, false);
+}
+
+void Meow::TreeView::branchCollapsed(const QModelIndex &index)
+{
+	// the playing song has a widget on it, keep it
+	const QModelIndex cur = current();
+	if (cur.isValid() && (inside(cur, TreeModel::ArtistNode) == index || cur.parent() == index))
+		return;
+	mModel->reclaim(index);
+}
+
+void Meow::TreeView::rowsInserted(const QModelIndex &parent, int start, int end)
+{
+	QTreeView::rowsInserted(parent, start, end);
+	
+	// an album's songs come in when it's materialized, and
+	// the filter may have hidden some of them already
+	for (int row=start; row <= end; row++)
+	{
+		if (mModel->isHidden(mModel->index(row, 0, parent)))
+			setRowHidden(row, parent, true);
+	}
 }
 
 void Meow::TreeView::mousePressEvent(QMouseEvent *e)
 {
-	QTreeWidget::mousePressEvent(e);
-	QModelIndex index = indexAt(e->pos());
+	QTreeView::mousePressEvent(e);
+	const QModelIndex index = indexAt(e->pos());
 	if (index.column() != 0) return;
-	QTreeWidgetItem *const at = itemAt(e->pos());
 	
 	int indent=0;
-	for (QTreeWidgetItem *up = at; up ; up = up->parent())
+	for (QModelIndex up = index; up.isValid(); up = up.parent())
 		indent++;
 	
 	if (e->pos().x() < indent*indentation())
 		return;
 	
-	if (e->button() == Qt::LeftButton && !itemWidget(at, 0))
-		emit kdeActivated(at);
+	if (e->button() == Qt::LeftButton && !indexWidget(index))
+		emit kdeActivated(index);
 	else if (e->button() == Qt::RightButton)
 	{
-		emit kdeContextMenu(at, e->globalPos());
+		emit kdeContextMenu(index, e->globalPos());
 		emit kdeContextMenu(e->globalPos());
 	}
 }
 
-Meow::TreeView::Song* Meow::TreeView::findAfter(QTreeWidgetItem *_item)
-{
-	if (!_item)
-		return 0;
-	
-	for (QTreeWidgetItemIterator it(_item, QTreeWidgetItemIterator::NotHidden); *it; ++it)
-	{
-		QTreeWidgetItem *n = *it;
-		if (Song *s = dynamic_cast<Song*>(n))
-			return s;
-	}
-	
-	return 0;
-}
-
-static QString canonical(const QString &t)
+QModelIndex Meow::TreeView::findAfter(const QModelIndex &index)
 {
-	QString s = t.toCaseFolded().simplified();
-	pad(s);
-	return s;
-}
-
-static void insertSorted(
-		QTreeWidgetItem *into, QTreeWidgetItem *child,
-		const QString &childCanonicalLabel
-	)
-{
-	const int children = into->childCount();
-	int upper=children;
-	int lower=0;
-	while (upper!=lower)
-	{ // a binary search
-		int i = lower+(upper-lower)/2;
-		QTreeWidgetItem *const ch = into->child(i);
-		QString t = canonical(ch->text(0));
-		if (childCanonicalLabel > t)
-			lower = i+1;
-		else
-			upper = i;
-	}
-	into->insertChild(lower, child);
-}
-
-template<typename Child, typename Parent>
-static Child* fold(Parent *into, const QString &label)
-{
-	const QString clabel = canonical(label);
-	const int children = into->childCount();
-	for (int i=0; i != children; ++i)
-	{ // return the child that already exists
-		QTreeWidgetItem *const ch = into->child(i);
-		if (canonical(ch->text(0)) == clabel)
-		{
-			return static_cast<Child*>(ch);
-			break;
-		}
-	}
-	
-	// or make a new one
-	Child *const c = new Child(label);
-	insertSorted(into, c, clabel);
-	c->changeColorsToReflectAutoExpansion();
-	return c;
+	if (TreeModel::type(index) == TreeModel::SongNode && !mModel->isHidden(index))
+		return index;
+	return mModel->nextSong(index, true);
 }
 
 void Meow::TreeView::addFileAndPlay(const File &file)
 {
-	Song *const song = addFile(file);
-	if (song)
+	const QModelIndex song = addFile(file);
+	if (song.isValid())
 		playAt(song);
 }
 
 
-Meow::TreeView::Song* Meow::TreeView::addFile(const File &file)
+QModelIndex Meow::TreeView::addFile(const File &file)
 {
 	QPoint under = QCursor::pos();
-	under = mapFromGlobal(under);
+	under = viewport()->mapFromGlobal(under);
 	
 	// keep the current item under the cursor while adding items
-	QTreeWidgetItem *const itemUnder = itemAt(under);
+	const QPersistentModelIndex indexUnder = indexAt(under);
 	int oldPos=0;
-	if (itemUnder)
-		oldPos = visualItemRect(itemUnder).top();
+	if (indexUnder.isValid())
+		oldPos = visualRect(indexUnder).top();
 
-	Song *const song = new Song(file);
-
-	if (file.displayByAlbum())
-	{
-		Album *album   = fold<Album>(invisibleRootItem(), file.album());
-		insertSorted(album, song, canonical(song->text(0)));
-		album->songAdded();
-	}
-	else
-	{
-		Artist *artist = fold<Artist>(invisibleRootItem(), file.artist());
-		Album *album  = fold<Album>(artist, file.album());
-		insertSorted(album, song, canonical(song->text(0)));
-		artist->songAdded();
-	}
-	
-	song->changeColorsToReflectAutoExpansion();
+	const QModelIndex song = mModel->addFile(file);
 	
-	if (itemUnder)
+	if (indexUnder.isValid())
 	{
 		// requires: setVerticalScrollMode(ScrollPerPixel); in the ctor
-		QRect newArea = visualItemRect(itemUnder);
+		QRect newArea = visualRect(indexUnder);
 		//now scroll vertically so that newArea is oldArea
 		int diff = newArea.top() - oldPos;
 		QScrollBar *const vs = verticalScrollBar();
@@ -809,205 +789,162 @@ Meow::TreeView::Song* Meow::TreeView::addFile(const File &file)
 	
 }
 
-static void deleteBranch(QTreeWidgetItem *parent)
+void Meow::TreeView::addFiles(const QVector<File> &files)
 {
-	while (parent)
+	if (files.isEmpty())
+		return;
+	
+	// like addFile, but only lay out the tree once for the whole chunk
+	QPoint under = QCursor::pos();
+	under = viewport()->mapFromGlobal(under);
+	
+	const QPersistentModelIndex indexUnder = indexAt(under);
+	int oldPos=0;
+	if (indexUnder.isValid())
+		oldPos = visualRect(indexUnder).top();
+
+	setUpdatesEnabled(false);
+	mModel->addFiles(files);
+	
+	if (indexUnder.isValid())
 	{
-		QTreeWidgetItem *p = parent->parent();
-		if (parent->childCount() == 0)
-			delete parent;
-		else
-			break;
-		parent = p;
+		QRect newArea = visualRect(indexUnder);
+		int diff = newArea.top() - oldPos;
+		QScrollBar *const vs = verticalScrollBar();
+		vs->setValue(vs->value() + diff);
 	}
+	setUpdatesEnabled(true);
 }
 
-template <class T>
-inline T* Meow::TreeView::inside(QTreeWidgetItem *p)
+QModelIndex Meow::TreeView::inside(QModelIndex index, TreeModel::NodeType type)
 {
-	while (p)
+	while (index.isValid())
 	{
-		if (T* t = dynamic_cast<T*>(p))
-			return t;
-		p = p->parent();
+		if (TreeModel::type(index) == type)
+			return index;
+		index = index.parent();
 	}
-	return 0;
+	return QModelIndex();
 }
 
-template <class T, class RetType>
-inline RetType Meow::TreeView::callOn(QTreeWidgetItem *p, RetType (T::*function)())
+void Meow::TreeView::reloadFile(const File &file)
 {
-	if (T *t = inside<T>(p))
-		return (t->*function)();
+	if (!mModel->song(file.fileId()).isValid())
+		return;
 	
-	return RetType();
+	const bool isCurrent = file.fileId() == mCurrent;
+	if (isCurrent)
+		setIndexWidget(current(), 0);
+	
+	// this moves it to where it belongs now
+	const QModelIndex s = mModel->addFile(file);
+	if (isCurrent)
+		setIndexWidget(mModel->reveal(s), new SongWidget(this, this, player));
 }
 
-void Meow::TreeView::reloadFile(const File &file)
+void Meow::TreeView::removeFiles(const QVector<FileId> &files)
 {
-	Song *s=0;
-	//we have to find the song representing file
-	
-	QList<QTreeWidgetItem*> selected = selectedItems();
-	// maybe the reloaded file is currently playing...
-	if (mCurrent && mCurrent->fileId() == file.fileId())
-		s = mCurrent;
-	for (QList<QTreeWidgetItem*>::iterator i = selected.begin(); i != selected.end(); ++i)
-	{ // ... or selected
-		if (Song *_s = dynamic_cast<Song*>(*i))
-			if (_s->fileId() == file.fileId())
-			{
-				s = _s;
-				break;
-			}
-	}
-	
-	if (!s)
-	{ // find it the slow way, then
-		for (QTreeWidgetItemIterator it(this); *it; ++it)
+	for (QVector<FileId>::const_iterator i = files.begin(); i != files.end(); ++i)
+	{
+		if (*i == mCurrent)
 		{
-			QTreeWidgetItem *n = *it;
-			if (Song *_s = dynamic_cast<Song*>(n))
-				if (_s->fileId() == file.fileId())
-				{
-					s = _s;
-					break;
-				}
+			// it's not there to be played anymore
+			setIndexWidget(current(), 0);
+			mCurrent = 0;
+			player->stop();
 		}
+		if (*i == mRandomPrevious)
+			mRandomPrevious = 0;
+		mFilterMatches.remove(*i);
+
+		const QModelIndex song = mModel->song(*i);
+		if (song.isValid())
+			mModel->remove(song);
 	}
-	
-	if (s == mCurrent)
-		removeItemWidget(mCurrent, 0);
-	
-	// remove it
-	QTreeWidgetItem *parent = s->parent();
-	if (parent)
-		callOn(parent, &Artist::songRemoved);
-	if (!parent) parent = invisibleRootItem();
-	int index = parent->indexOfChild(s);
-	parent->takeChild(index);
-	deleteBranch(parent);
-	
-	// ok now insert it again
-	if (file.displayByAlbum())
-	{
-		Album *album   = fold<Album>(invisibleRootItem(), file.album());
-		insertSorted(album, s, canonical(s->text(0)));
-		album->songAdded();
-	}
-	else
-	{
-		Artist *artist = fold<Artist>(invisibleRootItem(), file.artist());
-		Album *album  = fold<Album>(artist, file.album());
-		insertSorted(album, s, canonical(s->text(0)));
-		artist->songAdded();
-	}
-	
-	s->changeColorsToReflectAutoExpansion();
-	s->setText(file);
-	if (s == mCurrent)
-		setItemWidget(s, 0, new SongWidget(this, this, player));
 }
 
-static QTreeWidgetItem* hasAsParent(QTreeWidgetItem *item, const QList<QTreeWidgetItem*> &oneOfThese)
+static QModelIndex hasAsParent(const QModelIndex &index, const QModelIndexList &oneOfThese)
 {
-	for (QTreeWidgetItem *up = item; up; up = up->parent())
+	for (QModelIndex up = index; up.isValid(); up = up.parent())
 	{
 		if (oneOfThese.contains(up))
 			return up;
 	}
-	return 0;
+	return QModelIndex();
 }
 
 void Meow::TreeView::removeSelected()
 {
-	QList<QTreeWidgetItem*> selected = selectedItems();
+	QModelIndexList selected = selectionModel()->selectedIndexes();
 	
 	// first pass, go over selected making sure it doesn't contain any
 	// children of its own items. this is O(n²) but that's ok, because
 	// n should be pretty small, and it will get smaller every iteration
-	for (QList<QTreeWidgetItem*>::iterator i = selected.begin(); i != selected.end(); )
+	for (QModelIndexList::iterator i = selected.begin(); i != selected.end(); )
 	{
-		QList<QTreeWidgetItem*>::iterator prevI = i;
-		QTreeWidgetItem*const item  = *i;
-		++i;
-		
-		for (QTreeWidgetItem *up = item->parent(); up; up = up->parent())
-		{
-			if (selected.contains(up))
-				selected.erase(prevI);
-		}
+		if (hasAsParent(i->parent(), selected).isValid())
+			i = selected.erase(i);
+		else
+			++i;
 	}
 	
-	QTreeWidgetItem *nextToBePlaying;
+	QPersistentModelIndex nextToBePlaying;
 	// also consider the situation in which I delete the currently playing item
-	if ((nextToBePlaying = hasAsParent(mCurrent, selected)))
+	QModelIndex up;
+	if ((up = hasAsParent(current(), selected)).isValid())
 	{
 		// so as up is in the "to be deleted" list
 		// then the first sibling of up should be playable
 		// if it is also not in that list
 		do
 		{
-			nextToBePlaying = nonChildAfter(nextToBePlaying);
-		} while (selected.contains(nextToBePlaying));
+			up = nonChildAfter(up);
+		} while (selected.contains(up));
+		nextToBePlaying = up;
+		setIndexWidget(current(), 0);
 		mCurrent = 0;
 		player->stop();
 	}
-	if (mRandomPrevious && hasAsParent(mRandomPrevious, selected))
+	if (mRandomPrevious && hasAsParent(mModel->song(mRandomPrevious), selected).isValid())
 		mRandomPrevious = 0;
 	
-	
 	std::vector<FileId> files;
 	// second pass: delete the stuff
-	for (QList<QTreeWidgetItem*>::iterator i = selected.begin(); i != selected.end(); )
+	QList<QPersistentModelIndex> toRemove;
+	for (QModelIndexList::const_iterator i = selected.begin(); i != selected.end(); ++i)
 	{
-		QTreeWidgetItem *const item = *i;
-		++i; // access the next item before we delete the old one
-		QTreeWidgetItem *const next = nonChildAfter(item);
-		
-		for (QTreeWidgetItemIterator it(item); *it != next; ++it)
-		{
-			if (Song *s = dynamic_cast<Song*>(*it))
-				files.push_back(s->fileId());
-		}
+		mModel->songsUnder(*i, files);
+		toRemove += *i;
 	}
 	collection->remove(files);
-	while (!selected.isEmpty())
+	for (std::vector<FileId>::const_iterator i = files.begin(); i != files.end(); ++i)
+		mFilterMatches.remove(*i);
+	
+	for (QList<QPersistentModelIndex>::const_iterator i = toRemove.begin(); i != toRemove.end(); ++i)
 	{
-		QTreeWidgetItem *const item = selected.takeFirst();
-		QTreeWidgetItem *const parent = item->parent();
-		if (parent)
-		{
-			if (dynamic_cast<Song*>(item))
-				callOn(parent, &Artist::songRemoved);
-		}
-
-		delete item;
-		deleteBranch(parent);
+		// removing one can take an emptied branch with it
+		if (i->isValid())
+			mModel->remove(*i);
 	}
 	
-	if (nextToBePlaying)
+	if (nextToBePlaying.isValid())
 		playAt(nextToBePlaying);
 }
 
-QTreeWidgetItem *Meow::TreeView::siblingAfter(QTreeWidgetItem *item)
+QModelIndex Meow::TreeView::siblingAfter(const QModelIndex &index)
 {
-	QTreeWidgetItem *parent = item->parent();
-	if (!parent) parent = invisibleRootItem();
-	int itemindex = parent->indexOfChild(item);
-	if (itemindex+1 == parent->childCount())
-		return 0;
-	return parent->child(itemindex+1);
+	return index.sibling(index.row()+1, 0);
 }
 
-QTreeWidgetItem *Meow::TreeView::nonChildAfter(QTreeWidgetItem *item)
+QModelIndex Meow::TreeView::nonChildAfter(const QModelIndex &index)
 {
-	QTreeWidgetItem *next;
-	while (! (next = siblingAfter(item)))
+	QModelIndex item = index;
+	QModelIndex next;
+	while (!(next = siblingAfter(item)).isValid())
 	{
-		item = item->parent();
-		if (!item)
-			return 0;
+		item = item.parent();
+		if (!item.isValid())
+			return QModelIndex();
 	}
 	
 	return next;
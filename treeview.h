@@ -1,7 +1,12 @@
 #ifndef MEOW_TREEVIEW_H
 #define MEOW_TREEVIEW_H
 
-#include <qtreewidget.h>
+#include <qtreeview.h>
+#include <qvector.h>
+#include <qset.h>
+
+#include <db/file.h>
+#include "treemodel.h"
 
 namespace Meow
 {
@@ -9,99 +14,104 @@ class File;
 class Player;
 class Collection;
 
-class TreeView : public QTreeWidget
+class TreeView : public QTreeView
 {
 	Q_OBJECT
-	
-	struct Node;
-	struct Artist;
-	struct Album;
-	struct Song;
-	
+
 	class Selector;
 	class LinearSelector;
 	class RandomSongSelector;
-	template<typename BranchType>
+	template<TreeModel::NodeType BranchType>
 	class RandomBranchSelector;
-	typedef RandomBranchSelector<Meow::TreeView::Album>
+	typedef RandomBranchSelector<TreeModel::AlbumNode>
 		RandomAlbumSelector;
-	typedef RandomBranchSelector<Meow::TreeView::Artist>
+	typedef RandomBranchSelector<TreeModel::ArtistNode>
 		RandomArtistSelector;
-	
+	class ShuffleSelector;
+
 	class SongWidget;
-	
+
 	Player *const player;
 	Collection *const collection;
+	TreeModel *const mModel;
 	// mRandomPrevious is here so that when removing items, it's fast to check
-	Song *mCurrent, *mRandomPrevious;
-	
+	FileId mCurrent, mRandomPrevious;
+
 	Selector *mSelector;
-	
+
 	bool currentlyProcessingAutomaticExpansion;
-	
+
+	// the songs that match mFilterText, if mFilterMatchesValid
+	QString mFilterText;
+	QSet<FileId> mFilterMatches;
+	bool mFilterMatchesValid;
+
 public:
 	TreeView(QWidget *parent, Player *player, Collection *collection);
-	
+
 	QList<File> selectedFiles();
 	QList<QString> selectedAlbums();
-	
-	int childCount() const { return topLevelItemCount(); }
-	QTreeWidgetItem *child(int i) const { return topLevelItem(i); }
-	
+
 	enum SelectorType
 	{ // this order is significant
-		Linear=0, RandomSong, RandomAlbum, RandomArtist
+		Linear=0, RandomSong, RandomAlbum, RandomArtist, Shuffle
 	};
-	
+
 	void setSelector(SelectorType t);
-	
+
 	void playFirst();
 
 public slots:
 	void clear();
-	
+
 public slots:
 	void removeSelected();
-	
+
 	void previousSong();
 	void nextSong();
-	
+
 	void filter(const QString &text);
 	void stopFilter();
 
 private:
-	bool filter(QTreeWidgetItem *branch, const QString &text);
+	bool narrowFilter(const QString &text, const QStringList &terms);
+	void applyFilter(const QModelIndexList &changed);
+
+private slots:
+	void searchFinished(const QString &text, const QVector<FileId> &files);
 
 protected slots:
-	Song* addFile(const File &file);
+	QModelIndex addFile(const File &file);
+	void addFiles(const QVector<File> &files);
 	void addFileAndPlay(const File &file);
 	void reloadFile(const File &file);
-	
-	void playAt(QTreeWidgetItem *);
-	void manuallyExpanded(QTreeWidgetItem *);
+	void removeFiles(const QVector<FileId> &files);
+
+	void playAt(const QModelIndex &index);
+	void manuallyExpanded(const QModelIndex &index);
+	void branchCollapsed(const QModelIndex &index);
 
 signals:
-	void kdeActivated(QTreeWidgetItem*);
-	void kdeContextMenu(QTreeWidgetItem*, const QPoint &at);
+	void kdeActivated(const QModelIndex &index);
+	void kdeContextMenu(const QModelIndex &index, const QPoint &at);
 	void kdeContextMenu(const QPoint &at);
 
 protected:
 	virtual void mousePressEvent(QMouseEvent *e);
+	virtual void rowsInserted(const QModelIndex &parent, int start, int end);
 
 private:
-	Song *findAfter(QTreeWidgetItem *);
-	
-	QTreeWidgetItem *siblingAfter(QTreeWidgetItem *item);
-	QTreeWidgetItem *nonChildAfter(QTreeWidgetItem *item);
-	template <class T, class RetType>
-	inline static RetType callOn(QTreeWidgetItem *parentOf, RetType (T::*function)() );
-	template <class T>
-	inline static T* inside(QTreeWidgetItem *parentOf);
+	QModelIndex current() const;
+	QModelIndex findAfter(const QModelIndex &index);
+
+	QModelIndex siblingAfter(const QModelIndex &index);
+	QModelIndex nonChildAfter(const QModelIndex &index);
+	static QModelIndex inside(QModelIndex index, TreeModel::NodeType type);
 };
 
 
 }
 
 #endif
- 
+
 // kate: space-indent off; replace-tabs off;
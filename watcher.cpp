@@ -0,0 +1,409 @@
+#include "watcher.h"
+#include "directoryadder.h"
+
+#include <db/collection.h>
+
+#include <qapplication.h>
+#include <qthread.h>
+#include <qevent.h>
+#include <qtimer.h>
+#include <qdir.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <qdatetime.h>
+#include <qhash.h>
+#include <qset.h>
+#include <qpair.h>
+#include <qsocketnotifier.h>
+
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+class SyncedEvent : public QEvent
+{
+public:
+	static const Type type = QEvent::Type(QEvent::User+14);
+	SyncedEvent(int generation)
+		: QEvent(type), generation(generation)
+	{}
+
+	const int generation;
+	// the directories now watched, by watch descriptor
+	QHash<int, QString> directories;
+	QStringList changed, removed;
+};
+
+// the changes are given to the collection once
+// none have come for this long
+const int settleMsecs = 1000;
+
+#ifdef __linux__
+const uint32_t watchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+	| IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+#endif
+
+}
+
+struct Meow::Watcher::Private
+{
+	Collection *collection;
+	int fd;
+	QSocketNotifier *notifier;
+	QTimer settle;
+
+	QHash<int, QString> directories;
+
+	// what happened since the last flush
+	QSet<QString> changed, removed;
+	// folders that have to be listed, because they're new or
+	// because the kernel had to drop some of their events
+	QStringList unsynced;
+
+	Sync *sync;
+	// incremented by stop, so that a Sync that was
+	// already under way can be ignored
+	int generation;
+};
+
+/**
+ * Lists folders in the background, watching each directory in them,
+ * and compares what's there with what the collection has
+ **/
+class Meow::Watcher::Sync : public QThread
+{
+	Watcher *const w;
+	Collection *const collection;
+	const int fd;
+	const QStringList folders;
+	SyncedEvent *const e;
+	// what's in e->directories, for stop() after e is posted
+	QHash<int, QString> watched;
+
+	void watch(const QString &path)
+	{
+#ifdef __linux__
+		const int wd = inotify_add_watch(fd, QFile::encodeName(path).data(), watchMask);
+		if (wd >= 0)
+			watched.insert(wd, path);
+#else
+		Q_UNUSED(path);
+#endif
+	}
+
+	void sync(const QString &folder)
+	{
+		// an unmounted disk is not a reason to forget its songs
+		if (!QFileInfo(folder).isDir())
+			return;
+
+		QHash<QString, uint> known = collection->modificationTimes(folder);
+
+		// as in DirectoryAdder, the path each directory was found at
+		// and the one it really is, so that symlinks can't loop
+		QSet<QString> visited;
+		QList<QPair<QString, QString> > pending;
+		pending.append(qMakePair(folder, QFileInfo(folder).canonicalFilePath()));
+		visited.insert(pending.first().second);
+
+		while (!pending.isEmpty())
+		{
+			const QPair<QString, QString> dir = pending.takeLast();
+			watch(dir.first);
+
+			const QFileInfoList entries = QDir(dir.first).entryInfoList(
+					QDir::AllEntries | QDir::NoDotAndDotDot, QDir::NoSort
+				);
+			for (QFileInfoList::const_iterator i = entries.begin(); i != entries.end(); ++i)
+			{
+				if (i->isDir())
+				{
+					const QString real = i->isSymLink()
+						? i->canonicalFilePath()
+						: dir.second + '/' + i->fileName();
+					if (!real.isEmpty() && !visited.contains(real))
+					{
+						visited.insert(real);
+						pending.append(qMakePair(i->filePath(), real));
+					}
+				}
+				else if (i->isFile())
+				{
+					QHash<QString, uint>::iterator k = known.find(i->filePath());
+					if (k == known.end())
+					{
+						if (DirectoryAdder::isAudioFile(i->filePath()))
+							e->changed.append(i->filePath());
+					}
+					else
+					{
+						// 0 is a song whose tags were read before the
+						// times were kept, it's assumed to be current
+						if (*k && *k != i->lastModified().toTime_t())
+							e->changed.append(i->filePath());
+						known.erase(k);
+					}
+				}
+			}
+		}
+
+		// what wasn't seen is gone
+		for (QHash<QString, uint>::const_iterator k = known.begin(); k != known.end(); ++k)
+			e->removed.append(k.key());
+	}
+
+public:
+	Sync(Watcher *w, Collection *collection, int fd, const QStringList &folders, int generation)
+		: w(w), collection(collection), fd(fd), folders(folders),
+			e(new SyncedEvent(generation))
+	{
+	}
+
+	virtual void run()
+	{
+		for (QStringList::const_iterator i = folders.begin(); i != folders.end(); ++i)
+			sync(*i);
+		e->directories = watched;
+		QApplication::postEvent(w, e);
+	}
+
+	/**
+	 * the directories this added watches for, once it's finished
+	 **/
+	const QHash<int, QString> &directories() const { return watched; }
+};
+
+
+Meow::Watcher::Watcher(Collection *collection, QObject *parent)
+	: QObject(parent)
+{
+	d = new Private;
+	d->collection = collection;
+	d->fd = -1;
+	d->notifier = 0;
+	d->sync = 0;
+	d->generation = 0;
+
+	d->settle.setSingleShot(true);
+	d->settle.setInterval(settleMsecs);
+	connect(&d->settle, SIGNAL(timeout()), SLOT(flush()));
+
+#ifdef __linux__
+	d->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (d->fd < 0)
+	{
+		std::cerr << "Can't watch folders, inotify_init failed" << std::endl;
+		return;
+	}
+	d->notifier = new QSocketNotifier(d->fd, QSocketNotifier::Read, this);
+	connect(d->notifier, SIGNAL(activated(int)), SLOT(readEvents()));
+#endif
+}
+
+Meow::Watcher::~Watcher()
+{
+	stop();
+#ifdef __linux__
+	if (d->fd >= 0)
+		::close(d->fd);
+#endif
+	delete d;
+}
+
+bool Meow::Watcher::isSupported()
+{
+#ifdef __linux__
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Meow::Watcher::watch(const QString &folder)
+{
+	const QString path = QDir::cleanPath(QFileInfo(folder).absoluteFilePath());
+	d->collection->setWatched(path, true);
+	d->unsynced.append(path);
+	startSync();
+}
+
+void Meow::Watcher::unwatch(const QString &folder)
+{
+	const QString path = QDir::cleanPath(QFileInfo(folder).absoluteFilePath());
+	d->collection->setWatched(path, false);
+	d->unsynced.removeAll(path);
+
+	for (QHash<int, QString>::iterator i = d->directories.begin(); i != d->directories.end(); )
+	{
+		if (*i == path || i->startsWith(path + '/'))
+		{
+#ifdef __linux__
+			inotify_rm_watch(d->fd, i.key());
+#endif
+			i = d->directories.erase(i);
+		}
+		else
+			++i;
+	}
+}
+
+QStringList Meow::Watcher::folders() const
+{
+	return d->collection->watchedFolders();
+}
+
+void Meow::Watcher::restart()
+{
+	stop();
+	d->unsynced = d->collection->watchedFolders();
+	startSync();
+}
+
+void Meow::Watcher::stop()
+{
+	d->generation++;
+	if (d->sync)
+	{
+		d->sync->wait();
+		// its event will be ignored, so its watches are removed
+		// now, before another Sync can be given the same ones
+		// for the same directories
+#ifdef __linux__
+		const QHash<int, QString> &watched = d->sync->directories();
+		for (QHash<int, QString>::const_iterator i = watched.begin(); i != watched.end(); ++i)
+		{
+			if (!d->directories.contains(i.key()))
+				inotify_rm_watch(d->fd, i.key());
+		}
+#endif
+		delete d->sync;
+		d->sync = 0;
+	}
+#ifdef __linux__
+	for (QHash<int, QString>::const_iterator i = d->directories.begin(); i != d->directories.end(); ++i)
+		inotify_rm_watch(d->fd, i.key());
+#endif
+	d->directories.clear();
+	d->changed.clear();
+	d->removed.clear();
+	d->unsynced.clear();
+	d->settle.stop();
+}
+
+void Meow::Watcher::startSync()
+{
+	if (d->sync || d->unsynced.isEmpty() || d->fd < 0)
+		return;
+	d->sync = new Sync(this, d->collection, d->fd, d->unsynced, d->generation);
+	d->unsynced.clear();
+	d->sync->start(QThread::LowPriority);
+}
+
+void Meow::Watcher::readEvents()
+{
+#ifdef __linux__
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t length;
+	while ((length = ::read(d->fd, buffer, sizeof(buffer))) > 0)
+	{
+		for (const char *at = buffer; at < buffer + length; )
+		{
+			const inotify_event *const ev = reinterpret_cast<const inotify_event*>(at);
+			at += sizeof(inotify_event) + ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW)
+			{
+				// there's no telling what was lost, so look at everything
+				d->unsynced = d->collection->watchedFolders();
+				continue;
+			}
+
+			QHash<int, QString>::iterator dir = d->directories.find(ev->wd);
+			if (dir == d->directories.end())
+				continue;
+			if (ev->mask & IN_IGNORED)
+			{
+				d->directories.erase(dir);
+				continue;
+			}
+
+			const QString path = *dir + '/' + QFile::decodeName(ev->name);
+			if (ev->mask & IN_ISDIR)
+			{
+				if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+					d->unsynced.append(path);
+				else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+					d->removed.insert(path);
+			}
+			else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+			{
+				if (DirectoryAdder::isAudioFile(path))
+				{
+					d->changed.insert(path);
+					d->removed.remove(path);
+				}
+			}
+			else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+			{
+				d->removed.insert(path);
+				d->changed.remove(path);
+			}
+		}
+	}
+
+	// a file being copied in is written to many times
+	d->settle.start();
+#endif
+}
+
+void Meow::Watcher::flush()
+{
+	if (!d->removed.isEmpty())
+		d->collection->removeUrls(d->removed.toList());
+	if (!d->changed.isEmpty())
+	{
+		d->collection->startJob();
+		d->collection->update(d->changed.toList());
+		d->collection->scheduleFinishJob();
+	}
+	d->removed.clear();
+	d->changed.clear();
+
+	startSync();
+}
+
+bool Meow::Watcher::event(QEvent *e)
+{
+	if (e->type() != SyncedEvent::type)
+		return QObject::event(e);
+
+	SyncedEvent *const se = static_cast<SyncedEvent*>(e);
+	// stop() already removed the watches of an old one
+	if (se->generation != d->generation)
+		return true;
+
+	d->sync->wait();
+	delete d->sync;
+	d->sync = 0;
+
+	for (QHash<int, QString>::const_iterator i = se->directories.begin(); i != se->directories.end(); ++i)
+		d->directories.insert(i.key(), *i);
+	for (int i=0; i < se->changed.size(); i++)
+	{
+		d->changed.insert(se->changed[i]);
+		d->removed.remove(se->changed[i]);
+	}
+	for (int i=0; i < se->removed.size(); i++)
+		d->removed.insert(se->removed[i]);
+
+	flush();
+	return true;
+}
+
+// kate: space-indent off; replace-tabs off;
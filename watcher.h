@@ -0,0 +1,75 @@
+#ifndef MEOW_WATCHER_H
+#define MEOW_WATCHER_H
+
+#include <qobject.h>
+#include <qstringlist.h>
+
+namespace Meow
+{
+
+class Collection;
+
+/**
+ * Keeps a collection in sync with the folders it watches
+ * (@ref Collection::watchedFolders): songs that are written, moved
+ * or deleted there are reloaded, added or removed.
+ *
+ * The kernel tells us about changes with inotify, so nothing is
+ * scanned while nothing changes. The changes are collected for a
+ * moment and then given to the collection all at once. When a folder
+ * is first watched, when a new one appears, and if the kernel drops
+ * events, the folder is listed and compared with the modification
+ * times in the collection instead.
+ *
+ * Only Linux has inotify, elsewhere this does nothing
+ **/
+class Watcher : public QObject
+{
+	Q_OBJECT
+	struct Private;
+	class Sync;
+	Private *d;
+
+public:
+	Watcher(Collection *collection, QObject *parent);
+	~Watcher();
+
+	static bool isSupported();
+
+	/**
+	 * keep @p folder in sync from now on, including after a restart
+	 **/
+	void watch(const QString &folder);
+	/**
+	 * stop watching @p folder, its songs stay in the collection
+	 **/
+	void unwatch(const QString &folder);
+	QStringList folders() const;
+
+public slots:
+	/**
+	 * stop watching anything until @ref restart
+	 **/
+	void stop();
+	/**
+	 * forget everything and start watching the collection's
+	 * folders, for when a different collection was opened
+	 **/
+	void restart();
+
+private slots:
+	void readEvents();
+	void flush();
+
+protected:
+	virtual bool event(QEvent *e);
+
+private:
+	void startSync();
+};
+
+}
+
+#endif
+
+// kate: space-indent off; replace-tabs off;